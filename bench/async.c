@@ -0,0 +1,67 @@
+// 1 to 64 threads logging the same lines: crfprintf through stdio's lock
+// against craprintf into an async sink, both ending at /dev/null
+#include <crprintf.h>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static crprintf_async *sink;
+static FILE *stream;
+static size_t per_thread;
+
+static double now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+}
+
+static void *log_stdio(void *arg) {
+  int id = (int)(intptr_t)arg;
+  for (size_t i = 0; i < per_thread; i++)
+    crfprintf(stream, "<dim>[%3d]</dim> <green>ok</green> request %zu took <cyan>%d</cyan>us\n", id, i, (int)(i % 997));
+  return NULL;
+}
+
+static void *log_async(void *arg) {
+  int id = (int)(intptr_t)arg;
+  for (size_t i = 0; i < per_thread; i++)
+    craprintf(sink, "<dim>[%3d]</dim> <green>ok</green> request %zu took <cyan>%d</cyan>us\n", id, i, (int)(i % 997));
+  return NULL;
+}
+
+static double run(int threads, void *(*body)(void *)) {
+  pthread_t t[64];
+  double t0 = now_ns();
+  for (int i = 0; i < threads; i++) pthread_create(&t[i], NULL, body, (void *)(intptr_t)i);
+  for (int i = 0; i < threads; i++) pthread_join(t[i], NULL);
+  if (body == log_async) crprintf_async_flush(sink);
+  else fflush(stream);
+  return now_ns() - t0;
+}
+
+int main(int argc, char **argv) {
+  size_t total = (argc > 1) ? (size_t)atol(argv[1]) : 640000;
+  int fd = open("/dev/null", O_WRONLY);
+  stream = fdopen(dup(fd), "w");
+  sink = crprintf_async_open(fd, 1 << 20, CRPRINTF_ASYNC_BLOCK);
+  if (fd < 0 || !stream || !sink) return 1;
+
+  printf("%-8s %14s %14s %9s\n", "threads", "stdio ns/line", "async ns/line", "speedup");
+
+  for (int threads = 1; threads <= 64; threads *= 2) {
+    per_thread = total / (size_t)threads;
+    double lines = (double)(per_thread * (size_t)threads);
+    double a = run(threads, log_stdio) / lines;
+    double b = run(threads, log_async) / lines;
+    printf("%-8d %14.1f %14.1f %8.2fx\n", threads, a, b, a / b);
+  }
+
+  crprintf_async_close(sink);
+  fclose(stream);
+  close(fd);
+  return 0;
+}
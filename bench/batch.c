@@ -0,0 +1,82 @@
+// a 50k-row table printed one crprintf_exec per row against one crprintf_exec_batch
+#include <crprintf.h>
+
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct {
+  const char *name;
+  int pid;
+  double cpu;
+  size_t rss;
+  const char *state;
+} row_t;
+
+static const crprintf_field fields[] = {
+  CRPRINTF_FIELD(row_t, pid, CRPRINTF_INT),
+  CRPRINTF_FIELD(row_t, name, CRPRINTF_CSTR),
+  CRPRINTF_FIELD(row_t, cpu, CRPRINTF_DOUBLE),
+  CRPRINTF_FIELD(row_t, rss, CRPRINTF_SIZE),
+  CRPRINTF_FIELD(row_t, state, CRPRINTF_CSTR),
+};
+
+// %.1f goes through snprintf either way; the second table shows the per-row cost without it
+static const char *formats[] = {
+  "<dim><rpad=7>%d</rpad></dim> <bold><pad=16>%s</pad></bold> <cyan><rpad=6>%.1f</rpad></cyan> <rpad=12>%zu</rpad> <green>%s</green>\n",
+  "<dim>%7d</dim> <bold>%-16s</bold> <cyan>%6.0f</cyan> %12zu <green>%s</green>\n",
+};
+
+static double now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+  size_t count = (argc > 1) ? (size_t)atol(argv[1]) : 50000;
+  int rounds = (argc > 2) ? atoi(argv[2]) : 20;
+  static const char *names[] = { "init", "sshd", "postgres", "node", "crprintf-bench", "kworker/0:1" };
+  static const char *states[] = { "running", "sleeping", "idle" };
+
+  row_t *rows = malloc(count * sizeof(*rows));
+  if (!rows) return 1;
+  for (size_t i = 0; i < count; i++)
+    rows[i] = (row_t){ names[i % 6], (int)(i * 7 + 1), (double)(i % 1000) / 10.0, i * 4096, states[i % 3] };
+
+  FILE *sink = fopen("/dev/null", "w");
+  if (!sink) return 1;
+
+  crprintf_record_desc desc = { sizeof(row_t), sizeof(fields) / sizeof(*fields), fields };
+  printf("%-6s %-8s %8s %12s %12s\n", "table", "mode", "rows", "ms/table", "ns/row");
+
+  for (size_t t = 0; t < sizeof(formats) / sizeof(*formats); t++) {
+    crprintf_compiled *prog = crprintf_compile(formats[t]);
+
+    for (int color = 1; color >= 0; color--) {
+      crprintf_set_color(color);
+      double per_row = 0, batch = 0;
+
+      for (int r = 0; r < rounds; r++) {
+        double t0 = now_ns();
+        for (size_t i = 0; i < count; i++)
+          crprintf_exec(prog, sink, rows[i].pid, rows[i].name, rows[i].cpu, rows[i].rss, rows[i].state);
+        double t1 = now_ns();
+        if (crprintf_exec_batch(prog, sink, rows, count, &desc) < 0) return 1;
+        double t2 = now_ns();
+
+        per_row += t1 - t0;
+        batch += t2 - t1;
+      }
+
+      const char *mode = color ? "color" : "plain";
+      printf("%-6zu %-8s %8zu %12.2f %12.1f  per-row\n", t, mode, count, per_row / rounds / 1e6, per_row / rounds / (double)count);
+      printf("%-6zu %-8s %8zu %12.2f %12.1f  batch (%.2fx)\n", t, mode, count, batch / rounds / 1e6, batch / rounds / (double)count, per_row / batch);
+    }
+
+    crprintf_compiled_free(prog);
+  }
+
+  fclose(sink);
+  free(rows);
+  return 0;
+}
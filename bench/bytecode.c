@@ -0,0 +1,60 @@
+// compiled together with the library source so program internals are reachable
+#include "crprintf.c"
+
+#include <time.h>
+
+static const char *templates[] = {
+  "<bold><green>❯</green></bold> <dim>%s</dim> <cyan>(%s)</cyan> ",
+  "<blue>%s</blue><dim>:</dim><yellow>%d</yellow><dim>:</dim><yellow>%d</yellow> <red>error</red>: %s\n",
+  "  <pad=18><green>%s</green></pad> %s\n",
+  "<rpad=8><bold>%d</bold></rpad> <pad=24>%s</pad> <rpad=10>%zu</rpad> <dim>%x</dim>\n",
+  "<magenta>fn</magenta> <bold>%s</bold>(<cyan>%s</cyan>: <yellow>%s</yellow>) <dim>-></dim> <cyan>%s</cyan>",
+  "[<gray>%s</gray>] <bold_red>%-5s</bold_red> <pad=12>%s</pad> %s\n",
+};
+
+static const char *names[] = { "ok", "src/parser.c", "x", "value", "main", "info" };
+
+static void render(crprintf_compiled *prog, char *buf, size_t size, int t, int i) {
+  const char *s = names[i % 6];
+  switch (t) {
+    case 0: crsprintf_compiled(buf, size, NULL, prog, s, names[(i + 1) % 6]); break;
+    case 1: crsprintf_compiled(buf, size, NULL, prog, s, i, i & 63, s); break;
+    case 2: crsprintf_compiled(buf, size, NULL, prog, s, s); break;
+    case 3: crsprintf_compiled(buf, size, NULL, prog, i, s, (size_t)i * 7, i); break;
+    case 4: crsprintf_compiled(buf, size, NULL, prog, s, s, s, s); break;
+    case 5: crsprintf_compiled(buf, size, NULL, prog, s, s, s, s); break;
+  }
+}
+
+int main(int argc, char **argv) {
+  int rounds = (argc > 1) ? atoi(argv[1]) : 500000;
+  size_t count = sizeof(templates) / sizeof(*templates);
+  size_t fixed = 0, compact = 0;
+  char buf[512];
+
+  printf("%-4s %6s %12s %12s %10s\n", "tmpl", "insns", "fixed bytes", "bytecode", "ns/render");
+
+  for (size_t t = 0; t < count; t++) {
+    crprintf_compiled *prog = crprintf_compile(templates[t]);
+    struct timespec t0, t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < rounds; i++) {
+      render(prog, buf, sizeof(buf), (int)t, i);
+      __asm__ volatile("" : : "r"(buf) : "memory");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double ns = (double)(t1.tv_sec - t0.tv_sec) * 1e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+    size_t wide = prog->code_len * sizeof(instruction_t);
+    printf("%-4zu %6zu %12zu %12zu %10.1f\n", t, prog->code_len, wide, prog->bc_len, ns / rounds);
+
+    fixed += wide;
+    compact += prog->bc_len;
+    crprintf_compiled_free(prog);
+  }
+
+  printf("total code: %zu bytes fixed-width, %zu bytes compact (%.0f%%)\n",
+    fixed, compact, 100.0 * (double)compact / (double)fixed);
+  return 0;
+}
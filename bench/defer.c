@@ -0,0 +1,75 @@
+// what a logging call costs the thread that makes it: crprintf_exec through
+// stdio, crprintf_async_exec rendering before it publishes, and
+// crprintf_async_defer copying the arguments for the writer to render.
+// lines go out in bursts that fit the ring, and only the calls are timed
+#include <crprintf.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BURST 10000
+
+static const char *formats[] = {
+  "<dim>[%s]</dim> <green>ok</green> request %zu took <cyan>%.3f</cyan>ms from <bold>%s</bold>\n",
+  "<dim>%d</dim> <rpad=8>%d</rpad> %s\n",
+};
+
+static double now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+  int rounds = (argc > 1) ? atoi(argv[1]) : 50;
+  static const char *peers[] = { "10.0.0.1:443", "192.168.100.200:8080", "[::1]:22" };
+
+  int fd = open("/dev/null", O_WRONLY);
+  FILE *stream = fdopen(dup(fd), "w");
+  crprintf_async *sink = crprintf_async_open(fd, 16 << 20, CRPRINTF_ASYNC_BLOCK);
+  if (fd < 0 || !stream || !sink) return 1;
+
+  printf("%-6s %14s %14s %14s\n", "format", "stdio ns/call", "async ns/call", "defer ns/call");
+
+  for (size_t f = 0; f < sizeof(formats) / sizeof(*formats); f++) {
+    crprintf_compiled *prog = crprintf_compile(formats[f]);
+    double stdio = 0, async = 0, defer = 0;
+
+    for (int r = 0; r < rounds; r++) {
+      double t0 = now_ns();
+      for (size_t i = 0; i < BURST; i++) {
+        if (f == 0) crprintf_exec(prog, stream, "worker", i, (double)(i % 997) / 7.0, peers[i % 3]);
+        else crprintf_exec(prog, stream, (int)i, (int)(i % 997), peers[i % 3]);
+      }
+      double t1 = now_ns();
+      for (size_t i = 0; i < BURST; i++) {
+        if (f == 0) crprintf_async_exec(sink, prog, "worker", i, (double)(i % 997) / 7.0, peers[i % 3]);
+        else crprintf_async_exec(sink, prog, (int)i, (int)(i % 997), peers[i % 3]);
+      }
+      double t2 = now_ns();
+      crprintf_async_flush(sink);
+      double t3 = now_ns();
+      for (size_t i = 0; i < BURST; i++) {
+        if (f == 0) crprintf_async_defer(sink, prog, "worker", i, (double)(i % 997) / 7.0, peers[i % 3]);
+        else crprintf_async_defer(sink, prog, (int)i, (int)(i % 997), peers[i % 3]);
+      }
+      double t4 = now_ns();
+      crprintf_async_flush(sink);
+
+      stdio += t1 - t0;
+      async += t2 - t1;
+      defer += t4 - t3;
+    }
+
+    double calls = (double)rounds * BURST;
+    printf("%-6zu %14.1f %14.1f %14.1f\n", f, stdio / calls, async / calls, defer / calls);
+    crprintf_compiled_free(prog);
+  }
+
+  crprintf_async_close(sink);
+  fclose(stream);
+  close(fd);
+  return 0;
+}
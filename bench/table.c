@@ -0,0 +1,83 @@
+// auto-width columns: measuring every cell with snprintf and printing with '*'
+// widths, against crprintf_exec_table's measure pass over the same program
+#include <crprintf.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+  const char *name;
+  int pid;
+  double cpu;
+  const char *state;
+} row_t;
+
+static const crprintf_field fields[] = {
+  CRPRINTF_FIELD(row_t, pid, CRPRINTF_INT),
+  CRPRINTF_FIELD(row_t, name, CRPRINTF_CSTR),
+  CRPRINTF_FIELD(row_t, cpu, CRPRINTF_DOUBLE),
+  CRPRINTF_FIELD(row_t, state, CRPRINTF_CSTR),
+};
+
+static double now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+}
+
+static int max_int(int a, int b) { return a > b ? a : b; }
+
+int main(int argc, char **argv) {
+  size_t count = (argc > 1) ? (size_t)atol(argv[1]) : 50000;
+  int rounds = (argc > 2) ? atoi(argv[2]) : 20;
+  static const char *names[] = { "init", "sshd", "postgres", "node", "crprintf-bench", "kworker/0:1" };
+  static const char *states[] = { "running", "sleeping", "idle" };
+
+  row_t *rows = malloc(count * sizeof(*rows));
+  if (!rows) return 1;
+  for (size_t i = 0; i < count; i++)
+    rows[i] = (row_t){ names[i % 6], (int)(i * 7 + 1), (double)(i % 1000) / 10.0, states[i % 3] };
+
+  FILE *sink = fopen("/dev/null", "w");
+  if (!sink) return 1;
+
+  crprintf_compiled *starred = crprintf_compile("<dim>%*d</dim> <bold>%-*s</bold> <cyan>%*.1f</cyan> <green>%s</green>\n");
+  crprintf_compiled *table = crprintf_compile("<dim><rpad=0>%d</rpad></dim> <bold><pad=0>%s</pad></bold> <cyan><rpad=0>%.1f</rpad></cyan> <green>%s</green>\n");
+  crprintf_record_desc desc = { sizeof(row_t), sizeof(fields) / sizeof(*fields), fields };
+
+  printf("%-8s %8s %14s %14s %9s\n", "mode", "rows", "twice ns/row", "table ns/row", "speedup");
+
+  for (int color = 1; color >= 0; color--) {
+    crprintf_set_color(color);
+    double twice = 0, once = 0;
+
+    for (int r = 0; r < rounds; r++) {
+      double t0 = now_ns();
+      int w[3] = { 0, 0, 0 };
+      char cell[64];
+      for (size_t i = 0; i < count; i++) {
+        w[0] = max_int(w[0], snprintf(cell, sizeof(cell), "%d", rows[i].pid));
+        w[1] = max_int(w[1], (int)strlen(rows[i].name));
+        w[2] = max_int(w[2], snprintf(cell, sizeof(cell), "%.1f", rows[i].cpu));
+      }
+      for (size_t i = 0; i < count; i++)
+        crprintf_exec(starred, sink, w[0], rows[i].pid, w[1], rows[i].name, w[2], rows[i].cpu, rows[i].state);
+      double t1 = now_ns();
+      if (crprintf_exec_table(table, sink, rows, count, &desc, NULL, 0) < 0) return 1;
+      double t2 = now_ns();
+
+      twice += t1 - t0;
+      once += t2 - t1;
+    }
+
+    printf("%-8s %8zu %14.1f %14.1f %8.2fx\n", color ? "color" : "plain", count,
+      twice / rounds / (double)count, once / rounds / (double)count, twice / once);
+  }
+
+  crprintf_compiled_free(starred);
+  crprintf_compiled_free(table);
+  fclose(sink);
+  free(rows);
+  return 0;
+}
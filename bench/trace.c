@@ -0,0 +1,64 @@
+// log lines written as rendered text with crprintf_exec against the same
+// lines as trace records with crprintf_trace_write, both to /dev/null:
+// bytes per line and ns per line. records carry their own timestamps,
+// so neither side formats one
+#include <crprintf.h>
+
+#include <stdlib.h>
+#include <time.h>
+
+static const char *formats[] = {
+  "<green>ok</green> <bold>GET</bold> %s <cyan>%d</cyan> took <yellow>%.3f</yellow>ms from %s\n",
+  "<bold+red>error:</bold+red> worker <cyan>%d</cyan> failed to open <ul>%s</ul> (errno %d)\n",
+  "<dim>[%zu]</dim> <rpad=8>%d</rpad> <pad=12>%s</pad> %lld\n",
+};
+
+static double now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+  size_t count = (argc > 1) ? (size_t)atol(argv[1]) : 200000;
+  static const char *paths[] = { "/api/v1/users", "/static/app.js", "/healthz" };
+  static const char *peers[] = { "10.0.0.1:443", "192.168.100.200:8080", "[::1]:22" };
+
+  FILE *sink = fopen("/dev/null", "w");
+  crprintf_compiled *progs[3];
+  for (int f = 0; f < 3; f++) progs[f] = crprintf_compile(formats[f]);
+  crprintf_trace *log = crprintf_trace_open(sink, progs, 3);
+  if (!sink || !log) return 1;
+
+  printf("%-6s %-6s %12s %12s %12s %12s %9s\n", "format", "mode", "text B/line", "trace B/line", "text ns", "trace ns", "volume");
+
+  for (int f = 0; f < 3; f++) {
+    for (int color = 1; color >= 0; color--) {
+      crprintf_set_color(color);
+      double text_bytes = 0, trace_bytes = 0;
+
+      double t0 = now_ns();
+      for (size_t i = 0; i < count; i++) {
+        if (f == 0) text_bytes += crprintf_exec(progs[0], sink, paths[i % 3], 200, (double)(i % 997) / 7.0, peers[i % 3]);
+        else if (f == 1) text_bytes += crprintf_exec(progs[1], sink, (int)(i % 64), paths[i % 3], 2);
+        else text_bytes += crprintf_exec(progs[2], sink, i, (int)(i % 997), peers[i % 3], (long long)i * 31);
+      }
+      double t1 = now_ns();
+      for (size_t i = 0; i < count; i++) {
+        if (f == 0) trace_bytes += crprintf_trace_write(log, 0, paths[i % 3], 200, (double)(i % 997) / 7.0, peers[i % 3]);
+        else if (f == 1) trace_bytes += crprintf_trace_write(log, 1, (int)(i % 64), paths[i % 3], 2);
+        else trace_bytes += crprintf_trace_write(log, 2, i, (int)(i % 997), peers[i % 3], (long long)i * 31);
+      }
+      double t2 = now_ns();
+
+      printf("%-6d %-6s %12.1f %12.1f %12.1f %12.1f %8.1fx\n", f, color ? "color" : "plain",
+        text_bytes / (double)count, trace_bytes / (double)count,
+        (t1 - t0) / (double)count, (t2 - t1) / (double)count, text_bytes / trace_bytes);
+    }
+  }
+
+  crprintf_trace_close(log);
+  for (int f = 0; f < 3; f++) crprintf_compiled_free(progs[f]);
+  fclose(sink);
+  return 0;
+}
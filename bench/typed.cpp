@@ -0,0 +1,50 @@
+// crp::print's typed arguments against the va_list path, same program and VM
+#include <crprintf.hpp>
+
+#include <stdlib.h>
+#include <time.h>
+
+using namespace crp::literals;
+
+static double now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+}
+
+template <class Render>
+static double time_ns(int rounds, Render render) {
+  double t0 = now_ns();
+  for (int i = 0; i < rounds; i++) render(i);
+  return (now_ns() - t0) / rounds;
+}
+
+static void report(const char *name, double va, double typed) {
+  printf("%-10s %12.1f %12.1f %8.2fx\n", name, va, typed, va / typed);
+}
+
+int main(int argc, char **argv) {
+  int rounds = (argc > 1) ? atoi(argv[1]) : 1000000;
+  FILE *sink = fopen("/dev/null", "w");
+  if (!sink) return 1;
+  char buf[512];
+
+  printf("%-10s %12s %12s %9s\n", "line", "va_list ns", "typed ns", "speedup");
+
+  // native specs only: what's left is how arguments reach the VM
+  report("native",
+    time_ns(rounds, [&](int i) { crp::fprintf(sink, "<dim>[%5d]</dim> %d/%d <cyan>%x</cyan> %lu\n"_crp, i, i & 63, 64, i * 7, (unsigned long)i << 3); }),
+    time_ns(rounds, [&](int i) { crp::print(sink, "<dim>[%5d]</dim> %d/%d <cyan>%x</cyan> %lu\n"_crp, i, i & 63, 64, i * 7, (unsigned long)i << 3); }));
+
+  // flags and modifiers the VM hands to vsnprintf on the va_list path
+  report("flagged",
+    time_ns(rounds, [&](int i) { crp::fprintf(sink, "<bold>%+d</bold> %#x %hd %#o <dim>%+5ld</dim> % d\n"_crp, i - 500, i, (short)i, i & 511, (long)i * -3, i); }),
+    time_ns(rounds, [&](int i) { crp::print(sink, "<bold>%+d</bold> %#x %hd %#o <dim>%+5ld</dim> % d\n"_crp, i - 500, i, (short)i, i & 511, (long)i * -3, i); }));
+
+  report("stats",
+    time_ns(rounds, [&](int i) { crp::sprintf(buf, sizeof(buf), "<green>%6d</green> ok  <red>%+4d</red> failed  %05.1f%%  %zu bytes\n"_crp, i, i % 17, (double)(i % 1000) / 10, (size_t)i * 4096); }),
+    time_ns(rounds, [&](int i) { crp::format_to(buf, sizeof(buf), "<green>%6d</green> ok  <red>%+4d</red> failed  %05.1f%%  %zu bytes\n"_crp, i, i % 17, (double)(i % 1000) / 10, (size_t)i * 4096); }));
+
+  fclose(sink);
+  return 0;
+}
@@ -0,0 +1,103 @@
+// compiled together with the library source so the static width kernels are reachable
+#include "crprintf.c"
+
+#include <time.h>
+
+static size_t legacy_visible_len(const char *s, size_t n) {
+  size_t vis = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (s[i] == '\x1b') while (++i < n && !isalpha(s[i]));
+    else vis++;
+  }
+  return vis;
+}
+
+typedef size_t (*width_fn)(const char *, size_t);
+
+static char *make_input(const char *unit, size_t total) {
+  size_t ulen = strlen(unit);
+  char *buf = malloc(total + 1);
+  for (size_t i = 0; i < total; i += ulen)
+    memcpy(buf + i, unit, (total - i < ulen) ? total - i : ulen);
+  buf[total] = '\0';
+  return buf;
+}
+
+static double bench(width_fn fn, const char *s, size_t n, int rounds, size_t *out) {
+  struct timespec t0, t1;
+  size_t sink = 0;
+  
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (int r = 0; r < rounds; r++) {
+    sink += fn(s, n);
+    __asm__ volatile("" : : "r"(sink) : "memory");
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  
+  *out = sink / (size_t)rounds;
+  double ns = (double)(t1.tv_sec - t0.tv_sec) * 1e9 + (double)(t1.tv_nsec - t0.tv_nsec);
+  return ns / ((double)n * rounds);
+}
+
+// random mixes of ASCII, escapes, truncated and multibyte sequences must agree with the reference
+static int check_agreement(void) {
+  static const char *pieces[] = {
+    "a", "hello world ", "\x1b[1;31m", "\x1b[0m", "\xe6\x97\xa5", "e\xcc\x81",
+    "\xf0\x9f\x98\x80", "\xff", "\xe6\x97", "\xc3\xa9", "\t\n", "\x1b",
+  };
+  
+  char buf[512];
+  unsigned seed = 12345;
+  
+  for (int iter = 0; iter < 200000; iter++) {
+    size_t len = 0;
+    int parts = (int)((seed = seed * 1103515245u + 12345u) >> 16) % 24;
+    for (int k = 0; k < parts; k++) {
+      const char *p = pieces[((seed = seed * 1103515245u + 12345u) >> 16) % (sizeof(pieces) / sizeof(*pieces))];
+      size_t pl = strlen(p);
+      if (len + pl >= sizeof(buf)) break;
+      memcpy(buf + len, p, pl);
+      len += pl;
+    }
+    
+    for (size_t off = 0; off < len && off < 4; off++) {
+      if (visible_len(buf + off, len - off) != visible_len_scalar(buf + off, len - off)) {
+        fprintf(stderr, "mismatch at iteration %d offset %zu\n", iter, off);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  size_t size = (argc > 1) ? strtoul(argv[1], NULL, 10) : 4096;
+  int rounds = (argc > 2) ? atoi(argv[2]) : 20000;
+
+  if (check_agreement()) return 1;
+
+  static const struct { const char *name, *unit; } inputs[] = {
+    { "ascii",   "the quick brown fox jumps over the lazy dog | " },
+    { "styled",  "\x1b[1;32mok\x1b[0m  request served in 12ms  " },
+    { "cjk",     "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e text " },
+    { "emoji",   "\xf0\x9f\x9a\x80 deploy \xe2\x9c\x85 done " },
+  };
+
+  printf("%-8s %12s %12s %12s   (ns/byte, %zu-byte lines, kernel block %d)\n",
+    "input", "legacy", "scalar", "kernel", size, WIDTH_BLOCK);
+
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(*inputs); i++) {
+    char *s = make_input(inputs[i].unit, size);
+    size_t wl, ws, wk;
+    double legacy = bench(legacy_visible_len, s, size, rounds, &wl);
+    double scalar = bench(visible_len_scalar, s, size, rounds, &ws);
+    double kernel = bench(visible_len, s, size, rounds, &wk);
+    
+    printf("%-8s %12.3f %12.3f %12.3f   width %zu (legacy %zu)\n",
+      inputs[i].name, legacy, scalar, kernel, wk, wl);
+    if (ws != wk) { fprintf(stderr, "%s: kernel %zu != scalar %zu\n", inputs[i].name, wk, ws); return 1; }
+    free(s);
+  }
+  
+  return 0;
+}
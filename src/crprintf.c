@@ -27,14 +27,36 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <wchar.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include "crprintf.h"
 
+#if defined(__AVX2__)
+  #include <immintrin.h>
+#elif defined(__SSE2__)
+  #include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  #include <arm_neon.h>
+#endif
+
 static bool crprintf_no_color = false;
 static bool crprintf_debug = false;
 static bool crprintf_debug_hex = false;
+static bool crprintf_optimize = true;
+static size_t crprintf_arena_cap = 64 * 1024;
+static size_t crprintf_cache_cap = 1024 * 1024;
 
 void crprintf_set_color(bool enable) { crprintf_no_color = !enable; }
 bool crprintf_get_color(void) { return !crprintf_no_color; }
@@ -45,6 +67,16 @@ bool crprintf_get_debug(void) { return crprintf_debug; }
 void crprintf_set_debug_hex(bool enable) { crprintf_debug_hex = enable; }
 bool crprintf_get_debug_hex(void) { return crprintf_debug_hex; }
 
+void crprintf_set_optimize(bool enable) { crprintf_optimize = enable; }
+bool crprintf_get_optimize(void) { return crprintf_optimize; }
+
+void crprintf_set_arena_cap(size_t bytes) { crprintf_arena_cap = bytes; }
+size_t crprintf_get_arena_cap(void) { return crprintf_arena_cap; }
+
+static void cache_trim(size_t budget);
+void crprintf_set_cache_cap(size_t bytes) { crprintf_cache_cap = bytes; cache_trim(bytes); }
+size_t crprintf_get_cache_cap(void) { return crprintf_cache_cap; }
+
 static inline int hex_digit(char c) {
   static const int8_t lookup[256] = {
     ['0']=0, ['1']=1, ['2']=2, ['3']=3, ['4']=4, ['5']=5, ['6']=6, ['7']=7, ['8']=8, ['9']=9,
@@ -59,6 +91,10 @@ typedef enum {
   OP_NOP = 0,
   OP_EMIT_LIT,
   OP_EMIT_FMT,
+  OP_EMIT_INT,
+  OP_EMIT_UINT,
+  OP_EMIT_UINT_HEX,
+  OP_EMIT_CSTR,
   OP_SET_FG,
   OP_SET_BG,
   OP_SET_FG_RGB,
@@ -79,6 +115,10 @@ typedef enum {
   OP_EMIT_SPACES,
   OP_EMIT_NEWLINES,
   OP_SNAPSHOT,
+  OP_STYLE_APPLY,
+  OP_EMIT_VAR,
+  OP_APPLY_VAR,
+  OP_VAR_RET,
   OP_HALT,
   OP_MAX
 } opcode_t;
@@ -111,10 +151,49 @@ typedef enum {
 #define STYLE_STRIKE 0x10
 #define STYLE_INVERT 0x20
 
+#define DELTA_PUSH   1
+#define DELTA_POP    2
+#define DELTA_QUIET  4
+
+#define DELTA_FG     0x01
+#define DELTA_FG_RGB 0x02
+#define DELTA_BG     0x04
+#define DELTA_BG_RGB 0x08
+
+// literal pool record behind OP_STYLE_APPLY, followed by the precomputed escape
+typedef struct {
+  uint8_t stack;
+  uint8_t fields;
+  uint8_t flags_on;
+  uint8_t flags_off;
+  uint32_t fg, fg_rgb;
+  uint32_t bg, bg_rgb;
+} style_delta_t;
+
+#define FMT_LEFT  0x01
+#define FMT_ZERO  0x02
+#define FMT_PREC  0x04
+#define FMT_UPPER 0x08
+#define FMT_STAR_W 0x10
+#define FMT_STAR_P 0x20
+
+#define FMT_MAX_WIDTH 4096
+
+// literal pool record behind every format op, followed by the spec text
+typedef struct {
+  uint32_t len;
+  uint16_t width;
+  uint16_t prec;
+  uint8_t cls;
+  uint8_t flags;
+} fmt_desc_t;
+
 typedef struct {
   size_t mark;
+  size_t col;
   int width;
-  int right_align;
+  int16_t column;
+  bool right_align;
 } pad_entry_t;
 
 typedef struct {
@@ -132,27 +211,45 @@ typedef struct {
   
   int style_depth;
   int pad_depth;
+  size_t col;
 } vm_regs_t;
 
-#define MAX_VARS      64
-#define MAX_VAR_NAME  32
-#define MAX_VAR_VALUE 128
+// what a global variable renders as right now, compiled when it is set
+typedef struct {
+  crprintf_compiled *text;
+  crprintf_compiled *style;
+  uint64_t gen;
+} var_binding_t;
+
+// one per global name for the life of the process; programs hold these directly
+typedef struct {
+  var_binding_t *binding;
+  char *name;
+} var_slot_t;
 
+// immutable once created; name and value live in the same allocation
 typedef struct {
-  char name[MAX_VAR_NAME];
-  char value[MAX_VAR_VALUE];
-  int nlen; int vlen; int is_fmt;
+  uint32_t hash;
+  int nlen; 
+  int vlen; 
+  int is_fmt;
+  const char *name;
+  const char *value;
+  var_slot_t *slot;
 } crprintf_var_t;
 
+// open addressing over entry pointers, capacity is always a power of two
 typedef struct {
-  crprintf_var_t vars[MAX_VARS];
-  int count;
+  size_t mask;
+  size_t count;
+  crprintf_var_t *slots[];
 } var_table_t;
 
+// <let> definitions go into a private overlay that shadows the published globals
 typedef struct {
   const var_table_t *base;
-  var_table_t local;
-  bool has_local;
+  var_table_t *local;
+  unsigned epoch;
 } var_scope_t;
 
 typedef struct {
@@ -161,24 +258,60 @@ typedef struct {
   size_t out_pos;
   size_t out_cap;
   size_t resume_ip;
+  size_t resume_off;
   bool valid;
 } vm_checkpoint_t;
 
+// what crprintf_async_defer captures for one argument; strings copy at most
+// prec bytes, taken from the spec or from the '*' argument just before
+#define DEFER_MAX_ARGS 16
+#define DEFER_PREC     1
+#define DEFER_STAR     2
+
+typedef struct {
+  uint8_t cls;
+  uint8_t limit;
+  uint16_t prec;
+} defer_arg_t;
+
+enum { DEFER_UNKNOWN, DEFER_BUILDING, DEFER_READY, DEFER_NEVER };
+
+// code is the fixed-width form the compiler and optimizer work on; the VM
+// runs bc, which is what survives packing
 struct crprintf_compiled {
   instruction_t *code;
   size_t code_len;
   size_t code_cap;
+  uint8_t *bc;
+  size_t bc_len;
   char *literals;
   size_t lit_len;
   size_t lit_cap;
   char *source;
   size_t source_len;
-  uint32_t *src_map;
+  uint32_t *src_map;   // owns one block; lit_marks is its second half
   uint32_t *lit_marks;
   size_t map_cap;
+  size_t packed_size;  // nonzero once code, literals and slots share the struct's block
   const char *compile_base;
   uint32_t _cur_src_off;
   vm_checkpoint_t checkpoint;
+  var_slot_t **slots;
+  uint32_t slot_count;
+  uint32_t slot_cap;
+  bool bind_late;
+  bool fmt_as_text;    // a variable's late binding: conversions print as text and take no arguments
+  int var_depth;
+  bool is_const;
+  bool cached;
+  bool external;
+  bool unresolved;
+  uint32_t refs;
+  uint32_t const_off[2];
+  uint32_t const_len[2];
+  uint8_t defer_state;
+  uint8_t defer_count;
+  defer_arg_t defer_args[DEFER_MAX_ARGS];
 };
 
 typedef struct crprintf_state {
@@ -187,15 +320,149 @@ typedef struct crprintf_state {
   int style_depth;
 } crprintf_state;
 
-static var_table_t global_vars = {0};
+static uint32_t var_hash(const char *s, size_t n) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < n; i++) h = (h ^ (uint8_t)s[i]) * 16777619u;
+  return h;
+}
+
+static crprintf_var_t *var_new(const char *name, size_t nlen, const char *value, size_t vlen, int is_fmt) {
+  crprintf_var_t *v = malloc(sizeof(*v) + nlen + vlen + 2);
+  if (!v) return NULL;
+
+  char *n = (char *)(v + 1);
+  char *val = n + nlen + 1;
+  memcpy(n, name, nlen); n[nlen] = '\0';
+  memcpy(val, value, vlen); val[vlen] = '\0';
+  
+  *v = (crprintf_var_t){ 
+    .hash = var_hash(name, nlen), .nlen = (int)nlen, .vlen = (int)vlen, 
+    .is_fmt = is_fmt, .name = n, .value = val,
+  };
+  return v;
+}
+
+static var_table_t *table_new(size_t cap) {
+  var_table_t *t = calloc(1, sizeof(*t) + cap * sizeof(crprintf_var_t *));
+  if (t) t->mask = cap - 1;
+  return t;
+}
+
+static const crprintf_var_t *table_find(const var_table_t *t, const char *name, size_t nlen, uint32_t h) {
+  if (!t) return NULL;
+  for (size_t i = h & t->mask;; i = (i + 1) & t->mask) {
+    const crprintf_var_t *v = t->slots[i];
+    if (!v) return NULL;
+    if (v->hash == h && (size_t)v->nlen == nlen && memcmp(v->name, name, nlen) == 0) return v;
+  }
+}
+
+// a copy with room for extra more entries; the entries themselves are shared
+static var_table_t *table_copy(const var_table_t *t, size_t extra) {
+  size_t count = t ? t->count : 0;
+  size_t cap = 8;
+  while ((count + extra) * 4 > cap * 3) cap *= 2;
+  
+  var_table_t *n = table_new(cap);
+  if (!n || !t) return n;
+  
+  for (size_t i = 0; i <= t->mask; i++) {
+    crprintf_var_t *v = t->slots[i];
+    if (!v) continue;
+    size_t k = v->hash & n->mask;
+    while (n->slots[k]) k = (k + 1) & n->mask;
+    n->slots[k] = v;
+  }
+  
+  n->count = count;
+  return n;
+}
+
+// inserts or replaces in place, growing first if needed; hands back the entry it displaced
+static bool table_put(var_table_t **tp, crprintf_var_t *v, crprintf_var_t **replaced) {
+  var_table_t *t = *tp;
+  *replaced = NULL;
+  
+  if (!t || (t->count + 1) * 4 > (t->mask + 1) * 3) {
+    var_table_t *grown = table_copy(t, 1);
+    if (!grown) return false;
+    free(t);
+    *tp = t = grown;
+  }
+
+  size_t i = v->hash & t->mask;
+  for (; t->slots[i]; i = (i + 1) & t->mask) {
+    crprintf_var_t *o = t->slots[i];
+    if (o->hash == v->hash && o->nlen == v->nlen && memcmp(o->name, v->name, (size_t)v->nlen) == 0) {
+      *replaced = o;
+      t->slots[i] = v;
+      return true;
+    }
+  }
+  
+  t->slots[i] = v;
+  t->count++;
+  return true;
+}
+
+static void table_free_entries(var_table_t *t) {
+  if (!t) return;
+  for (size_t i = 0; i <= t->mask; i++) free(t->slots[i]);
+  free(t);
+}
+
+// readers pin the epoch they entered in; a writer flips it twice and waits both halves out
+static var_table_t *global_vars;
+static uint64_t var_generation;
+static pthread_mutex_t var_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned var_epoch;
+static unsigned long var_readers[2];
+
+static unsigned vars_read_lock(void) {
+  for (;;) {
+    unsigned e = __atomic_load_n(&var_epoch, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&var_readers[e], 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&var_epoch, __ATOMIC_SEQ_CST) == e) return e;
+    __atomic_fetch_sub(&var_readers[e], 1, __ATOMIC_RELEASE);
+  }
+}
+
+static void vars_read_unlock(unsigned e) {
+  __atomic_fetch_sub(&var_readers[e], 1, __ATOMIC_RELEASE);
+}
+
+static void vars_synchronize(void) {
+  for (int phase = 0; phase < 2; phase++) {
+    unsigned old = __atomic_load_n(&var_epoch, __ATOMIC_RELAXED);
+    __atomic_store_n(&var_epoch, old ^ 1u, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&var_readers[old], __ATOMIC_ACQUIRE)) sched_yield();
+  }
+}
+
+static void scope_open(var_scope_t *s) {
+  s->epoch = vars_read_lock();
+  s->base = __atomic_load_n(&global_vars, __ATOMIC_ACQUIRE);
+  s->local = NULL;
+}
+
+static void scope_close(var_scope_t *s) {
+  table_free_entries(s->local);
+  s->local = NULL;
+  vars_read_unlock(s->epoch);
+}
 
-static inline const var_table_t *scope_read(const var_scope_t *s) {
-  return s->has_local ? &s->local : s->base;
+static const crprintf_var_t *scope_find(const var_scope_t *s, const char *name, size_t nlen) {
+  uint32_t h = var_hash(name, nlen);
+  const crprintf_var_t *v = table_find(s->local, name, nlen, h);
+  return v ? v : table_find(s->base, name, nlen, h);
 }
 
-static inline var_table_t *scope_write(var_scope_t *s) {
-  if (!s->has_local) { s->local = *s->base; s->has_local = true; }
-  return &s->local;
+static bool scope_define(var_scope_t *s, const char *name, size_t nlen, const char *value, size_t vlen, int is_fmt) {
+  crprintf_var_t *v = var_new(name, nlen, value, vlen, is_fmt), *replaced;
+  if (!v) return false;
+  if (!table_put(&s->local, v, &replaced)) { free(v); return false; }
+  free(replaced);
+  return true;
 }
 
 static const char *scan_var_brace(
@@ -214,6 +481,116 @@ static crprintf_compiled *program_new(void) {
   return p;
 }
 
+// recompile metadata lives in its own block so untracked programs never pay for it
+static bool track_alloc(crprintf_compiled *p, size_t cap) {
+  uint32_t *block = malloc(cap * 2 * sizeof(uint32_t));
+  if (!block) return false;
+  
+  if (p->src_map) {
+    memcpy(block, p->src_map, p->code_len * sizeof(uint32_t));
+    memcpy(block + cap, p->lit_marks, p->code_len * sizeof(uint32_t));
+    free(p->src_map);
+  }
+  
+  p->src_map = block;
+  p->lit_marks = block + cap;
+  p->map_cap = cap;
+  return true;
+}
+
+// bytecode: one opcode byte whose top bit says a LEB128 operand follows;
+// ops that point at text also carry its length so emitting it is one memcpy
+#define BC_ARG 0x80
+
+static inline uint32_t bc_varint(const uint8_t **p) {
+  const uint8_t *s = *p;
+  if (__builtin_expect(*s < 0x80, 1)) { *p = s + 1; return *s; }
+  
+  uint32_t v = 0;
+  int shift = 0;
+  uint8_t b;
+  do { b = *s++; v |= (uint32_t)(b & 0x7f) << shift; shift += 7; } while (b & 0x80);
+  *p = s;
+  return v;
+}
+
+static size_t bc_put(uint8_t *out, uint32_t v) {
+  size_t n = 0;
+  while (v >= 0x80) { out[n++] = (uint8_t)(v | 0x80); v >>= 7; }
+  out[n++] = (uint8_t)v;
+  return n;
+}
+
+static inline bool bc_has_len(uint32_t op) {
+  return op == OP_EMIT_LIT || op == OP_STYLE_APPLY;
+}
+
+// mirrors the VM's decoder; the text length is skipped since operands point at NUL-terminated text too
+static const uint8_t *bc_decode(const uint8_t *ip, instruction_t *ins) {
+  uint8_t op = *ip++;
+  ins->op = op & ~BC_ARG;
+  ins->operand = (op & BC_ARG) ? bc_varint(&ip) : 0;
+  if (bc_has_len(ins->op)) bc_varint(&ip);
+  return ip;
+}
+
+// SNAPSHOT records its own index so a checkpoint can be matched back to the code
+static void encode_program(crprintf_compiled *p) {
+  uint8_t *bc = malloc(p->code_len * 11 + 1);
+  if (!bc) return;
+  
+  size_t n = 0;
+  for (size_t i = 0; i < p->code_len; i++) {
+    const instruction_t *ins = &p->code[i];
+    uint32_t arg = (ins->op == OP_SNAPSHOT) ? (uint32_t)i : ins->operand;
+    
+    bc[n++] = (uint8_t)(ins->op | (arg ? BC_ARG : 0));
+    if (arg) n += bc_put(bc + n, arg);
+    if (bc_has_len(ins->op)) {
+      const char *text = p->literals + ins->operand + (ins->op == OP_STYLE_APPLY ? sizeof(style_delta_t) : 0);
+      n += bc_put(bc + n, (uint32_t)strlen(text));
+    }
+    if (p->checkpoint.valid && i + 1 == p->checkpoint.resume_ip) p->checkpoint.resume_off = n;
+  }
+  
+  uint8_t *fit = realloc(bc, n ? n : 1);
+  free(p->bc);
+  p->bc = fit ? fit : bc;
+  p->bc_len = n;
+}
+
+// finished programs move into one right-sized, line-aligned block: the
+// struct, then bytecode, literal pool and slot table back to back; the
+// fixed-width code is only needed while compiling and is dropped here
+static crprintf_compiled *program_pack(crprintf_compiled *p) {
+  size_t bc_off = (sizeof(*p) + 15) & ~(size_t)15;
+  size_t lit_off = bc_off + p->bc_len;
+  size_t slot_off = (lit_off + p->lit_len + 7) & ~(size_t)7;
+  size_t total = (slot_off + p->slot_count * sizeof(var_slot_t *) + 63) & ~(size_t)63;
+  
+  char *block = p->bc ? aligned_alloc(64, total) : NULL;
+  if (!block) return p;
+  
+  crprintf_compiled *q = (crprintf_compiled *)block;
+  *q = *p;
+  q->code = NULL;
+  q->code_cap = 0;
+  q->bc = (uint8_t *)(block + bc_off);
+  q->literals = block + lit_off;
+  q->slots = p->slot_count ? (var_slot_t **)(block + slot_off) : NULL;
+  q->lit_cap = p->lit_len;
+  q->slot_cap = p->slot_count;
+  q->packed_size = total;
+  
+  memcpy(q->bc, p->bc, p->bc_len);
+  memcpy(q->literals, p->literals, p->lit_len);
+  if (q->slots) memcpy(q->slots, p->slots, p->slot_count * sizeof(var_slot_t *));
+  
+  free(p->code); free(p->bc); free(p->literals); free(p->slots);
+  free(p);
+  return q;
+}
+
 static inline void emit_op(crprintf_compiled *p, uint32_t op, uint32_t operand) {
   if (__builtin_expect(p->code_len >= p->code_cap, 0)) {
     size_t new_cap = p->code_cap * 2;
@@ -223,12 +600,7 @@ static inline void emit_op(crprintf_compiled *p, uint32_t op, uint32_t operand)
     p->code_cap = new_cap;
   }
   if (p->src_map) {
-    if (__builtin_expect(p->code_len >= p->map_cap, 0)) {
-      size_t new_cap = p->map_cap * 2;
-      p->src_map = realloc(p->src_map, new_cap * sizeof(uint32_t));
-      p->lit_marks = realloc(p->lit_marks, new_cap * sizeof(uint32_t));
-      p->map_cap = new_cap;
-    }
+    if (__builtin_expect(p->code_len >= p->map_cap, 0) && !track_alloc(p, p->map_cap * 2)) return;
     p->src_map[p->code_len] = p->_cur_src_off;
     p->lit_marks[p->code_len] = (uint32_t)p->lit_len;
   }
@@ -254,38 +626,25 @@ static uint32_t add_literal(crprintf_compiled *p, const char *s, size_t len) {
   return off;
 }
 
-typedef struct { 
-  const char *name; 
-  int nlen; 
-  color_t col; 
-} color_entry_t;
-
-static const color_entry_t fg_colors[] = {
-  {"black",5,COL_BLACK}, {"red",3,COL_RED}, {"green",5,COL_GREEN},
-  {"yellow",6,COL_YELLOW}, {"blue",4,COL_BLUE}, {"magenta",7,COL_MAGENTA},
-  {"cyan",4,COL_CYAN}, {"white",5,COL_WHITE},
-  {"gray",4,COL_GRAY}, {"grey",4,COL_GRAY},
-  {"bright_red",10,COL_BRIGHT_RED}, {"bright_green",12,COL_BRIGHT_GREEN},
-  {"bright_yellow",13,COL_BRIGHT_YELLOW}, {"bright_blue",11,COL_BRIGHT_BLUE},
-  {"bright_magenta",14,COL_BRIGHT_MAGENTA}, {"bright_cyan",11,COL_BRIGHT_CYAN},
-  {"bright_white",12,COL_BRIGHT_WHITE},
-}; 
-
-static const color_entry_t bg_colors[] = {
-  {"bg_black",8,COL_BLACK}, {"bg_red",6,COL_RED}, {"bg_green",8,COL_GREEN},
-  {"bg_yellow",9,COL_YELLOW}, {"bg_blue",7,COL_BLUE}, {"bg_magenta",10,COL_MAGENTA},
-  {"bg_cyan",7,COL_CYAN}, {"bg_white",8,COL_WHITE},
-};
+static uint32_t add_record(crprintf_compiled *p, const void *hdr, size_t hlen, const char *s, size_t len) {
+  size_t required = p->lit_len + hlen + len + 1;
+  if (__builtin_expect(required > p->lit_cap, 0)) {
+    size_t new_cap = p->lit_cap;
+    while (new_cap < required) new_cap *= 2;
+    char *new_literals = realloc(p->literals, new_cap);
+    if (!new_literals) return 0;
+    p->literals = new_literals;
+    p->lit_cap = new_cap;
+  }
 
-static const color_entry_t seg_bg_colors[] = {
-  {"black",5,COL_BLACK}, {"red",3,COL_RED}, {"green",5,COL_GREEN},
-  {"yellow",6,COL_YELLOW}, {"blue",4,COL_BLUE}, {"magenta",7,COL_MAGENTA},
-  {"cyan",4,COL_CYAN}, {"white",5,COL_WHITE},
-};
+  uint32_t off = (uint32_t)p->lit_len;
+  memcpy(p->literals + p->lit_len, hdr, hlen);
+  memcpy(p->literals + p->lit_len + hlen, s, len);
+  p->literals[p->lit_len + hlen + len] = '\0';
+  p->lit_len += hlen + len + 1;
 
-#define FG_COUNT (sizeof(fg_colors)/sizeof(fg_colors[0]))
-#define BG_COUNT (sizeof(bg_colors)/sizeof(bg_colors[0]))
-#define SEG_BG_COUNT (sizeof(seg_bg_colors)/sizeof(seg_bg_colors[0]))
+  return off;
+}
 
 static inline int parse_hex_rgb(const char *hex, int len, uint32_t *rgb) {
   int r, g, b;
@@ -318,64 +677,87 @@ static int compile_hex_bg(crprintf_compiled *p, const char *hex, int hlen) {
   return 1;
 }
 
-static int tag_eq(const char *tag, int len, const char *lit) {
-  int ll = (int)strlen(lit);
-  return len == ll && memcmp(tag, lit, ll) == 0;
-}
+#define TAG_EQ(tag, len, lit) \
+  ((len) == (int)sizeof(lit) - 1 && memcmp((tag), (lit), sizeof(lit) - 1) == 0)
 
-static int tag_prefix(const char *tag, int len, const char *pfx) {
-  int pl = (int)strlen(pfx);
-  return len > pl && memcmp(tag, pfx, pl) == 0;
-}
+#define TAG_PREFIX(tag, len, pfx) \
+  ((len) > (int)sizeof(pfx) - 1 && memcmp((tag), (pfx), sizeof(pfx) - 1) == 0)
 
-static int match_fg(crprintf_compiled *p, const char *s, int len) {
-  for (int i = 0; i < (int)FG_COUNT; i++) if (
-    len == fg_colors[i].nlen && memcmp(s, fg_colors[i].name, len) == 0) {
-    emit_op(p, OP_SET_FG, fg_colors[i].col); return 1;
+// every style name resolves to the instruction it compiles to; OP_NOP when unknown
+static instruction_t style_word(const char *s, int len) {
+  #define WORD(lit, op, operand) \
+    if (memcmp(s, lit, sizeof(lit) - 1) == 0) return (instruction_t){ op, operand }
+  
+  switch (len) {
+    case 1: WORD("i", OP_SET_ITALIC, 1); break;
+    case 2: WORD("ul", OP_SET_UL, 1); break;
+    case 3: 
+      WORD("dim", OP_SET_DIM, 1); 
+      WORD("red", OP_SET_FG, COL_RED); 
+      break;
+    case 4: switch (s[0]) {
+      case 'b': WORD("bold", OP_SET_BOLD, 1); WORD("blue", OP_SET_FG, COL_BLUE); break;
+      case 'c': WORD("cyan", OP_SET_FG, COL_CYAN); break;
+      case 'g': WORD("gray", OP_SET_FG, COL_GRAY); WORD("grey", OP_SET_FG, COL_GRAY); break;
+    } break;
+    case 5: switch (s[0]) {
+      case 'b': WORD("black", OP_SET_FG, COL_BLACK); break;
+      case 'g': WORD("green", OP_SET_FG, COL_GREEN); break;
+      case 'w': WORD("white", OP_SET_FG, COL_WHITE); break;
+    } break;
+    case 6: switch (s[0]) {
+      case 'y': WORD("yellow", OP_SET_FG, COL_YELLOW); break;
+      case 'i': WORD("italic", OP_SET_ITALIC, 1); WORD("invert", OP_SET_INVERT, 1); break;
+      case 's': WORD("strike", OP_SET_STRIKE, 1); break;
+      case 'b': WORD("bg_red", OP_SET_BG, COL_RED); break;
+    } break;
+    case 7: switch (s[0]) {
+      case 'm': WORD("magenta", OP_SET_FG, COL_MAGENTA); break;
+      case 'b': WORD("bg_blue", OP_SET_BG, COL_BLUE); WORD("bg_cyan", OP_SET_BG, COL_CYAN); break;
+    } break;
+    case 8: switch (s[3]) {
+      case 'b': WORD("bg_black", OP_SET_BG, COL_BLACK); break;
+      case 'g': WORD("bg_green", OP_SET_BG, COL_GREEN); break;
+      case 'w': WORD("bg_white", OP_SET_BG, COL_WHITE); break;
+    } break;
+    case 9:  WORD("bg_yellow", OP_SET_BG, COL_YELLOW); break;
+    case 10: 
+      WORD("bright_red", OP_SET_FG, COL_BRIGHT_RED); 
+      WORD("bg_magenta", OP_SET_BG, COL_MAGENTA); 
+      break;
+    case 11: 
+      WORD("bright_blue", OP_SET_FG, COL_BRIGHT_BLUE); 
+      WORD("bright_cyan", OP_SET_FG, COL_BRIGHT_CYAN); 
+      break;
+    case 12: 
+      WORD("bright_green", OP_SET_FG, COL_BRIGHT_GREEN); 
+      WORD("bright_white", OP_SET_FG, COL_BRIGHT_WHITE); 
+      break;
+    case 13: WORD("bright_yellow", OP_SET_FG, COL_BRIGHT_YELLOW); break;
+    case 14: WORD("bright_magenta", OP_SET_FG, COL_BRIGHT_MAGENTA); break;
   }
-  return 0;
+  
+  #undef WORD
+  return (instruction_t){ OP_NOP, 0 };
 }
 
-static int match_bg(crprintf_compiled *p, const char *s, int len) {
-  for (int i = 0; i < (int)BG_COUNT; i++) if (
-    len == bg_colors[i].nlen && memcmp(s, bg_colors[i].name, len) == 0) {
-    emit_op(p, OP_SET_BG, bg_colors[i].col); return 1; 
-  }
-  return 0;
+static inline bool is_attr_op(uint32_t op) {
+  return op >= OP_SET_BOLD && op <= OP_SET_INVERT;
 }
 
-static int match_seg_bg(crprintf_compiled *p, const char *s, int len) {
-  for (int i = 0; i < (int)SEG_BG_COUNT; i++) if (
-    len == seg_bg_colors[i].nlen && memcmp(s, seg_bg_colors[i].name, len) == 0) { 
-    emit_op(p, OP_SET_BG, seg_bg_colors[i].col); return 1; 
-  }
-  return 0;
+static int match_word(crprintf_compiled *p, const char *s, int len) {
+  instruction_t w = style_word(s, len);
+  if (w.op == OP_NOP) return 0;
+  emit_op(p, w.op, w.operand);
+  return 1;
 }
 
-typedef struct { 
-  const char *name;
-  int nlen;
-  int op; 
-} attr_entry_t;
-
-static const attr_entry_t attrs[] = {
-  { "bold", 4,   OP_SET_BOLD   },
-  { "dim",  3,   OP_SET_DIM    },
-  { "ul",   2,   OP_SET_UL     },
-  { "i",    1,   OP_SET_ITALIC },
-  { "italic", 6, OP_SET_ITALIC },
-  { "strike", 6, OP_SET_STRIKE },
-  { "invert", 6, OP_SET_INVERT },
-};
-
-#define ATTR_COUNT (sizeof(attrs) / sizeof(attrs[0]))
-
-static int match_attr(crprintf_compiled *p, const char *s, int len) {
-  for (int i = 0; i < (int)ATTR_COUNT; i++) if (
-    len == attrs[i].nlen && memcmp(s, attrs[i].name, len) == 0) { 
-    emit_op(p, attrs[i].op, 1); return 1; 
-  }
-  return 0;
+// bg_ segments only take the eight base colors
+static int match_seg_bg(crprintf_compiled *p, const char *s, int len) {
+  instruction_t w = style_word(s, len);
+  if (w.op != OP_SET_FG || w.operand < COL_BLACK || w.operand > COL_WHITE) return 0;
+  emit_op(p, OP_SET_BG, w.operand);
+  return 1;
 }
 
 static const char *next_seg(const char *cur, const char *end, int *out_len) {
@@ -386,12 +768,10 @@ static const char *next_seg(const char *cur, const char *end, int *out_len) {
 }
 
 static int match_plus_seg(crprintf_compiled *p, const char *seg, int slen) {
-  if (match_attr(p, seg, slen))      return 1;
-  if (match_fg(p, seg, slen))        return 1;
-  if (match_bg(p, seg, slen))        return 1;
+  if (match_word(p, seg, slen))      return 1;
   if (slen > 0 && seg[0] == '#')     return compile_hex_fg(p, seg, slen);
-  if (tag_prefix(seg, slen, "bg_#")) return compile_hex_bg(p, seg + 3, slen - 3);
-  if (tag_prefix(seg, slen, "bg_"))  return match_seg_bg(p, seg + 3, slen - 3);
+  if (TAG_PREFIX(seg, slen, "bg_#")) return compile_hex_bg(p, seg + 3, slen - 3);
+  if (TAG_PREFIX(seg, slen, "bg_"))  return match_seg_bg(p, seg + 3, slen - 3);
   return 0;
 }
 
@@ -441,24 +821,15 @@ static int compile_let(var_scope_t *scope, const char *body, int len) {
       while (after < end && (*after == ' ' || *after == ',')) after++;
       int vlen = (int)(vend - vstart);
       
-      if (nlen <= 0 || nlen >= MAX_VAR_NAME || vlen < 0 || vlen >= MAX_VAR_VALUE) return 0;
-      var_table_t *vars = scope_write(scope);
-      if (vars->count >= MAX_VARS) return 0;
-
-      crprintf_var_t *v = &vars->vars[vars->count++];
-      memcpy(v->name, p, nlen);
-      
-      v->name[nlen] = '\0'; v->nlen = nlen;
-      memcpy(v->value, vstart, vlen);
-      
-      v->value[vlen] = '\0'; v->vlen = vlen;
-      v->is_fmt = 0;
+      if (nlen <= 0) return 0;
+      int is_fmt = 0;
       
       for (int j = 0; j < vlen; j++) {
         if (vstart[j] == '%' && j + 1 < vlen && vstart[j + 1] != '%') 
-        { v->is_fmt = 1; break; }
+        { is_fmt = 1; break; }
       }
       
+      if (!scope_define(scope, p, (size_t)nlen, vstart, (size_t)vlen, is_fmt)) return 0;
       p = after;
       continue;
     }
@@ -466,42 +837,104 @@ static int compile_let(var_scope_t *scope, const char *body, int len) {
     while (vend < end && *vend != ',') vend++;
 
     int vlen = (int)(vend - vstart);
-    if (nlen <= 0 || nlen >= MAX_VAR_NAME || vlen <= 0 || vlen >= MAX_VAR_VALUE) return 0;
-    var_table_t *vars = scope_write(scope);
-    if (vars->count >= MAX_VARS) return 0;
-
-    crprintf_var_t *v = &vars->vars[vars->count++];
-    memcpy(v->name, p, nlen);
-    v->name[nlen] = '\0'; v->nlen = nlen;
-    
-    memcpy(v->value, vstart, vlen);
-    v->value[vlen] = '\0'; v->vlen = vlen;
+    if (nlen <= 0 || vlen <= 0) return 0;
+    if (!scope_define(scope, p, (size_t)nlen, vstart, (size_t)vlen, 0)) return 0;
     p = vend;
   }
 
   return 1;
 }
 
+static void compile_fragment(crprintf_compiled *p, const char *fmt, var_scope_t *vars);
+
+static void binding_free(var_binding_t *b) {
+  if (!b) return;
+  crprintf_compiled_free(b->text);
+  crprintf_compiled_free(b->style);
+  free(b);
+}
+
+// both forms end in VAR_RET so the VM can run them in place of the referencing op.
+// the program a call site binds to may change under it, so it never takes
+// arguments: a conversion in the value prints as text
+static var_binding_t *binding_new(const char *value, size_t vlen, uint64_t gen) {
+  var_binding_t *b = calloc(1, sizeof(*b));
+  if (!b) return NULL;
+  b->gen = gen;
+  b->text = program_new();
+  b->text->fmt_as_text = true;
+  
+  if (memchr(value, '<', vlen)) {
+    var_scope_t scope;
+    scope_open(&scope);
+    compile_fragment(b->text, value, &scope);
+    scope_close(&scope);
+  } else emit_op(b->text, OP_EMIT_LIT, add_literal(b->text, value, vlen));
+  emit_op(b->text, OP_VAR_RET, 0);
+  encode_program(b->text);
+  b->text = program_pack(b->text);
+
+  b->style = program_new();
+  if (compile_plus_segs(b->style, value, (int)vlen)) {
+    emit_op(b->style, OP_VAR_RET, 0);
+    encode_program(b->style);
+    b->style = program_pack(b->style);
+  } else { crprintf_compiled_free(b->style); b->style = NULL; }
+  
+  return b;
+}
+
+// copy-on-write: compiles already running keep the table they started with,
+// and programs that bound the name late see the new value on their next render
 void crprintf_var(const char *name, const char *value) {
-  if (global_vars.count >= MAX_VARS) return;
-  int nlen = (int)strlen(name);
-  int vlen = (int)strlen(value);
-  if (nlen <= 0 || nlen >= MAX_VAR_NAME || vlen <= 0 || vlen >= MAX_VAR_VALUE) return;
-
-  for (int i = 0; i < global_vars.count; i++) {
-    crprintf_var_t *v = &global_vars.vars[i];
-    if (v->nlen == nlen && memcmp(v->name, name, nlen) == 0) {
-      memcpy(v->value, value, vlen);
-      v->value[vlen] = '\0'; v->vlen = vlen; return;
-    }
+  size_t nlen = strlen(name);
+  size_t vlen = strlen(value);
+  if (nlen == 0 || vlen == 0) return;
+  
+  crprintf_var_t *v = var_new(name, nlen, value, vlen, 0), *replaced;
+  if (!v) return;
+
+  pthread_mutex_lock(&var_lock);
+  var_table_t *old = global_vars;
+  const crprintf_var_t *prev = table_find(old, name, nlen, v->hash);
+  
+  v->slot = prev ? prev->slot : calloc(1, sizeof(var_slot_t));
+  if (v->slot && !v->slot->name && (v->slot->name = malloc(nlen + 1))) memcpy(v->slot->name, name, nlen + 1);
+  
+  uint64_t gen = __atomic_add_fetch(&var_generation, 1, __ATOMIC_RELEASE);
+  var_binding_t *binding = v->slot ? binding_new(value, vlen, gen) : NULL;
+  var_table_t *next = table_copy(old, 1);
+  
+  if (!binding || !next || !table_put(&next, v, &replaced)) {
+    pthread_mutex_unlock(&var_lock);
+    if (!prev && v->slot) { free(v->slot->name); free(v->slot); }
+    binding_free(binding); free(next); free(v);
+    return;
   }
 
-  crprintf_var_t *v = &global_vars.vars[global_vars.count++];
-  memcpy(v->name, name, nlen);
-  v->name[nlen] = '\0'; v->nlen = nlen;
+  var_binding_t *retired = __atomic_exchange_n(&v->slot->binding, binding, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&global_vars, next, __ATOMIC_RELEASE);
+  vars_synchronize();
+  pthread_mutex_unlock(&var_lock);
+  
+  binding_free(retired);
+  free(old);
+  free(replaced);
+}
+
+static uint32_t program_slot(crprintf_compiled *p, var_slot_t *slot) {
+  for (uint32_t i = 0; i < p->slot_count; i++) if (p->slots[i] == slot) return i;
   
-  memcpy(v->value, value, vlen);
-  v->value[vlen] = '\0'; v->vlen = vlen;
+  if (p->slot_count == p->slot_cap) {
+    uint32_t cap = p->slot_cap ? p->slot_cap * 2 : 4;
+    var_slot_t **grown = realloc(p->slots, cap * sizeof(*grown));
+    if (!grown) return UINT32_MAX;
+    p->slots = grown;
+    p->slot_cap = cap;
+  }
+  
+  p->slots[p->slot_count] = slot;
+  return p->slot_count++;
 }
 
 crprintf_state *crprintf_state_new(void) { return calloc(1, sizeof(crprintf_state)); }
@@ -525,25 +958,59 @@ bool crprintf_state_eq(const crprintf_state *a, const crprintf_state *b) {
   return true;
 }
 
-static int emit_style_esc(char *esc, size_t esc_size, const style_entry_t *s) {
-  int n = snprintf(esc, esc_size, "\x1b[0m");
-  if (s->flags & STYLE_BOLD)   n += snprintf(esc+n, esc_size-n, "\x1b[1m");
-  if (s->flags & STYLE_DIM)    n += snprintf(esc+n, esc_size-n, "\x1b[2m");
-  if (s->flags & STYLE_UL)     n += snprintf(esc+n, esc_size-n, "\x1b[4m");
-  if (s->flags & STYLE_ITALIC) n += snprintf(esc+n, esc_size-n, "\x1b[3m");
-  if (s->flags & STYLE_STRIKE) n += snprintf(esc+n, esc_size-n, "\x1b[9m");
-  if (s->flags & STYLE_INVERT) n += snprintf(esc+n, esc_size-n, "\x1b[7m");
-  if (s->fg == COL_RGB)
-    n += snprintf(esc+n, esc_size-n, "\x1b[38;2;%d;%d;%dm",
-      UNPACK_R(s->fg_rgb), UNPACK_G(s->fg_rgb), UNPACK_B(s->fg_rgb));
-  else if (s->fg)
-    n += snprintf(esc+n, esc_size-n, "\x1b[%dm", s->fg);
-  if (s->bg == COL_RGB)
-    n += snprintf(esc+n, esc_size-n, "\x1b[48;2;%d;%d;%dm",
-      UNPACK_R(s->bg_rgb), UNPACK_G(s->bg_rgb), UNPACK_B(s->bg_rgb));
-  else if (s->bg)
-    n += snprintf(esc+n, esc_size-n, "\x1b[%dm", s->bg + 10);
-  return n;
+static inline char *esc_uint(char *p, unsigned v) {
+  if (v >= 100) *p++ = (char)('0' + v / 100);
+  if (v >= 10)  *p++ = (char)('0' + v / 10 % 10);
+  *p++ = (char)('0' + v % 10);
+  return p;
+}
+
+static inline char *esc_sgr(char *p, unsigned code) {
+  *p++ = '\x1b'; *p++ = '[';
+  p = esc_uint(p, code);
+  *p++ = 'm';
+  return p;
+}
+
+static inline char *esc_rgb(char *p, unsigned base, uint32_t rgb) {
+  *p++ = '\x1b'; *p++ = '[';
+  p = esc_uint(p, base); *p++ = ';'; *p++ = '2'; *p++ = ';';
+  p = esc_uint(p, UNPACK_R(rgb)); *p++ = ';';
+  p = esc_uint(p, UNPACK_G(rgb)); *p++ = ';';
+  p = esc_uint(p, UNPACK_B(rgb));
+  *p++ = 'm';
+  return p;
+}
+
+// worst case is 6 attributes plus two 24-bit colors, well under 128 bytes
+static int emit_style_esc(char *esc, const style_entry_t *s) {
+  char *p = esc_sgr(esc, 0);
+  if (s->flags & STYLE_BOLD)   p = esc_sgr(p, 1);
+  if (s->flags & STYLE_DIM)    p = esc_sgr(p, 2);
+  if (s->flags & STYLE_UL)     p = esc_sgr(p, 4);
+  if (s->flags & STYLE_ITALIC) p = esc_sgr(p, 3);
+  if (s->flags & STYLE_STRIKE) p = esc_sgr(p, 9);
+  if (s->flags & STYLE_INVERT) p = esc_sgr(p, 7);
+  if (s->fg == COL_RGB) p = esc_rgb(p, 38, s->fg_rgb);
+  else if (s->fg)       p = esc_sgr(p, s->fg);
+  if (s->bg == COL_RGB) p = esc_rgb(p, 48, s->bg_rgb);
+  else if (s->bg)       p = esc_sgr(p, s->bg + 10);
+  return (int)(p - esc);
+}
+
+static inline void apply_style_delta(vm_regs_t *r, const style_delta_t *d) {
+  if (d->stack & DELTA_PUSH) {
+    if (r->style_depth < 8) r->style_stack[r->style_depth++] = r->current;
+  } else if (d->stack & DELTA_POP) {
+    if (r->style_depth > 0) r->current = r->style_stack[--r->style_depth];
+    else r->current = (style_entry_t){.fg = COL_NONE, .bg = COL_NONE};
+  }
+  
+  r->current.flags = (uint8_t)((r->current.flags & ~d->flags_off) | d->flags_on);
+  if (d->fields & DELTA_FG)     r->current.fg = d->fg;
+  if (d->fields & DELTA_FG_RGB) r->current.fg_rgb = d->fg_rgb;
+  if (d->fields & DELTA_BG)     r->current.bg = d->bg;
+  if (d->fields & DELTA_BG_RGB) r->current.bg_rgb = d->bg_rgb;
 }
 
 static int compile_var_ref(crprintf_compiled *p, var_scope_t *scope, const char *tag, int len) {
@@ -553,60 +1020,45 @@ static int compile_var_ref(crprintf_compiled *p, var_scope_t *scope, const char
   const char *plus = memchr(name, '+', nlen);
   int var_nlen = plus ? (int)(plus - name) : nlen;
 
-  const var_table_t *vars = scope_read(scope);
-  for (int i = 0; i < vars->count; i++) {
-    const crprintf_var_t *v = &vars->vars[i];
-    if (var_nlen != v->nlen || memcmp(name, v->name, var_nlen) != 0) continue;
+  const crprintf_var_t *v = scope_find(scope, name, (size_t)var_nlen);
+  if (!v) { p->unresolved = true; return 0; }
     
-    emit_op(p, OP_STYLE_PUSH, 0);
-    if (!compile_plus_segs(p, v->value, v->vlen)) return 0;
-
-    if (plus) {
-      const char *rest = plus + 1;
-      int rlen = nlen - var_nlen - 1;
-      if (rlen > 0 && !compile_plus_segs(p, rest, rlen)) return 0;
-    }
-
-    emit_op(p, OP_STYLE_FLUSH, 0);
-    return 1;
-  }
-
-  return 0;
-}
+  emit_op(p, OP_STYLE_PUSH, 0);
+  const var_binding_t *b = v->slot ? __atomic_load_n(&v->slot->binding, __ATOMIC_ACQUIRE) : NULL;
+  uint32_t idx = (p->bind_late && b && b->style) ? program_slot(p, v->slot) : UINT32_MAX;
+  
+  if (idx != UINT32_MAX) emit_op(p, OP_APPLY_VAR, idx);
+  else if (!compile_plus_segs(p, v->value, v->vlen)) return 0;
 
-static int match_attr_off(crprintf_compiled *p, const char *s, int len) {
-  for (int i = 0; i < (int)ATTR_COUNT; i++) if (
-    len == attrs[i].nlen && memcmp(s, attrs[i].name, len) == 0) {
-    emit_op(p, attrs[i].op, 0); return 1;
+  if (plus) {
+    const char *rest = plus + 1;
+    int rlen = nlen - var_nlen - 1;
+    if (rlen > 0 && !compile_plus_segs(p, rest, rlen)) return 0;
   }
-  return 0;
-}
 
-static int match_fg_off(crprintf_compiled *p, const char *s, int len) {
-  for (int i = 0; i < (int)FG_COUNT; i++) if (
-    len == fg_colors[i].nlen && memcmp(s, fg_colors[i].name, len) == 0) {
-    emit_op(p, OP_SET_FG, COL_NONE); return 1;
-  }
-  if (len > 0 && s[0] == '#') { emit_op(p, OP_SET_FG, COL_NONE); return 1; }
-  return 0;
+  emit_op(p, OP_STYLE_FLUSH, 0);
+  return 1;
 }
 
-static int match_bg_off(crprintf_compiled *p, const char *s, int len) {
-  for (int i = 0; i < (int)BG_COUNT; i++) if (
-    len == bg_colors[i].nlen && memcmp(s, bg_colors[i].name, len) == 0) {
-    emit_op(p, OP_SET_BG, COL_NONE); return 1;
-  }
-  if (tag_prefix(s, len, "bg_#")) { emit_op(p, OP_SET_BG, COL_NONE); return 1; }
-  return 0;
+// closing a style name restores its default instead of popping the stack
+static int match_off(crprintf_compiled *p, const char *s, int len) {
+  instruction_t w = style_word(s, len);
+  
+  if (is_attr_op(w.op))                                  emit_op(p, w.op, 0);
+  else if (w.op == OP_SET_FG || (len > 0 && s[0] == '#')) emit_op(p, OP_SET_FG, COL_NONE);
+  else if (w.op == OP_SET_BG || TAG_PREFIX(s, len, "bg_#")) emit_op(p, OP_SET_BG, COL_NONE);
+  else return 0;
+  
+  return 1;
 }
 
 static int compile_tag(crprintf_compiled *p, const char *tag, int len, int closing, var_scope_t *vars) {
   if (closing) {
-    if (tag_eq(tag, len, "pad") || tag_eq(tag, len, "rpad")) { 
+    if (TAG_EQ(tag, len, "pad") || TAG_EQ(tag, len, "rpad")) { 
       emit_op(p, OP_PAD_END, 0); return 1; 
     }
     
-    if (match_attr_off(p, tag, len) || match_fg_off(p, tag, len) || match_bg_off(p, tag, len)) {
+    if (match_off(p, tag, len)) {
       emit_op(p, OP_STYLE_FLUSH, 0); return 1;
     }
     
@@ -614,49 +1066,40 @@ static int compile_tag(crprintf_compiled *p, const char *tag, int len, int closi
     return 1;
   }
 
-  if (tag_prefix(tag, len, "let ")) return compile_let(vars, tag + 4, len - 4);
-  if (tag[0] == '$' && len > 1)     return compile_var_ref(p, vars, tag, len);
-
-  if (tag_prefix(tag, len, "pad="))  { emit_op(p, OP_PAD_BEGIN,  (uint32_t)atoi(tag + 4)); return 1; }
-  if (tag_prefix(tag, len, "rpad=")) { emit_op(p, OP_RPAD_BEGIN, (uint32_t)atoi(tag + 5)); return 1; }
-  
-  if (tag_prefix(tag, len, "space=") && tag[len-1] == '/') {
-    emit_op(p, OP_EMIT_SPACES, (uint32_t)atoi(tag + 6));
-    return 1;
-  }
-  
-  if (tag_prefix(tag, len, "gap=") && tag[len-1] == '/') {
-    emit_op(p, OP_EMIT_SPACES, (uint32_t)atoi(tag + 4));
-    return 1;
-  }
-
-  if (tag_eq(tag, len, "reset/")) {
-    emit_op(p, OP_STYLE_RESET_ALL, 0);
-    return 1;
-  }
-  
-  if (tag_eq(tag, len, "br/")) {
-    emit_op(p, OP_EMIT_NEWLINES, 1);
-    return 1;
-  }
+  bool self_closing = len > 0 && tag[len - 1] == '/';
   
-  if (tag_prefix(tag, len, "br=") && tag[len-1] == '/') {
-    emit_op(p, OP_EMIT_NEWLINES, (uint32_t)atoi(tag + 3));
-    return 1;
+  switch (tag[0]) {
+    case '$': if (len > 1) return compile_var_ref(p, vars, tag, len); break;
+    case 'l': if (TAG_PREFIX(tag, len, "let ")) return compile_let(vars, tag + 4, len - 4); break;
+    case 'p': 
+      if (TAG_PREFIX(tag, len, "pad=")) { emit_op(p, OP_PAD_BEGIN, (uint32_t)atoi(tag + 4)); return 1; } 
+      break;
+    case 'r':
+      if (TAG_PREFIX(tag, len, "rpad=")) { emit_op(p, OP_RPAD_BEGIN, (uint32_t)atoi(tag + 5)); return 1; }
+      if (TAG_EQ(tag, len, "reset/"))    { emit_op(p, OP_STYLE_RESET_ALL, 0); return 1; }
+      break;
+    case 's':
+      if (self_closing && TAG_PREFIX(tag, len, "space=")) { emit_op(p, OP_EMIT_SPACES, (uint32_t)atoi(tag + 6)); return 1; }
+      break;
+    case 'g':
+      if (self_closing && TAG_PREFIX(tag, len, "gap=")) { emit_op(p, OP_EMIT_SPACES, (uint32_t)atoi(tag + 4)); return 1; }
+      break;
+    case 'b':
+      if (TAG_EQ(tag, len, "br/")) { emit_op(p, OP_EMIT_NEWLINES, 1); return 1; }
+      if (self_closing && TAG_PREFIX(tag, len, "br=")) { emit_op(p, OP_EMIT_NEWLINES, (uint32_t)atoi(tag + 3)); return 1; }
+      break;
   }
 
   emit_op(p, OP_STYLE_PUSH, 0);
 
-  if (match_attr(p, tag, len)) { emit_op(p, OP_STYLE_FLUSH, 0); return 1; }
-  if (match_fg(p, tag, len))   { emit_op(p, OP_STYLE_FLUSH, 0); return 1; }
-  if (match_bg(p, tag, len))   { emit_op(p, OP_STYLE_FLUSH, 0); return 1; }
+  if (match_word(p, tag, len)) { emit_op(p, OP_STYLE_FLUSH, 0); return 1; }
 
   if (tag[0] == '#') {
     if (!compile_hex_fg(p, tag, len)) return 0;
     emit_op(p, OP_STYLE_FLUSH, 0); return 1;
   }
 
-  if (tag_prefix(tag, len, "bg_#")) {
+  if (TAG_PREFIX(tag, len, "bg_#")) {
     if (!compile_hex_bg(p, tag + 3, len - 3)) return 0;
     emit_op(p, OP_STYLE_FLUSH, 0); return 1;
   }
@@ -673,12 +1116,15 @@ static int compile_tag(crprintf_compiled *p, const char *tag, int len, int closi
     int slen;
     const char *sep = next_seg(seg, end, &slen);
 
-    if (match_attr(p, seg, slen)) {
-    } else if (tag_eq(seg, slen, "bg") && sep < end) {
+    instruction_t w = style_word(seg, slen);
+    
+    if (is_attr_op(w.op) || w.op == OP_SET_FG) {
+      emit_op(p, w.op, w.operand);
+    } else if (TAG_EQ(seg, slen, "bg") && sep < end) {
       seg = sep + 1;
       sep = next_seg(seg, end, &slen);
       if (!match_seg_bg(p, seg, slen)) return 0;
-    } else if (!match_fg(p, seg, slen)) return 0;
+    } else return 0;
 
     emitted++;
     seg = (sep < end) ? sep + 1 : end;
@@ -743,7 +1189,6 @@ static arg_class_t classify_arg(const char *spec, int len) {
   
   if (conv == '%') return ARG_NONE;
   if (conv == 'n') return ARG_PTR;
-  if (conv == 's') return ARG_CSTR;
   if (conv == 'p') return ARG_PTR;
   
   if (
@@ -760,6 +1205,7 @@ static arg_class_t classify_arg(const char *spec, int len) {
   if (p[0] == 'l' && p[1] == 'l') return ARG_LLONG;
   if (p[0] == 'l' && conv == 'c') return ARG_WINT;
   if (p[0] == 'l' && conv == 's') return ARG_WSTR;
+  if (conv == 's')                return ARG_CSTR;
   if (p[0] == 'l')                return ARG_LONG;
   if (p[0] == 'j')                return ARG_LLONG;
 
@@ -776,31 +1222,12 @@ static arg_class_t classify_arg(const char *spec, int len) {
   #define CRP_VA_DEREF(ap) (*(ap))
 #endif
 
-static inline void advance_format_args(const char *spec, CRP_VA_REF_T ap) {
-  const char *p = spec + 1;
-  
-  while (
-    *p == '-' ||
-    *p == '+' ||
-    *p == ' ' ||
-    *p == '#' ||
-    *p == '0'
-  ) p++;
-  
-  if (*p == '*') {
-    (void)va_arg(CRP_VA_DEREF(ap), int);
-    p++;
-  } else while (*p >= '0' && *p <= '9') p++;
-
-  if (*p == '.') {
-    p++;
-    if (*p == '*') {
-      (void)va_arg(CRP_VA_DEREF(ap), int);
-      p++;
-    } else while (*p >= '0' && *p <= '9') p++;
-  }
+// consumes what a spec took from ap, as recorded at compile time
+static inline void skip_format_args(const fmt_desc_t *d, CRP_VA_REF_T ap) {
+  if (d->flags & FMT_STAR_W) (void)va_arg(CRP_VA_DEREF(ap), int);
+  if (d->flags & FMT_STAR_P) (void)va_arg(CRP_VA_DEREF(ap), int);
 
-  switch (classify_arg(spec, (int)strlen(spec))) {
+  switch ((arg_class_t)d->cls) {
     case ARG_INT:    (void)va_arg(CRP_VA_DEREF(ap), int);          break;
     case ARG_LONG:   (void)va_arg(CRP_VA_DEREF(ap), long);         break;
     case ARG_LLONG:  (void)va_arg(CRP_VA_DEREF(ap), long long);    break;
@@ -814,19 +1241,129 @@ static inline void advance_format_args(const char *spec, CRP_VA_REF_T ap) {
   }
 }
 
-static const char *scan_fmt(crprintf_compiled *p, const char *ptr, const char **lit) {
-  flush_lit(p, *lit, ptr);
+static const char digit_pairs[201] =
+  "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+  "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+static inline unsigned long long fetch_integer(uint8_t cls, bool is_signed, CRP_VA_REF_T ap, bool *neg) {
+  long long v;
+  switch (cls) {
+    case ARG_LONG:  
+      if (!is_signed) return va_arg(CRP_VA_DEREF(ap), unsigned long);
+      v = va_arg(CRP_VA_DEREF(ap), long); break;
+    case ARG_LLONG: 
+      if (!is_signed) return va_arg(CRP_VA_DEREF(ap), unsigned long long);
+      v = va_arg(CRP_VA_DEREF(ap), long long); break;
+    case ARG_SIZE:  
+      if (!is_signed) return va_arg(CRP_VA_DEREF(ap), size_t);
+      v = (long long)va_arg(CRP_VA_DEREF(ap), ptrdiff_t); break;
+    default:        
+      if (!is_signed) return va_arg(CRP_VA_DEREF(ap), unsigned int);
+      v = va_arg(CRP_VA_DEREF(ap), int); break;
+  }
+  
+  *neg = v < 0;
+  return *neg ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+}
+
+// both writers fill backwards from end and return the first digit
+static inline char *format_dec(char *end, unsigned long long v) {
+  while (v >= 100) {
+    unsigned r = (unsigned)(v % 100); v /= 100;
+    end -= 2; memcpy(end, digit_pairs + r * 2, 2);
+  }
+  if (v >= 10) { end -= 2; memcpy(end, digit_pairs + v * 2, 2); }
+  else *--end = (char)('0' + v);
+  return end;
+}
+
+static inline char *format_hex(char *end, unsigned long long v, bool upper) {
+  const char *xd = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+  do { *--end = xd[v & 0xF]; v >>= 4; } while (v);
+  return end;
+}
+
+static inline bool is_fmt_op(uint32_t op) {
+  return op >= OP_EMIT_FMT && op <= OP_EMIT_CSTR;
+}
+
+static inline bool is_var_op(uint32_t op) {
+  return op == OP_EMIT_VAR || op == OP_APPLY_VAR;
+}
+
+// recognizes the specs the VM formats itself; everything else stays on vsnprintf
+static uint32_t native_fmt_op(const char *spec, size_t len, fmt_desc_t *d) {
+  const char *p = spec + 1;
+  const char *end = spec + len;
+  *d = (fmt_desc_t){ .len = (uint32_t)len };
+  if (len < 2) return OP_EMIT_FMT;
+
+  for (; p < end - 1 && (*p == '-' || *p == '0'); p++)
+    d->flags |= (*p == '-') ? FMT_LEFT : FMT_ZERO;
+
+  unsigned width = 0, prec = 0;
+  while (p < end && *p >= '0' && *p <= '9') 
+    if ((width = width * 10 + (unsigned)(*p++ - '0')) > FMT_MAX_WIDTH) return OP_EMIT_FMT;
+  
+  if (p < end && *p == '.') {
+    d->flags |= FMT_PREC; p++;
+    while (p < end && *p >= '0' && *p <= '9') 
+      if ((prec = prec * 10 + (unsigned)(*p++ - '0')) > FMT_MAX_WIDTH) return OP_EMIT_FMT;
+  }
+
+  size_t mods = (size_t)(end - 1 - p);
+  if (!(mods == 0 || (mods == 1 && (*p == 'l' || *p == 'z' || *p == 'j')) ||
+      (mods == 2 && p[0] == 'l' && p[1] == 'l'))) return OP_EMIT_FMT;
+
+  d->width = (uint16_t)width;
+  d->prec = (uint16_t)prec;
+  d->cls = (uint8_t)classify_arg(spec, (int)len);
+
+  switch (end[-1]) {
+    case 'd': case 'i': return OP_EMIT_INT;
+    case 'u':           return OP_EMIT_UINT;
+    case 'X':           d->flags |= FMT_UPPER; return OP_EMIT_UINT_HEX;
+    case 'x':           return OP_EMIT_UINT_HEX;
+    case 's':
+      if (mods || (d->flags & FMT_ZERO)) return OP_EMIT_FMT;
+      return OP_EMIT_CSTR;
+    default: return OP_EMIT_FMT;
+  }
+}
+
+static void describe_fmt(const char *spec, size_t len, fmt_desc_t *d) {
+  const char *p = spec + 1, *end = spec + len;
+  *d = (fmt_desc_t){ .len = (uint32_t)len, .cls = (uint8_t)classify_arg(spec, (int)len) };
+
+  while (p < end && (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')) p++;
+  if (p < end && *p == '*') { d->flags |= FMT_STAR_W; p++; }
+  else while (p < end && *p >= '0' && *p <= '9') p++;
+  
+  if (end - p > 1 && p[0] == '.' && p[1] == '*') d->flags |= FMT_STAR_P;
+}
 
+static void emit_fmt(crprintf_compiled *p, const char *spec, size_t len) {
+  fmt_desc_t desc;
+  uint32_t op = native_fmt_op(spec, len, &desc);
+  if (op == OP_EMIT_FMT) describe_fmt(spec, len, &desc);
+  emit_op(p, op, add_record(p, &desc, sizeof(desc), spec, len));
+}
+
+static const char *fmt_spec_end(const char *ptr) {
   const char *fs = ptr + 1;
   while (*fs=='-'||*fs=='+'||*fs==' '||*fs=='#'||*fs=='0') fs++;
   if (*fs == '*') fs++; else while (*fs >= '0' && *fs <= '9') fs++;
   if (*fs == '.') { fs++; if (*fs == '*') fs++; else while (*fs >= '0' && *fs <= '9') fs++; }
   while (*fs=='h'||*fs=='l'||*fs=='L'||*fs=='z'||*fs=='j'||*fs=='t') fs++;
   if (*fs) fs++;
+  return fs;
+}
 
-  uint32_t off = add_literal(p, ptr, fs - ptr);
-  arg_class_t cls = classify_arg(ptr, (int)(fs - ptr));
-  emit_op(p, OP_EMIT_FMT, off | ((uint32_t)cls << 28));
+static const char *scan_fmt(crprintf_compiled *p, const char *ptr, const char **lit) {
+  flush_lit(p, *lit, ptr);
+  const char *fs = fmt_spec_end(ptr);
+
+  emit_fmt(p, ptr, (size_t)(fs - ptr));
   *lit = fs;
   return fs;
 }
@@ -867,28 +1404,109 @@ static const char *scan_let_brace(crprintf_compiled *p, const char *ptr, const c
   return *lit;
 }
 
-static void compile_fragment(crprintf_compiled *p, const char *fmt, var_scope_t *vars) {
-  const char *ptr = fmt;
-  const char *lit = ptr;
+// mask of '<', '>', '{', '%' and NUL in the aligned block at s; the first one sits at ctz / SCAN_STRIDE
+// aligned blocks never cross a page, so reading past the terminator is safe
+#define SCAN_OVERREAD __attribute__((no_sanitize_address, no_sanitize_thread))
+
+#if defined(__AVX2__)
+  #define SCAN_BLOCK  32
+  #define SCAN_STRIDE 1
+  SCAN_OVERREAD static inline uint64_t special_chars(const char *s) {
+    __m256i v = _mm256_load_si256((const __m256i *)s);
+    __m256i m = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>'))),
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('{')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('%')))
+    );
+    m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+    return (uint32_t)_mm256_movemask_epi8(m);
+  }
+#elif defined(__SSE2__)
+  #define SCAN_BLOCK  16
+  #define SCAN_STRIDE 1
+  SCAN_OVERREAD static inline uint64_t special_chars(const char *s) {
+    __m128i v = _mm_load_si128((const __m128i *)s);
+    __m128i m = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('<')), _mm_cmpeq_epi8(v, _mm_set1_epi8('>'))),
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('{')), _mm_cmpeq_epi8(v, _mm_set1_epi8('%')))
+    );
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    return (uint32_t)_mm_movemask_epi8(m);
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  #define SCAN_BLOCK  16
+  #define SCAN_STRIDE 4
+  SCAN_OVERREAD static inline uint64_t special_chars(const char *s) {
+    uint8x16_t v = vld1q_u8((const uint8_t *)s);
+    uint8x16_t m = vorrq_u8(
+      vorrq_u8(vceqq_u8(v, vdupq_n_u8('<')), vceqq_u8(v, vdupq_n_u8('>'))),
+      vorrq_u8(vceqq_u8(v, vdupq_n_u8('{')), vceqq_u8(v, vdupq_n_u8('%')))
+    );
+    m = vorrq_u8(m, vceqzq_u8(v));
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+  }
+#else
+  #define SCAN_BLOCK  8
+  #define SCAN_STRIDE 8
+  #define SWAR_HAS(x, c) ({ \
+    uint64_t _x = (x) ^ (0x0101010101010101ull * (uint8_t)(c)); \
+    (_x - 0x0101010101010101ull) & ~_x; \
+  })
+  SCAN_OVERREAD static inline uint64_t special_chars(const char *s) {
+    uint64_t v;
+    memcpy(&v, s, 8);
+    #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+    #endif
+    uint64_t m = SWAR_HAS(v, '<') | SWAR_HAS(v, '>') | SWAR_HAS(v, '{') | SWAR_HAS(v, '%') | SWAR_HAS(v, 0);
+    return m & 0x8080808080808080ull;
+  }
+#endif
 
-  while (*ptr) {
-    if (p->compile_base && fmt >= p->compile_base && fmt <= p->compile_base + p->source_len)
-      p->_cur_src_off = (uint32_t)(ptr - p->compile_base);
+SCAN_OVERREAD static const char *find_special(const char *s) {
+  size_t mis = (uintptr_t)s & (SCAN_BLOCK - 1);
+  const char *b = s - mis;
+  uint64_t m = special_chars(b) >> (mis * SCAN_STRIDE);
+  if (m) return s + __builtin_ctzll(m) / SCAN_STRIDE;
+
+  for (;;) {
+    b += SCAN_BLOCK;
+    if ((m = special_chars(b))) return b + __builtin_ctzll(m) / SCAN_STRIDE;
+  }
+}
+
+static void compile_fragment(crprintf_compiled *p, const char *fmt, var_scope_t *vars) {
+  const char *ptr = fmt;
+  const char *lit = ptr;
+  bool track = p->compile_base && fmt >= p->compile_base && fmt <= p->compile_base + p->source_len;
+
+  while (*(ptr = find_special(ptr))) {
+    if (track) p->_cur_src_off = (uint32_t)(ptr - p->compile_base);
     if      (*ptr == '<' && ptr[1] == '<')                ptr = scan_escape(p, ptr, &lit, "<", 1);
     else if (*ptr == '>' && ptr[1] == '>')                ptr = scan_escape(p, ptr, &lit, ">", 1);
     else if (*ptr == '%' && ptr[1] == '%')                ptr = scan_escape(p, ptr, &lit, "%", 1);
-    else if (*ptr == '{' && memcmp(ptr, "{let ", 5) == 0) ptr = scan_let_brace(p, ptr, &lit, vars);
+    else if (*ptr == '{' && strncmp(ptr, "{let ", 5) == 0) ptr = scan_let_brace(p, ptr, &lit, vars);
     else if (*ptr == '{')                                 ptr = scan_var_brace(p, ptr, &lit, vars);
     else if (*ptr == '<')                                 ptr = scan_tag(p, ptr, &lit, vars);
-    else if (*ptr == '%' && ptr[1] && ptr[1] != '%')      ptr = scan_fmt(p, ptr, &lit);
+    else if (*ptr == '%' && ptr[1] && ptr[1] != '%' && !p->fmt_as_text) ptr = scan_fmt(p, ptr, &lit);
     else ptr++;
   }
 
-  if (p->compile_base && fmt >= p->compile_base && fmt <= p->compile_base + p->source_len)
-    p->_cur_src_off = (uint32_t)(ptr - p->compile_base);
+  if (track) p->_cur_src_off = (uint32_t)(ptr - p->compile_base);
   flush_lit(p, lit, ptr);
 }
 
+// only markup runs through the compiler; any other value is emitted as a literal
+static bool value_takes_args(const char *value, int vlen, var_scope_t *vars) {
+  if (!memchr(value, '<', (size_t)vlen) || (!memchr(value, '%', (size_t)vlen) && !memchr(value, '{', (size_t)vlen))) return false;
+
+  crprintf_compiled *tmp = program_new();
+  compile_fragment(tmp, value, vars);
+  bool takes = false;
+  for (size_t i = 0; i < tmp->code_len && !takes; i++) takes = is_fmt_op(tmp->code[i].op);
+  crprintf_compiled_free(tmp);
+  return takes;
+}
+
 static const char *scan_var_brace(crprintf_compiled *p, const char *ptr, const char **lit, var_scope_t *vars) {
   flush_lit(p, *lit, ptr);
 
@@ -909,52 +1527,68 @@ static const char *scan_var_brace(crprintf_compiled *p, const char *ptr, const c
     if (!e) goto emit_brace;
 
     int slen = (int)(e - s);
-    if (slen > 0 && slen < MAX_VAR_VALUE) {
-      char buf[MAX_VAR_VALUE];
-      if (lower || upper) { transform_case(buf, s, slen, lower); s = buf; }
+    if (slen > 0) {
+      char small[256];
+      char *buf = NULL;
+      if (lower || upper) {
+        buf = (slen < (int)sizeof(small)) ? small : malloc((size_t)slen);
+        if (!buf) goto emit_brace;
+        transform_case(buf, s, slen, lower); 
+        s = buf;
+      }
       uint32_t off = add_literal(p, s, slen);
       emit_op(p, OP_EMIT_LIT, off);
+      if (buf != small) free(buf);
     }
 
     *lit = end + 1;
     return *lit;
   }
 
-  const var_table_t *vtbl = scope_read(vars);
-  for (int i = 0; i < vtbl->count; i++) {
-    const crprintf_var_t *v = &vtbl->vars[i];
-    if (nlen != v->nlen || memcmp(name, v->name, nlen) != 0) continue;
-
-    const char *val = v->value;
-    int vlen = v->vlen;
-    char buf[MAX_VAR_VALUE];
-    
-    if (lower || upper) {
-      transform_case(buf, val, vlen, lower);
-      val = buf;
-    }
-    
-    if (memchr(val, '<', vlen)) {
-      char tmp[MAX_VAR_VALUE + 1];
-      memcpy(tmp, val, vlen);
-      tmp[vlen] = '\0';
-      const char *saved_base = p->compile_base;
-      p->compile_base = NULL;
-      compile_fragment(p, tmp, vars);
-      p->compile_base = saved_base;
-    } else if (v->is_fmt) {
-      arg_class_t cls = classify_arg(val, vlen);
-      uint32_t off = add_literal(p, val, vlen);
-      emit_op(p, OP_EMIT_FMT, off | ((uint32_t)cls << 28));
-    } else {
-      uint32_t off = add_literal(p, val, vlen);
-      emit_op(p, OP_EMIT_LIT, off);
-    }
-    
+  const crprintf_var_t *v = scope_find(vars, name, (size_t)nlen);
+  if (!v) { p->unresolved = true; goto emit_brace; }
+  
+  // a value that takes arguments is inlined, so the call site's argument count can't change later
+  bool late = p->bind_late && v->slot && !lower && !upper && !value_takes_args(v->value, v->vlen, vars);
+  uint32_t idx = late ? program_slot(p, v->slot) : UINT32_MAX;
+  if (idx != UINT32_MAX) {
+    emit_op(p, OP_EMIT_VAR, idx);
     *lit = end + 1;
     return *lit;
   }
 
+  const char *val = v->value;
+  int vlen = v->vlen;
+  char small[256];
+  char *buf = NULL;
+  
+  if (lower || upper) {
+    buf = (vlen < (int)sizeof(small)) ? small : malloc((size_t)vlen + 1);
+    if (!buf) goto emit_brace;
+    transform_case(buf, val, vlen, lower);
+    buf[vlen] = '\0';
+    val = buf;
+  }
+  
+  if (memchr(val, '<', vlen)) {
+    if (p->var_depth >= 8) { if (buf != small) free(buf); goto emit_brace; }
+    const char *saved_base = p->compile_base;
+    p->compile_base = NULL;
+    p->var_depth++;
+    compile_fragment(p, val, vars);
+    p->var_depth--;
+    p->compile_base = saved_base;
+  } else if (v->is_fmt) {
+    emit_fmt(p, val, (size_t)vlen);
+  } else {
+    uint32_t off = add_literal(p, val, vlen);
+    emit_op(p, OP_EMIT_LIT, off);
+  }
+  
+  if (buf != small) free(buf);
+  *lit = end + 1;
+  return *lit;
+
 emit_brace:;
   uint32_t off = add_literal(p, "{", 1);
   emit_op(p, OP_EMIT_LIT, off);
@@ -962,81 +1596,632 @@ emit_brace:;
   return *lit;
 }
 
-crprintf_compiled *crprintf_compile(const char *fmt) {
+static void optimize_program(crprintf_compiled *p, bool fold);
+
+// folded programs are the long-lived ones, so they also bind global variables late
+static crprintf_compiled *compile_program(const char *fmt, bool fold) {
   crprintf_compiled *p = program_new();
-  var_scope_t vars = { .base = &global_vars };
+  var_scope_t vars;
+  p->bind_late = fold;
 
+  scope_open(&vars);
   compile_fragment(p, fmt, &vars);
+  scope_close(&vars);
   emit_op(p, OP_HALT, 0);
-  return p;
+  optimize_program(p, fold);
+  return program_pack(p);
 }
 
-static size_t visible_len(const char *s, size_t n) {
+crprintf_compiled *crprintf_compile(const char *fmt) {
+  return compile_program(fmt, true);
+}
+
+static crprintf_compiled *static_find(const char *fmt);
+
+// call sites whose format was precompiled bind to it and never compile
+crprintf_compiled *crprintf_compile_once(crprintf_compiled **slot, const char *fmt) {
+  crprintf_compiled *prog = static_find(fmt);
+  if (!prog) prog = crprintf_compile(fmt);
+  crprintf_compiled *winner = NULL;
+  
+  if (!__atomic_compare_exchange_n(slot, &winner, prog, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    crprintf_compiled_free(prog);
+    return winner;
+  }
+  
+  if (__builtin_expect(crprintf_get_debug(), 0)) crprintf_disasm(prog, stderr);
+  if (__builtin_expect(crprintf_get_debug_hex(), 0)) crprintf_hexdump(prog, stderr);
+  return prog;
+}
+
+typedef struct { uint32_t lo, hi; } cp_range_t;
+
+// combining marks, joiners and format characters
+static const cp_range_t zero_width[] = {
+  {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF},
+  {0x05C1, 0x05C2}, {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A},
+  {0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DC}, {0x06DF, 0x06E4},
+  {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0711, 0x0711}, {0x0730, 0x074A},
+  {0x07A6, 0x07B0}, {0x07EB, 0x07F3}, {0x0816, 0x0819}, {0x081B, 0x0823},
+  {0x0825, 0x0827}, {0x0829, 0x082D}, {0x0900, 0x0902}, {0x093A, 0x093A},
+  {0x093C, 0x093C}, {0x0941, 0x0948}, {0x094D, 0x094D}, {0x0951, 0x0957},
+  {0x0962, 0x0963}, {0x0981, 0x0981}, {0x09BC, 0x09BC}, {0x09C1, 0x09C4},
+  {0x09CD, 0x09CD}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E},
+  {0x0EB1, 0x0EB1}, {0x0EB4, 0x0EBC}, {0x0EC8, 0x0ECD}, {0x1160, 0x11FF},
+  {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x202A, 0x202E},
+  {0x2060, 0x2064}, {0x20D0, 0x20FF}, {0x302A, 0x302D}, {0x3099, 0x309A},
+  {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0x1F3FB, 0x1F3FF},
+  {0xE0000, 0xE0FFF},
+};
+
+// East Asian Wide and Fullwidth blocks, including emoji presentation
+static const cp_range_t double_width[] = {
+  {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC},
+  {0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615},
+  {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1},
+  {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}, {0x26CE, 0x26CE},
+  {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+  {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B},
+  {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+  {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF},
+  {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}, {0x2E80, 0x303E},
+  {0x3041, 0x33FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF},
+  {0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19},
+  {0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4},
+  {0x17000, 0x18CFF}, {0x1B000, 0x1B2FF}, {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF},
+  {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F251}, {0x1F300, 0x1F64F},
+  {0x1F680, 0x1F6FF}, {0x1F7E0, 0x1F7EB}, {0x1F90C, 0x1F9FF}, {0x1FA70, 0x1FAFF},
+  {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+};
+
+static bool in_ranges(const cp_range_t *r, size_t n, uint32_t cp) {
+  size_t lo = 0, hi = n;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (cp > r[mid].hi) lo = mid + 1;
+    else if (cp < r[mid].lo) hi = mid;
+    else return true;
+  }
+  return false;
+}
+
+static int codepoint_width(uint32_t cp) {
+  if (cp < 0x300) return 1;
+  if ((cp >= 0x4E00 && cp <= 0x9FFF) || (cp >= 0xAC00 && cp <= 0xD7A3)) return 2;
+  if (in_ranges(zero_width, sizeof(zero_width) / sizeof(*zero_width), cp)) return 0;
+  if (in_ranges(double_width, sizeof(double_width) / sizeof(*double_width), cp)) return 2;
+  return 1;
+}
+
+// measures the escape sequence or UTF-8 character at s[*i] and steps past it
+static size_t special_width(const unsigned char *s, size_t n, size_t *i) {
+  size_t k = *i;
+  unsigned char c = s[k];
+  
+  if (c == 0x1b) {
+    while (++k < n && (unsigned)((s[k] | 0x20) - 'a') >= 26);
+    *i = (k < n) ? k + 1 : n;
+    return 0;
+  }
+
+  size_t len = (c >= 0xF0 && c <= 0xF4) ? 4 : (c >= 0xE0) && c < 0xF0 ? 3 : (c >= 0xC2 && c < 0xE0) ? 2 : 1;
+  uint32_t cp = (len == 4) ? (c & 0x07u) : (len == 3) ? (c & 0x0Fu) : (c & 0x1Fu);
+  
+  if (len == 1 || k + len > n) { *i = k + 1; return 1; }
+  for (size_t j = 1; j < len; j++) {
+    if ((s[k + j] & 0xC0) != 0x80) { *i = k + 1; return 1; }
+    cp = (cp << 6) | (s[k + j] & 0x3Fu);
+  }
+
+  *i = k + len;
+  return (size_t)codepoint_width(cp);
+}
+
+// reference implementation; the vector kernel below must agree with it byte for byte
+static size_t visible_len_scalar(const char *str, size_t n) {
+  const unsigned char *s = (const unsigned char *)str;
   size_t vis = 0;
-  for (size_t i = 0; i < n; i++) {
-    if (s[i] == '\x1b') while (++i < n && !isalpha(s[i]));
-    else vis++;
+  for (size_t i = 0; i < n;) {
+    if (s[i] < 0x80 && s[i] != 0x1b) { vis++; i++; }
+    else vis += special_width(s, n, &i);
   }
   return vis;
 }
 
+// nonzero when the block at s holds an escape or non-ASCII byte; the first one sits at ctz / WIDTH_STRIDE
+#if defined(__AVX2__)
+  #define WIDTH_BLOCK  32
+  #define WIDTH_STRIDE 1
+  static inline uint64_t special_mask(const unsigned char *s) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)s);
+    __m256i esc = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x1b));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(v, esc));
+  }
+#elif defined(__SSE2__)
+  #define WIDTH_BLOCK  16
+  #define WIDTH_STRIDE 1
+  static inline uint64_t special_mask(const unsigned char *s) {
+    __m128i v = _mm_loadu_si128((const __m128i *)s);
+    __m128i esc = _mm_cmpeq_epi8(v, _mm_set1_epi8(0x1b));
+    return (uint32_t)_mm_movemask_epi8(_mm_or_si128(v, esc));
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  #define WIDTH_BLOCK  16
+  #define WIDTH_STRIDE 4
+  static inline uint64_t special_mask(const unsigned char *s) {
+    uint8x16_t v = vld1q_u8(s);
+    uint8x16_t hit = vorrq_u8(vcgeq_u8(v, vdupq_n_u8(0x80)), vceqq_u8(v, vdupq_n_u8(0x1b)));
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+  }
+#else
+  #define WIDTH_BLOCK  8
+  #define WIDTH_STRIDE 8
+  static inline uint64_t special_mask(const unsigned char *s) {
+    uint64_t v;
+    memcpy(&v, s, 8);
+    #if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+    #endif
+    uint64_t x = v ^ 0x1b1b1b1b1b1b1b1bull;
+    uint64_t esc = (x - 0x0101010101010101ull) & ~x;
+    return (v | esc) & 0x8080808080808080ull;
+  }
+#endif
+
+// plain ASCII is counted a block at a time; only escapes and multibyte characters are decoded
+static size_t visible_len(const char *str, size_t n) {
+  const unsigned char *s = (const unsigned char *)str;
+  size_t vis = 0, i = 0;
+
+  while (i + WIDTH_BLOCK <= n) {
+    uint64_t m = special_mask(s + i);
+    if (!m) { vis += WIDTH_BLOCK; i += WIDTH_BLOCK; continue; }
+    
+    size_t skip = (size_t)__builtin_ctzll(m) / WIDTH_STRIDE;
+    vis += skip;
+    i += skip;
+    vis += special_width(s, n, &i);
+  }
+
+  return vis + visible_len_scalar(str + i, n - i);
+}
+
+// cuts str in place to at most cols visible columns; escapes past the cut are
+// kept so a style closed inside the cut text is still closed
+static size_t clip_visible(char *str, size_t n, size_t cols, size_t *vis) {
+  unsigned char *s = (unsigned char *)str;
+  size_t w = 0, keep = 0;
+  bool full = false;
+
+  for (size_t i = 0; i < n;) {
+    size_t at = i;
+    size_t cw = (s[i] < 0x80 && s[i] != 0x1b) ? (i++, 1) : special_width(s, n, &i);
+    if (s[at] != 0x1b && (full || w + cw > cols)) { full = true; continue; }
+
+    memmove(s + keep, s + at, i - at);
+    keep += i - at;
+    w += cw;
+  }
+
+  *vis = w;
+  return keep;
+}
+
 typedef struct {
   char *data;
   size_t len;
+  size_t cap;
+  char *dst;
+  size_t dst_size;
+  bool direct;
+  bool arena;
+  bool no_color;
+  bool truncated;
+  bool oom;
+  bool measure;
 } vm_output_t;
 
-static vm_output_t crprintf_vm_run_ex(crprintf_compiled *prog, va_list ap, crprintf_state *state, const vm_checkpoint_t *ckpt);
+static bool vm_out_heap(vm_output_t *o, size_t cap) {
+  *o = (vm_output_t){ .data = malloc(cap), .cap = cap, .no_color = crprintf_no_color };
+  return o->data != NULL;
+}
+
+static void vm_out_direct(vm_output_t *o, char *buf, size_t size) {
+  *o = (vm_output_t){
+    .data = buf, .cap = size, .dst = buf, .dst_size = size,
+    .direct = true, .no_color = crprintf_no_color,
+  };
+}
+
+// a sink with no buffer: everything is dropped on arrival, so only the
+// visible columns counted inside pad spans survive
+static void vm_out_measure(vm_output_t *o) {
+  *o = (vm_output_t){ .truncated = true, .no_color = true, .measure = true };
+}
+
+// direct output only leaves the caller's buffer when a pad span needs the bytes
+static bool vm_out_reserve(vm_output_t *o, size_t n, bool spill) {
+  if (o->truncated) return false;
+  bool direct = o->direct && o->data == o->dst;
+  if (direct && !spill) return false;
+
+  size_t cap = o->cap ? o->cap * 2 : 512;
+  while (o->len + n + 1 > cap) cap *= 2;
+
+  char *grown = direct ? malloc(cap) : realloc(o->data, cap);
+  if (!grown) { o->oom = true; return false; }
+  if (direct && o->len) memcpy(grown, o->dst, o->len);
+
+  o->data = grown;
+  o->cap = cap;
+  return true;
+}
+
+static size_t vm_out_room(const vm_output_t *o) {
+  if (o->truncated || o->cap == 0) return 0;
+  return o->cap - 1 - o->len;
+}
+
+static void vm_out_drop(vm_output_t *o, const char *s, size_t n) {
+  size_t room = vm_out_room(o);
+  if (room) { memcpy(o->data + o->len, s, room); o->len += room; n -= room; }
+  o->truncated = true;
+  o->len += n;
+}
+
+static void vm_out_drop_fill(vm_output_t *o, char c, size_t n) {
+  size_t room = vm_out_room(o);
+  if (room) { memset(o->data + o->len, c, room); o->len += room; n -= room; }
+  o->truncated = true;
+  o->len += n;
+}
+
+static bool vm_out_finish(vm_output_t *o) {
+  if (o->measure) return true;
+  bool spilled = o->direct && o->data != o->dst;
+  if (o->oom) {
+    if (spilled || !o->direct) free(o->data);
+    return false;
+  }
+
+  if (!o->direct) { o->data[o->len] = '\0'; return true; }
+  if (o->dst_size == 0) { if (spilled) free(o->data); return true; }
+
+  size_t copy = (o->len < o->dst_size) ? o->len : o->dst_size - 1;
+  if (spilled) { memcpy(o->dst, o->data, copy); free(o->data); o->data = o->dst; }
+  o->dst[copy] = '\0';
+  return true;
+}
+
+#define ARENA_MIN    512
+#define ARENA_WINDOW 64
+
+typedef struct {
+  char *data;
+  size_t cap;
+  size_t peak;
+  unsigned renders;
+  bool busy;
+} vm_arena_t;
+
+static __thread vm_arena_t tls_arena;
+static pthread_key_t arena_key;
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+
+static void arena_destroy(void *arg) {
+  vm_arena_t *a = arg;
+  free(a->data);
+  *a = (vm_arena_t){0};
+}
+
+static void arena_key_init(void) { pthread_key_create(&arena_key, arena_destroy); }
+
+// borrows the calling thread's arena; falls back to a private heap buffer when re-entered
+static bool vm_out_arena(vm_output_t *o) {
+  vm_arena_t *a = &tls_arena;
+  if (a->busy || crprintf_arena_cap == 0) return vm_out_heap(o, ARENA_MIN);
+
+  if (!a->data) {
+    pthread_once(&arena_key_once, arena_key_init);
+    pthread_setspecific(arena_key, a);
+    if (!(a->data = malloc(ARENA_MIN))) return false;
+    a->cap = ARENA_MIN;
+  }
+
+  a->busy = true;
+  *o = (vm_output_t){ .data = a->data, .cap = a->cap, .arena = true, .no_color = crprintf_no_color };
+  return true;
+}
+
+// takes the buffer back and trims it to the recent high-water mark or the configured cap
+static void vm_arena_settle(vm_output_t *o, bool ok) {
+  if (!o->arena) { if (ok) free(o->data); return; }
+
+  vm_arena_t *a = &tls_arena;
+  a->busy = false;
+  if (!ok) { *a = (vm_arena_t){0}; return; }
+
+  a->data = o->data;
+  a->cap = o->cap;
+  if (o->len + 1 > a->peak) a->peak = o->len + 1;
+  if (++a->renders < ARENA_WINDOW && a->cap <= crprintf_arena_cap) return;
+
+  size_t want = ARENA_MIN;
+  while (want < a->peak) want *= 2;
+  if (want > crprintf_arena_cap) want = crprintf_arena_cap;
+  a->peak = 0; a->renders = 0;
+
+  if (want >= a->cap) return;
+  if (want < ARENA_MIN) { free(a->data); a->data = NULL; a->cap = 0; return; }
+
+  char *shrunk = realloc(a->data, want);
+  if (shrunk) { a->data = shrunk; a->cap = want; }
+}
+
+// the columns of a table, by the ordinal of the outermost span in a row;
+// spans without a conversion keep their N and are not columns
+typedef struct {
+  int16_t column_of[CRPRINTF_TABLE_COLUMNS];
+  size_t width[CRPRINTF_TABLE_COLUMNS];
+  size_t columns;
+  size_t span;
+} vm_table_t;
+
+// a batch reloads its argument row from the next record at HALT and runs
+// the program again instead of returning
+typedef struct {
+  crprintf_arg *row;
+  const char *rec;
+  size_t left;
+  const crprintf_record_desc *desc;
+  FILE *stream;
+  size_t written;
+  vm_table_t *table;
+} vm_batch_t;
+
+// arguments handed over already typed; when present the VM never touches ap
+typedef struct {
+  const crprintf_arg *v;
+  size_t count;
+  size_t next;
+  vm_batch_t *batch;
+} vm_args_t;
+
+static const crprintf_arg missing_arg = { .len = CRPRINTF_ARG_VALUE };
+
+static inline bool style_same(const style_entry_t *a, const style_entry_t *b) {
+  return a->fg == b->fg && a->bg == b->bg && a->fg_rgb == b->fg_rgb && a->bg_rgb == b->bg_rgb && a->flags == b->flags;
+}
+
+static void load_field(crprintf_arg *a, const char *rec, const crprintf_field *f) {
+  const char *src = rec + f->offset;
+  a->len = CRPRINTF_ARG_VALUE;
+
+  switch ((arg_class_t)f->type) {
+    case ARG_INT:    { int v;          memcpy(&v, src, sizeof(v)); a->v.i = v; break; }
+    case ARG_LONG:   { long v;         memcpy(&v, src, sizeof(v)); a->v.i = v; break; }
+    case ARG_LLONG:  { long long v;    memcpy(&v, src, sizeof(v)); a->v.i = v; break; }
+    case ARG_SIZE:   { size_t v;       memcpy(&v, src, sizeof(v)); a->v.u = v; break; }
+    case ARG_DOUBLE: { double v;       memcpy(&v, src, sizeof(v)); a->v.f = v; break; }
+    case ARG_CSTR:   { const char *v;  memcpy(&v, src, sizeof(v)); a->v.s = v; break; }
+    case ARG_PTR:
+    case ARG_WSTR:   { const void *v;  memcpy(&v, src, sizeof(v)); a->v.p = v; break; }
+    case ARG_WINT:   { wint_t v;       memcpy(&v, src, sizeof(v)); a->v.i = (long long)v; break; }
+    case ARG_NONE:   a->v.u = 0; break;
+  }
+}
+
+static void batch_next_row(vm_args_t *args) {
+  vm_batch_t *b = args->batch;
+  for (size_t f = 0; f < args->count; f++) load_field(&b->row[f], b->rec, &b->desc->fields[f]);
+  b->rec += b->desc->stride;
+  b->left--;
+  args->next = 0;
+}
+
+// rows are written in chunks of about this much; one buffer for a whole
+// large table costs more in fresh pages than it saves in writes
+#define BATCH_CHUNK (32 * 1024)
+
+static inline const crprintf_arg *next_arg(vm_args_t *args) {
+  return args->next < args->count ? &args->v[args->next++] : &missing_arg;
+}
+
+// the typed twin of fetch_integer: truncates to what va_arg would have read
+static inline unsigned long long typed_integer(uint8_t cls, bool is_signed, const crprintf_arg *a, bool *neg) {
+  long long v;
+  switch (cls) {
+    case ARG_LONG:
+      if (!is_signed) return (unsigned long)a->v.u;
+      v = (long)a->v.i; break;
+    case ARG_LLONG:
+      if (!is_signed) return a->v.u;
+      v = a->v.i; break;
+    case ARG_SIZE:
+      if (!is_signed) return (size_t)a->v.u;
+      v = (long long)(ptrdiff_t)a->v.i; break;
+    default:
+      if (!is_signed) return (unsigned int)a->v.u;
+      v = (int)a->v.i; break;
+  }
+
+  *neg = v < 0;
+  return *neg ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+
+static int format_va(char *dst, size_t size, const char *spec, va_list ap) {
+  va_list ap_copy;
+  va_copy(ap_copy, ap);
+  int n = vsnprintf(dst, size, spec, ap_copy);
+  va_end(ap_copy);
+  return n;
+}
+
+// one generic spec from typed arguments; star holds the '*' values it takes first
+static int format_typed(char *dst, size_t size, const char *spec, uint8_t cls, const int *star, int stars, const crprintf_arg *a) {
+  #define TYPED(v) ( \
+    stars == 2 ? snprintf(dst, size, spec, star[0], star[1], v) : \
+    stars == 1 ? snprintf(dst, size, spec, star[0], v) : snprintf(dst, size, spec, v))
+
+  switch ((arg_class_t)cls) {
+    case ARG_INT:    return TYPED((int)a->v.i);
+    case ARG_LONG:   return TYPED((long)a->v.i);
+    case ARG_LLONG:  return TYPED(a->v.i);
+    case ARG_SIZE:   return TYPED((size_t)a->v.u);
+    case ARG_DOUBLE: return TYPED(a->v.f);
+    case ARG_CSTR:   return TYPED(a->v.s);
+    case ARG_PTR:    return TYPED(a->v.p);
+    case ARG_WINT:   return TYPED((wint_t)a->v.i);
+    case ARG_WSTR:   return TYPED((const wchar_t *)a->v.p);
+    case ARG_NONE:   return snprintf(dst, size, spec, 0);
+  }
+  return 0;
+
+  #undef TYPED
+}
+
+#pragma GCC diagnostic pop
+
+// the columns an n-byte conversion takes, worked out from its argument rather
+// than its text so that measuring a long cell needs no buffer: only the bytes
+// of a string or character can be other than ASCII, and the rest is padding
+static size_t conv_columns(const char *spec, size_t len, const int *star, int stars, const crprintf_arg *a, size_t n) {
+  char conv = spec[len - 1];
+  bool wide = len >= 3 && spec[len - 2] == 'l';
+  if (conv != 's' && conv != 'c') return n;
+
+  if (!wide && conv == 'c') {
+    char c = (char)a->v.i;
+    return n - 1 + visible_len(&c, 1);
+  }
+
+  size_t prec = SIZE_MAX;
+  const char *dot = memchr(spec, '.', len);
+  if (conv != 'c' && dot) {
+    if (dot[1] == '*') prec = (star[stars - 1] >= 0) ? (size_t)star[stars - 1] : SIZE_MAX;
+    else prec = (size_t)strtoul(dot + 1, NULL, 10);
+  }
+
+  if (!wide) {
+    if (!a->v.s) return n;
+    const char *stop = (prec == SIZE_MAX) ? NULL : memchr(a->v.s, '\0', prec);
+    size_t body = (prec == SIZE_MAX) ? strlen(a->v.s) : stop ? (size_t)(stop - a->v.s) : prec;
+    return n - body + visible_len(a->v.s, body);
+  }
+
+  // converted a character at a time as snprintf did, measured a stack chunk at a time
+  wchar_t one = (wchar_t)a->v.i;
+  const wchar_t *w = (conv == 'c') ? &one : a->v.p;
+  if (!w) return n;
+
+  char chunk[256];
+  size_t fill = 0, body = 0, vis = 0;
+  mbstate_t st;
+  memset(&st, 0, sizeof(st));
+  for (size_t i = 0; conv == 'c' ? i < 1 : w[i] != 0; i++) {
+    char mb[MB_LEN_MAX];
+    size_t k = wcrtomb(mb, w[i], &st);
+    if (k == (size_t)-1 || body + k > prec) break;
+    if (fill + k > sizeof(chunk)) { vis += visible_len(chunk, fill); fill = 0; }
+    memcpy(chunk + fill, mb, k);
+    fill += k;
+    body += k;
+  }
+  return n - body + vis + visible_len(chunk, fill);
+}
+
+static bool crprintf_vm_run_ex(
+  crprintf_compiled *prog, va_list ap, vm_args_t *args, crprintf_state *state,
+  const vm_checkpoint_t *ckpt, vm_output_t *o
+);
 
-static vm_output_t crprintf_vm_run(crprintf_compiled *prog, va_list ap, crprintf_state *state) {
-  return crprintf_vm_run_ex(prog, ap, state, NULL);
+static bool crprintf_vm_run(crprintf_compiled *prog, va_list ap, crprintf_state *state, vm_output_t *o) {
+  return crprintf_vm_run_ex(prog, ap, NULL, state, NULL, o);
 }
 
-static vm_output_t crprintf_vm_run_ex(crprintf_compiled *prog, va_list ap, crprintf_state *state, const vm_checkpoint_t *ckpt) {
+static bool crprintf_vm_run_ex(
+  crprintf_compiled *prog, va_list ap, vm_args_t *args, crprintf_state *state,
+  const vm_checkpoint_t *ckpt, vm_output_t *o
+) {
   vm_regs_t regs = {0};
-  size_t cap, pos;
-  char *out;
+
+  #define OUT_FITS(n, spill) \
+    (__builtin_expect(o->len + (n) + 1 <= o->cap, 1) || vm_out_reserve(o, (n), (spill)))
+  
+  #define OUT_STR(s, l) ({ \
+    const char *_s = (s); size_t _l = (l); \
+    if (OUT_FITS(_l, regs.pad_depth > 0)) { memcpy(o->data + o->len, _s, _l); o->len += _l; } \
+    else vm_out_drop(o, _s, _l); \
+  })
+  
+  // visible columns are only counted while a pad span is open to measure them
+  #define OUT_TEXT(s, l) ({ \
+    const char *_ts = (s); size_t _tl = (l); \
+    OUT_STR(_ts, _tl); \
+    if (regs.pad_depth > 0) regs.col += visible_len(_ts, _tl); \
+  })
+  
+  #define OUT_FILL(c, l) ({ \
+    size_t _fl = (l); \
+    if (OUT_FITS(_fl, regs.pad_depth > 0)) { memset(o->data + o->len, (c), _fl); o->len += _fl; } \
+    else vm_out_drop_fill(o, (c), _fl); \
+    regs.col += _fl; \
+  })
+  
+  #define OUT_CSTR(s) ({ const char *_cs = (s); OUT_STR(_cs, strlen(_cs)); })
+
+  // batches remember the style their output is left in and skip escapes that wouldn't change it
+  vm_batch_t *batch = args ? args->batch : NULL;
+  vm_table_t *table = batch ? batch->table : NULL;
+  style_entry_t shown = {0};
+  #define STYLE_SHOWN() (batch && style_same(&regs.current, &shown))
 
   if (ckpt && ckpt->valid) {
     regs = ckpt->regs;
-    cap = ckpt->out_cap;
-    pos = ckpt->out_pos;
-    out = malloc(cap);
-    if (!out) return (vm_output_t){ NULL, 0 };
-    memcpy(out, ckpt->out_buf, pos);
-  } else {
-    if (state) {
-      regs.current = state->current;
-      memcpy(regs.style_stack, state->style_stack, sizeof(state->style_stack));
-      regs.style_depth = state->style_depth;
-    }
-    cap = 512; pos = 0;
-    out = malloc(cap);
-    if (!out) return (vm_output_t){ NULL, 0 };
+    if (!OUT_FITS(ckpt->out_pos, true)) return vm_out_finish(o);
+    memcpy(o->data, ckpt->out_buf, ckpt->out_pos);
+    o->len = ckpt->out_pos;
+  } else if (state) {
+    regs.current = state->current;
+    memcpy(regs.style_stack, state->style_stack, sizeof(state->style_stack));
+    regs.style_depth = state->style_depth;
   }
 
-  #define ENSURE(n) ({ \
-  while (pos + (n) + 1 > cap) { \
-    cap *= 2; out = realloc(out, cap); \
-    if (!out) return (vm_output_t){ NULL, 0 }; \
-  }})
-  
-  #define OUT_STR(s, l) ({ ENSURE(l); memcpy(out+pos, s, l); pos += (l); })
-  #define OUT_CSTR(s) ({ size_t _l = strlen(s); OUT_STR(s, _l); })
+  // folded escapes assume rendering starts from a clean style
+  bool dynamic = state && (
+    state->style_depth || state->current.flags ||
+    state->current.fg || state->current.bg
+  );
 
-  if (!(ckpt && ckpt->valid) && state && !crprintf_no_color) {
+  if (!(ckpt && ckpt->valid) && state && !o->no_color) {
     style_entry_t *cur = &regs.current;
     if (cur->fg || cur->bg || cur->flags) {
       char esc[128];
-      int n = emit_style_esc(esc, sizeof(esc), cur);
+      int n = emit_style_esc(esc, cur);
       OUT_STR(esc, (size_t)n);
     }
   }
 
-  const instruction_t *ip = (ckpt && ckpt->valid) ? prog->code + ckpt->resume_ip : prog->code;
+  const uint8_t *ip = (ckpt && ckpt->valid) ? prog->bc + ckpt->resume_off : prog->bc;
+  instruction_t ins;
+  const char *lits = prog->literals;
+  
+  // late-bound values run in place; their programs never reference other slots
+  const uint8_t *ret_ip = NULL;
+  const char *ret_lits = NULL;
+  unsigned epoch = prog->slot_count ? vars_read_lock() : 0;
+  
   static const void *dispatch[OP_MAX] = {
     [OP_NOP]             = &&op_nop,
     [OP_EMIT_LIT]        = &&op_emit_lit,
     [OP_EMIT_FMT]        = &&op_emit_fmt,
+    [OP_EMIT_INT]        = &&op_emit_int,
+    [OP_EMIT_UINT]       = &&op_emit_int,
+    [OP_EMIT_UINT_HEX]   = &&op_emit_int,
+    [OP_EMIT_CSTR]       = &&op_emit_cstr,
     [OP_SET_FG]          = &&op_set_fg,
     [OP_SET_BG]          = &&op_set_bg,
     [OP_SET_FG_RGB]      = &&op_set_fg_rgb,
@@ -1057,104 +2242,198 @@ static vm_output_t crprintf_vm_run_ex(crprintf_compiled *prog, va_list ap, crpri
     [OP_EMIT_SPACES]     = &&op_emit_spaces,
     [OP_EMIT_NEWLINES]   = &&op_emit_newlines,
     [OP_SNAPSHOT]        = &&op_snapshot,
+    [OP_STYLE_APPLY]     = &&op_style_apply,
+    [OP_EMIT_VAR]        = &&op_var,
+    [OP_APPLY_VAR]       = &&op_var,
+    [OP_VAR_RET]         = &&op_var_ret,
     [OP_HALT]            = &&op_halt,
   };
 
-  #define DISPATCH() goto *dispatch[ip->op]
-  #define NEXT()     do { ip++; DISPATCH(); } while(0)
+  #define DISPATCH() do { \
+    uint8_t _op = *ip++; \
+    ins.op = _op & ~BC_ARG; \
+    ins.operand = (_op & BC_ARG) ? bc_varint(&ip) : 0; \
+    goto *dispatch[ins.op]; \
+  } while (0)
+  #define NEXT() DISPATCH()
 
   DISPATCH();
 
   op_nop: NEXT();
 
   op_emit_lit: {
-    OUT_CSTR(prog->literals + ip->operand);
+    size_t len = bc_varint(&ip);
+    OUT_TEXT(lits + ins.operand, len);
     NEXT();
   }
 
   op_emit_fmt: {
-    uint32_t lit_off = ip->operand & 0x0FFFFFFF;
-    const char *spec = prog->literals + lit_off;
+    fmt_desc_t d;
+    memcpy(&d, lits + ins.operand, sizeof(d));
+    const char *spec = lits + ins.operand + sizeof(d);
+
+    int star[2], stars = 0;
+    const crprintf_arg *a = NULL;
+    if (args) {
+      if (d.flags & FMT_STAR_W) star[stars++] = (int)next_arg(args)->v.i;
+      if (d.flags & FMT_STAR_P) star[stars++] = (int)next_arg(args)->v.i;
+      a = (d.cls != ARG_NONE) ? next_arg(args) : &missing_arg;
+      if (a->len != CRPRINTF_ARG_VALUE) { OUT_TEXT(a->v.s, a->len); NEXT(); }
+    }
+
+    #define FORMAT_SPEC(dst, size) \
+      (args ? format_typed((dst), (size), spec, d.cls, star, stars, a) : format_va((dst), (size), spec, ap))
     
-    char tmp[256];
-    va_list ap_copy;
-    va_copy(ap_copy, ap);
+    // format straight into the output; only a grow or a dropped pad span formats again.
+    // a measure pass formats once onto the stack, and only inside a span
+    char local[256];
+    size_t room = vm_out_room(o);
+    size_t start = o->len;
+    int n = !o->measure ? FORMAT_SPEC(room ? o->data + o->len : NULL, room ? room + 1 : 0)
+      : regs.pad_depth > 0 ? FORMAT_SPEC(local, sizeof(local)) : 0;
     
-    #pragma GCC diagnostic push
-    #pragma GCC diagnostic ignored "-Wformat-nonliteral"
-    int n = vsnprintf(tmp, sizeof(tmp), spec, ap_copy);
-    va_end(ap_copy);
+    if (n > 0) {
+      if (o->measure && (size_t)n < sizeof(local)) {
+        regs.col += visible_len(local, (size_t)n);
+      } else if (o->measure) {
+        regs.col += args ? conv_columns(spec, d.len, star, stars, a, (size_t)n) : (size_t)n;
+        o->len += (size_t)n;
+        o->truncated = true;
+      } else if ((size_t)n <= room || OUT_FITS((size_t)n, regs.pad_depth > 0)) {
+        if ((size_t)n > room) FORMAT_SPEC(o->data + o->len, (size_t)n + 1);
+        o->len += (size_t)n;
+        if (regs.pad_depth > 0) regs.col += visible_len(o->data + start, (size_t)n);
+      } else {
+        if (regs.pad_depth > 0) {
+          char *wide = ((size_t)n < sizeof(local)) ? local : malloc((size_t)n + 1);
+          if (!wide) { o->oom = true; NEXT(); }
+          FORMAT_SPEC(wide, (size_t)n + 1);
+          regs.col += visible_len(wide, (size_t)n);
+          if (wide != local) free(wide);
+        }
+        o->len += (size_t)n;
+        o->truncated = true;
+      }
+    }
+    #undef FORMAT_SPEC
     
-    if (n > 0 && (size_t)n < sizeof(tmp)) {
-      OUT_STR(tmp, (size_t)n);
-    } else if (n > 0) {
-      ENSURE((size_t)n);
-      va_copy(ap_copy, ap);
-      vsnprintf(out + pos, (size_t)n + 1, spec, ap_copy);
-      va_end(ap_copy);
-      pos += (size_t)n;
+    if (!args) skip_format_args(&d, CRP_VA_PASS(ap));
+    NEXT();
+  }
+
+  op_emit_int: {
+    fmt_desc_t d;
+    memcpy(&d, lits + ins.operand, sizeof(d));
+
+    bool neg = false;
+    unsigned long long v = args
+      ? typed_integer(d.cls, ins.op == OP_EMIT_INT, next_arg(args), &neg)
+      : fetch_integer(d.cls, ins.op == OP_EMIT_INT, CRP_VA_PASS(ap), &neg);
+
+    char digits[24];
+    char *end = digits + sizeof(digits);
+    char *s = (ins.op == OP_EMIT_UINT_HEX) ? format_hex(end, v, d.flags & FMT_UPPER) : format_dec(end, v);
+    if ((d.flags & FMT_PREC) && d.prec == 0 && v == 0) s = end;
+    if (neg) *--s = '-';
+
+    size_t ndig = (size_t)(end - s) - neg;
+    size_t zeros = 0;
+    if (d.flags & FMT_PREC) zeros = d.prec > ndig ? d.prec - ndig : 0;
+    else if ((d.flags & (FMT_ZERO | FMT_LEFT)) == FMT_ZERO && d.width > end - s) zeros = d.width - (size_t)(end - s);
+
+    size_t total = (size_t)(end - s) + zeros;
+    size_t pad = d.width > total ? d.width - total : 0;
+
+    if (pad && !(d.flags & FMT_LEFT)) OUT_FILL(' ', pad);
+    if (zeros) {
+      if (neg) { OUT_STR(s, 1); s++; regs.col++; }
+      OUT_FILL('0', zeros);
     }
-    #pragma GCC diagnostic pop
+    OUT_STR(s, (size_t)(end - s));
+    regs.col += (size_t)(end - s);
+    if (pad && (d.flags & FMT_LEFT)) OUT_FILL(' ', pad);
+    NEXT();
+  }
+
+  op_emit_cstr: {
+    fmt_desc_t d;
+    memcpy(&d, lits + ins.operand, sizeof(d));
+
+    const char *s;
+    size_t known = CRPRINTF_ARG_VALUE;
+    if (args) { const crprintf_arg *a = next_arg(args); s = a->v.s; known = a->len; }
+    else s = va_arg(CRP_VA_DEREF(CRP_VA_PASS(ap)), const char *);
+    if (!s) { s = ((d.flags & FMT_PREC) && d.prec < 6) ? "" : "(null)"; known = CRPRINTF_ARG_VALUE; }
     
-    advance_format_args(spec, CRP_VA_PASS(ap));
+    size_t len;
+    if (known != CRPRINTF_ARG_VALUE) len = ((d.flags & FMT_PREC) && d.prec < known) ? d.prec : known;
+    else {
+      const char *stop = (d.flags & FMT_PREC) ? memchr(s, '\0', d.prec) : NULL;
+      len = (d.flags & FMT_PREC) ? (stop ? (size_t)(stop - s) : d.prec) : strlen(s);
+    }
+    size_t pad = d.width > len ? d.width - len : 0;
+
+    if (pad && !(d.flags & FMT_LEFT)) OUT_FILL(' ', pad);
+    OUT_TEXT(s, len);
+    if (pad && (d.flags & FMT_LEFT)) OUT_FILL(' ', pad);
     NEXT();
   }
 
   op_set_fg: { 
-    regs.current.fg = ip->operand;
+    regs.current.fg = ins.operand;
     NEXT(); 
   }
   
   op_set_bg: { 
-    regs.current.bg = ip->operand;
+    regs.current.bg = ins.operand;
     NEXT(); 
   }
   
   op_set_bold: { 
-    if (ip->operand) regs.current.flags |= STYLE_BOLD;
+    if (ins.operand) regs.current.flags |= STYLE_BOLD;
     else regs.current.flags &= ~STYLE_BOLD;
     NEXT(); 
   }
   
   op_set_dim: { 
-    if (ip->operand) regs.current.flags |= STYLE_DIM;
+    if (ins.operand) regs.current.flags |= STYLE_DIM;
     else regs.current.flags &= ~STYLE_DIM;
     NEXT(); 
   }
   
   op_set_ul: {
-    if (ip->operand) regs.current.flags |= STYLE_UL;
+    if (ins.operand) regs.current.flags |= STYLE_UL;
     else regs.current.flags &= ~STYLE_UL;
     NEXT();
   }
 
   op_set_italic: {
-    if (ip->operand) regs.current.flags |= STYLE_ITALIC;
+    if (ins.operand) regs.current.flags |= STYLE_ITALIC;
     else regs.current.flags &= ~STYLE_ITALIC;
     NEXT();
   }
 
   op_set_strike: {
-    if (ip->operand) regs.current.flags |= STYLE_STRIKE;
+    if (ins.operand) regs.current.flags |= STYLE_STRIKE;
     else regs.current.flags &= ~STYLE_STRIKE;
     NEXT();
   }
 
   op_set_invert: {
-    if (ip->operand) regs.current.flags |= STYLE_INVERT;
+    if (ins.operand) regs.current.flags |= STYLE_INVERT;
     else regs.current.flags &= ~STYLE_INVERT;
     NEXT();
   }
   
   op_set_fg_rgb: { 
     regs.current.fg = COL_RGB;
-    regs.current.fg_rgb = ip->operand; 
+    regs.current.fg_rgb = ins.operand; 
     NEXT(); 
   }
   
   op_set_bg_rgb: { 
     regs.current.bg = COL_RGB;
-    regs.current.bg_rgb = ip->operand;
+    regs.current.bg_rgb = ins.operand;
     NEXT();
   }
   
@@ -1163,15 +2442,20 @@ static vm_output_t crprintf_vm_run_ex(crprintf_compiled *prog, va_list ap, crpri
     NEXT();
   }
   
-  op_pad_begin: {
-    if (regs.pad_depth < 8) regs.pad_stack[regs.pad_depth++] 
-      = (pad_entry_t){ pos, (int)ip->operand, 0 };
-    NEXT();
-  }
-  
+  op_pad_begin:
   op_rpad_begin: {
+    int width = (int)ins.operand;
+    int16_t column = -1;
+    
+    // a table cell is laid out at its column's width once the widths are known
+    if (table && regs.pad_depth == 0) {
+      column = (table->span < CRPRINTF_TABLE_COLUMNS) ? table->column_of[table->span] : -1;
+      table->span++;
+      if (column >= 0 && !o->measure) width = (int)table->width[column];
+    }
+    
     if (regs.pad_depth < 8) regs.pad_stack[regs.pad_depth++] 
-      = (pad_entry_t){ pos, (int)ip->operand, 1 };
+      = (pad_entry_t){ o->len, regs.col, width, column, ins.op == OP_RPAD_BEGIN };
     NEXT();
   }
   
@@ -1179,209 +2463,1371 @@ static vm_output_t crprintf_vm_run_ex(crprintf_compiled *prog, va_list ap, crpri
     if (regs.pad_depth <= 0) NEXT();
     regs.pad_depth--;
     pad_entry_t pe = regs.pad_stack[regs.pad_depth];
-    size_t vis = visible_len(out + pe.mark, pos - pe.mark);
+    
+    size_t vis = regs.col - pe.col;
+    if (pe.column >= 0 && o->measure) {
+      size_t w = (vis > (size_t)pe.width) ? vis : (size_t)pe.width;
+      if (w > table->width[pe.column]) table->width[pe.column] = w;
+      NEXT();
+    }
+    
+    // only a capped column holds cells wider than itself
+    if (pe.column >= 0 && vis > (size_t)pe.width && !o->truncated) {
+      o->len = pe.mark + clip_visible(o->data + pe.mark, o->len - pe.mark, (size_t)pe.width, &vis);
+      regs.col = pe.col + vis;
+    }
+    
     if ((size_t)pe.width <= vis) NEXT();
-  
     size_t pad_n = pe.width - vis;
-    ENSURE(pad_n);
-    if (pe.right_align) {
-      memmove(out + pe.mark + pad_n, out + pe.mark, pos - pe.mark);
-      memset(out + pe.mark, ' ', pad_n);
-    } else memset(out + pos, ' ', pad_n);
     
-    pos += pad_n;
+    if (!pe.right_align || o->truncated) {
+      OUT_FILL(' ', pad_n);
+      NEXT();
+    }
+  
+    // only reached when the span's width depends on arguments; static spans are resolved at compile time
+    if (!OUT_FITS(pad_n, true)) NEXT();
+    memmove(o->data + pe.mark + pad_n, o->data + pe.mark, o->len - pe.mark);
+    memset(o->data + pe.mark, ' ', pad_n);
+    o->len += pad_n;
+    regs.col += pad_n;
     NEXT();
   }
   
   op_emit_spaces: {
-    size_t n = (size_t)ip->operand;
-    ENSURE(n);
-    memset(out + pos, ' ', n);
-    pos += n;
+    OUT_FILL(' ', (size_t)ins.operand);
+    NEXT();
+  }
+  
+  op_emit_newlines: {
+    OUT_FILL('\n', (size_t)ins.operand);
+    NEXT();
+  }
+
+  op_style_reset: {
+    if (regs.style_depth > 0) regs.current = regs.style_stack[--regs.style_depth];
+    else regs.current = (style_entry_t){.fg = COL_NONE, .bg = COL_NONE};
+    if (ins.operand) NEXT();
+    goto style_emit;
+  }
+  
+  op_style_reset_all: {
+    regs.current = (style_entry_t){.fg = COL_NONE, .bg = COL_NONE};
+    regs.style_depth = 0;
+    if (!o->no_color && !ins.operand && !STYLE_SHOWN()) { OUT_CSTR("\x1b[0m"); shown = regs.current; }
+    NEXT();
+  }
+
+  op_style_apply: {
+    const char *rec = lits + ins.operand;
+    size_t len = bc_varint(&ip);
+    style_delta_t d;
+    memcpy(&d, rec, sizeof(d));
+    apply_style_delta(&regs, &d);
+    if (o->no_color || (d.stack & DELTA_QUIET)) NEXT();
+    if (dynamic) goto style_emit;
+    if (STYLE_SHOWN()) NEXT();
+    OUT_STR(rec + sizeof(d), len);
+    shown = regs.current;
     NEXT();
   }
+
+  op_var: {
+    const var_binding_t *b = __atomic_load_n(&prog->slots[ins.operand]->binding, __ATOMIC_ACQUIRE);
+    const crprintf_compiled *sub = (ins.op == OP_EMIT_VAR) ? b->text : b->style;
+    if (!sub) NEXT();
+    ret_ip = ip; ret_lits = lits;
+    ip = sub->bc; lits = sub->literals;
+    DISPATCH();
+  }
+  
+  op_var_ret: {
+    ip = ret_ip; lits = ret_lits;
+    DISPATCH();
+  }
+
+  op_style_flush:
+  style_emit: {
+    if (!o->no_color && !STYLE_SHOWN()) {
+      char esc[128];
+      int n = emit_style_esc(esc, &regs.current);
+      OUT_STR(esc, (size_t)n);
+      shown = regs.current;
+    }
+    NEXT();
+  }
+  
+  op_snapshot: {
+    if (o->truncated || batch) NEXT();
+    vm_checkpoint_t *save = &prog->checkpoint;
+    free(save->out_buf);
+    save->regs = regs;
+    save->out_buf = malloc(o->len);
+    if (save->out_buf) {
+      memcpy(save->out_buf, o->data, o->len);
+      save->out_pos = o->len;
+      save->out_cap = o->len;
+      save->resume_ip = ins.operand + 1;
+      save->resume_off = (size_t)(ip - prog->bc);
+      save->valid = true;
+    }
+    NEXT();
+  }
+
+  op_halt: {
+    if (batch && batch->left) {
+      if (o->len >= BATCH_CHUNK && !o->oom && !o->measure) {
+        batch->written += fwrite(o->data, 1, o->len, batch->stream);
+        o->len = 0;
+      }
+
+      // the next row starts where this one left the style, with no pad span open
+      batch_next_row(args);
+      regs.pad_depth = 0;
+      regs.col = 0;
+      if (table) table->span = 0;
+      dynamic = regs.style_depth || regs.current.flags || regs.current.fg || regs.current.bg;
+      ip = prog->bc;
+      DISPATCH();
+    }
+
+    if (prog->slot_count) vars_read_unlock(epoch);
+    if (state) {
+      state->current = regs.current;
+      memcpy(state->style_stack, regs.style_stack, sizeof(state->style_stack));
+      state->style_depth = regs.style_depth;
+    }
+    return vm_out_finish(o);
+  }
+
+  #undef OUT_FITS
+  #undef OUT_STR
+  #undef OUT_TEXT
+  #undef OUT_FILL
+  #undef OUT_CSTR
+  #undef STYLE_SHOWN
+}
+
+static bool vm_run_noargs(crprintf_compiled *prog, vm_output_t *o, ...) {
+  va_list ap; va_start(ap, o);
+  bool ok = crprintf_vm_run(prog, ap, NULL, o);
+  va_end(ap);
+  return ok;
+}
+
+// ap only exists to satisfy the signature; typed runs never read it
+static bool vm_run_typed(crprintf_compiled *prog, vm_args_t *args, crprintf_state *state, vm_output_t *o, ...) {
+  va_list ap; va_start(ap, o);
+  bool ok = crprintf_vm_run_ex(prog, ap, args, state, NULL, o);
+  va_end(ap);
+  return ok;
+}
+
+static inline bool is_set_op(uint32_t op) {
+  return op >= OP_SET_FG && op <= OP_SET_INVERT;
+}
+
+static void delta_add(style_delta_t *d, const instruction_t *ins) {
+  uint8_t bit = 0;
+  switch (ins->op) {
+    case OP_SET_FG:     d->fields |= DELTA_FG; d->fg = ins->operand; return;
+    case OP_SET_BG:     d->fields |= DELTA_BG; d->bg = ins->operand; return;
+    case OP_SET_FG_RGB: d->fields |= DELTA_FG | DELTA_FG_RGB; d->fg = COL_RGB; d->fg_rgb = ins->operand; return;
+    case OP_SET_BG_RGB: d->fields |= DELTA_BG | DELTA_BG_RGB; d->bg = COL_RGB; d->bg_rgb = ins->operand; return;
+    case OP_SET_BOLD:   bit = STYLE_BOLD;   break;
+    case OP_SET_DIM:    bit = STYLE_DIM;    break;
+    case OP_SET_UL:     bit = STYLE_UL;     break;
+    case OP_SET_ITALIC: bit = STYLE_ITALIC; break;
+    case OP_SET_STRIKE: bit = STYLE_STRIKE; break;
+    case OP_SET_INVERT: bit = STYLE_INVERT; break;
+  }
+  if (ins->operand) { d->flags_on |= bit; d->flags_off &= (uint8_t)~bit; }
+  else { d->flags_off |= bit; d->flags_on &= (uint8_t)~bit; }
+}
+
+static uint32_t add_style_record(crprintf_compiled *p, const style_delta_t *d, const char *esc, int n) {
+  return add_record(p, d, sizeof(*d), esc, (size_t)n);
+}
+
+// collapses [PUSH] SET_* FLUSH runs (and bare RESETs) into one STYLE_APPLY whose
+// escape is precomputed by simulating the style registers from a clean start
+static void fold_styles(crprintf_compiled *p) {
+  vm_regs_t sim = {0};
+  size_t w = 0;
+
+  for (size_t i = 0; i < p->code_len;) {
+    // a late-bound value can leave any style behind, so the simulation stops there
+    if (is_var_op(p->code[i].op)) {
+      while (i < p->code_len) p->code[w++] = p->code[i++];
+      break;
+    }
+    
+    style_delta_t d = {0};
+    size_t j = i;
+
+    if (p->code[j].op == OP_STYLE_PUSH) { d.stack = DELTA_PUSH; j++; }
+    while (j < p->code_len && is_set_op(p->code[j].op)) delta_add(&d, &p->code[j++]);
+
+    uint32_t op = p->code[j].op;
+    if (op == OP_STYLE_FLUSH || (op == OP_STYLE_RESET && j == i)) {
+      if (op == OP_STYLE_RESET) d.stack = DELTA_POP | (p->code[j].operand ? DELTA_QUIET : 0);
+      apply_style_delta(&sim, &d);
+      char esc[128];
+      int n = (d.stack & DELTA_QUIET) ? 0 : emit_style_esc(esc, &sim.current);
+      p->code[w++] = (instruction_t){ OP_STYLE_APPLY, add_style_record(p, &d, esc, n) };
+      i = j + 1;
+      continue;
+    }
+
+    instruction_t ins = p->code[i++];
+    if (ins.op == OP_STYLE_RESET_ALL) { sim.current = (style_entry_t){0}; sim.style_depth = 0; }
+    else if (ins.op == OP_STYLE_PUSH) apply_style_delta(&sim, &(style_delta_t){ .stack = DELTA_PUSH });
+    else if (is_set_op(ins.op)) { style_delta_t one = {0}; delta_add(&one, &ins); apply_style_delta(&sim, &one); }
+    p->code[w++] = ins;
+  }
+
+  p->code_len = w;
+}
+
+// with no format specifiers the output only depends on the color switch
+static void fold_constant(crprintf_compiled *p) {
+  for (size_t i = 0; i < p->code_len; i++)
+    if (is_fmt_op(p->code[i].op) || is_var_op(p->code[i].op) || p->code[i].op == OP_SNAPSHOT) return;
+
+  for (int plain = 0; plain < 2; plain++) {
+    vm_output_t o;
+    if (!vm_out_heap(&o, 512)) return;
+    o.no_color = plain;
+    if (!vm_run_noargs(p, &o)) return;
+    p->const_off[plain] = add_literal(p, o.data, o.len);
+    p->const_len[plain] = (uint32_t)o.len;
+    free(o.data);
+  }
+
+  p->is_const = true;
+}
+
+#define F_FG     0x040
+#define F_FG_RGB 0x080
+#define F_BG     0x100
+#define F_BG_RGB 0x200
+#define F_ALL    0x3FF
+
+static uint32_t set_op_fields(uint32_t op) {
+  switch (op) {
+    case OP_SET_FG:     return F_FG;
+    case OP_SET_BG:     return F_BG;
+    case OP_SET_FG_RGB: return F_FG | F_FG_RGB;
+    case OP_SET_BG_RGB: return F_BG | F_BG_RGB;
+    case OP_SET_BOLD:   return STYLE_BOLD;
+    case OP_SET_DIM:    return STYLE_DIM;
+    case OP_SET_UL:     return STYLE_UL;
+    case OP_SET_ITALIC: return STYLE_ITALIC;
+    case OP_SET_STRIKE: return STYLE_STRIKE;
+    case OP_SET_INVERT: return STYLE_INVERT;
+    default:            return 0;
+  }
+}
+
+static inline bool is_escape_op(uint32_t op) {
+  return op == OP_STYLE_FLUSH || op == OP_STYLE_RESET || op == OP_STYLE_RESET_ALL;
+}
+
+// ops that neither read the style registers nor write output
+static inline bool is_style_silent(uint32_t op) {
+  return op == OP_NOP || op == OP_STYLE_PUSH || is_set_op(op);
+}
+
+// an op removed because of a later one ties both to one recompile unit, so
+// crprintf_recompile never keeps the first while re-emitting the second
+static void fuse_src(crprintf_compiled *p, size_t k, size_t m) {
+  if (!p->src_map) return;
+  for (size_t i = k + 1; i <= m; i++)
+    if (p->src_map[i] > p->src_map[k]) p->src_map[i] = p->src_map[k];
+}
+
+// an escape followed by another full escape with no output between is invisible
+static void drop_overwritten_escapes(crprintf_compiled *p) {
+  for (size_t k = 0; k < p->code_len; k++) {
+    if (!is_escape_op(p->code[k].op)) continue;
+    size_t m = k + 1;
+    while (m < p->code_len && is_style_silent(p->code[m].op)) m++;
+    if (m >= p->code_len || !is_escape_op(p->code[m].op)) continue;
+
+    if (p->code[k].op == OP_STYLE_FLUSH) p->code[k] = (instruction_t){ OP_NOP, 0 };
+    else p->code[k].operand = 1;
+    fuse_src(p, k, m);
+  }
+}
+
+// a SET whose fields are all rewritten before a flush, push or halt reads them
+static void drop_dead_sets(crprintf_compiled *p) {
+  uint32_t dead = 0;
+  size_t killer[10] = {0};
+
+  for (size_t k = p->code_len; k-- > 0;) {
+    uint32_t op = p->code[k].op;
+    uint32_t fields = set_op_fields(op);
+
+    if (fields) {
+      if ((dead & fields) == fields) {
+        size_t m = k;
+        for (int f = 0; f < 10; f++) if ((fields >> f & 1) && killer[f] > m) m = killer[f];
+        p->code[k] = (instruction_t){ OP_NOP, 0 };
+        fuse_src(p, k, m);
+        continue;
+      }
+      for (int f = 0; f < 10; f++) if (fields >> f & 1) killer[f] = k;
+      dead |= fields;
+    } else if (op == OP_STYLE_RESET || op == OP_STYLE_RESET_ALL) {
+      for (int f = 0; f < 10; f++) killer[f] = k;
+      dead = F_ALL;
+    } else switch (op) {
+      case OP_NOP: case OP_EMIT_LIT: case OP_EMIT_FMT:
+      case OP_EMIT_INT: case OP_EMIT_UINT: case OP_EMIT_UINT_HEX: case OP_EMIT_CSTR:
+      case OP_PAD_BEGIN: case OP_RPAD_BEGIN: case OP_PAD_END:
+      case OP_EMIT_SPACES: case OP_EMIT_NEWLINES: break;
+      default: dead = 0; break;
+    }
+  }
+}
+
+// removes NOPs and joins EMIT_LITs whose strings sit back to back in the pool
+static void compact_code(crprintf_compiled *p) {
+  size_t w = 0, run_end = 0;
+
+  for (size_t i = 0; i < p->code_len; i++) {
+    instruction_t ins = p->code[i];
+    uint32_t mark = p->lit_marks ? p->lit_marks[i] : 0;
+
+    if (ins.op == OP_NOP) {
+      if (w && p->lit_marks && mark > p->lit_marks[w - 1]) p->lit_marks[w - 1] = mark;
+      continue;
+    }
+
+    if (ins.op == OP_EMIT_LIT) {
+      size_t blen = strlen(p->literals + ins.operand);
+      size_t b_end = ins.operand + blen + 1;
+
+      if (w && p->code[w - 1].op == OP_EMIT_LIT && ins.operand == run_end) {
+        char *a = p->literals + p->code[w - 1].operand;
+        size_t alen = strlen(a);
+        memmove(a + alen, p->literals + ins.operand, blen + 1);
+        memset(a + alen + blen + 1, 0, b_end - (size_t)(a + alen + blen + 1 - p->literals));
+        run_end = b_end;
+        if (p->lit_marks && mark > p->lit_marks[w - 1]) p->lit_marks[w - 1] = mark;
+        continue;
+      }
+      run_end = b_end;
+    }
+
+    p->code[w] = ins;
+    if (p->src_map) { p->src_map[w] = p->src_map[i]; p->lit_marks[w] = mark; }
+    w++;
+  }
+
+  p->code_len = w;
+}
+
+// visible width of the span opened at i, or false when it depends on arguments
+static bool static_span_width(const crprintf_compiled *p, size_t i, size_t *end, size_t *width) {
+  size_t w = 0;
+
+  for (size_t k = i + 1; k < p->code_len; k++) {
+    const instruction_t *ins = &p->code[k];
+    switch (ins->op) {
+      case OP_EMIT_LIT: {
+        const char *s = p->literals + ins->operand;
+        w += visible_len(s, strlen(s));
+        break;
+      }
+      
+      case OP_EMIT_SPACES:
+      case OP_EMIT_NEWLINES: w += ins->operand; break;
+      
+      case OP_PAD_BEGIN:
+      case OP_RPAD_BEGIN: {
+        size_t inner;
+        if (!static_span_width(p, k, &k, &inner)) return false;
+        w += inner > ins->operand ? inner : ins->operand;
+        break;
+      }
+      
+      case OP_PAD_END:
+        *end = k;
+        *width = w;
+        return true;
+      
+      case OP_HALT: case OP_SNAPSHOT: return false;
+      default: if (is_fmt_op(ins->op) || is_var_op(ins->op)) return false; break;
+    }
+  }
+  return false;
+}
+
+// pads around argument-free content become plain EMIT_SPACES, so rpad never shifts bytes
+static void resolve_static_pads(crprintf_compiled *p) {
+  int depth = 0, max_depth = 0;
+  for (size_t i = 0; i < p->code_len; i++) {
+    if (p->code[i].op == OP_PAD_BEGIN || p->code[i].op == OP_RPAD_BEGIN) {
+      if (++depth > max_depth) max_depth = depth;
+    } else if (p->code[i].op == OP_PAD_END && depth > 0) depth--;
+  }
+  if (max_depth > 8) return;
+
+  bool changed = false;
+  for (size_t i = 0; i < p->code_len; i++) {
+    instruction_t *b = &p->code[i];
+    size_t end, width;
+    if (b->op != OP_PAD_BEGIN && b->op != OP_RPAD_BEGIN) continue;
+    if (!static_span_width(p, i, &end, &width)) continue;
+
+    uint32_t gap = width < b->operand ? b->operand - (uint32_t)width : 0;
+    instruction_t *at = (b->op == OP_RPAD_BEGIN) ? b : &p->code[end];
+    instruction_t *other = (b->op == OP_RPAD_BEGIN) ? &p->code[end] : b;
+    
+    *at = gap ? (instruction_t){ OP_EMIT_SPACES, gap } : (instruction_t){ OP_NOP, 0 };
+    *other = (instruction_t){ OP_NOP, 0 };
+    changed = true;
+  }
+
+  if (changed) compact_code(p);
+}
+
+static void peephole(crprintf_compiled *p) {
+  drop_overwritten_escapes(p);
+  drop_dead_sets(p);
+  compact_code(p);
+}
+
+// always ends with the program encoded, since the VM only runs bytecode
+static void optimize_program(crprintf_compiled *p, bool fold) {
+  fold = fold && crprintf_optimize && !p->src_map;
+  
+  if (crprintf_optimize) {
+    if (__builtin_expect(crprintf_debug, 0)) {
+      encode_program(p);
+      fprintf(stderr, "; before optimization\n");
+      crprintf_disasm(p, stderr);
+    }
+    peephole(p);
+    if (fold) {
+      resolve_static_pads(p);
+      fold_styles(p);
+    }
+  }
+  
+  encode_program(p);
+  if (fold) fold_constant(p);
+}
+
+static int const_copy(crprintf_compiled *prog, char *buf, size_t size) {
+  bool plain = crprintf_no_color;
+  size_t len = prog->const_len[plain];
+  if (size) {
+    size_t copy = (len < size) ? len : size - 1;
+    memcpy(buf, prog->literals + prog->const_off[plain], copy);
+    buf[copy] = '\0';
+  }
+  return (int)len;
+}
+
+int crprintf_exec(crprintf_compiled *prog, FILE *stream, ...) {
+  if (prog->is_const) {
+    bool plain = crprintf_no_color;
+    return (int)fwrite(prog->literals + prog->const_off[plain], 1, prog->const_len[plain], stream);
+  }
+  
+  vm_output_t o;
+  if (!vm_out_arena(&o)) return -1;
+  
+  va_list ap; va_start(ap, stream);
+  bool ok = crprintf_vm_run(prog, ap, NULL, &o);
+  va_end(ap);
+
+  int ret = ok ? (int)fwrite(o.data, 1, o.len, stream) : -1;
+  vm_arena_settle(&o, ok);
+  
+  return ret;
+}
+
+int crprintf_exec_args(crprintf_compiled *prog, FILE *stream, const crprintf_arg *args, size_t count) {
+  if (prog->is_const) {
+    bool plain = crprintf_no_color;
+    return (int)fwrite(prog->literals + prog->const_off[plain], 1, prog->const_len[plain], stream);
+  }
+
+  vm_output_t o;
+  if (!vm_out_arena(&o)) return -1;
+
+  vm_args_t typed = { args, count, 0, NULL };
+  bool ok = vm_run_typed(prog, &typed, NULL, &o);
+
+  int ret = ok ? (int)fwrite(o.data, 1, o.len, stream) : -1;
+  vm_arena_settle(&o, ok);
+
+  return ret;
+}
+
+int crsprintf_args(crprintf_compiled *prog, char *buf, size_t size, const crprintf_arg *args, size_t count) {
+  if (prog->is_const) return const_copy(prog, buf, size);
+
+  vm_output_t o;
+  vm_out_direct(&o, buf, size);
+
+  vm_args_t typed = { args, count, 0, NULL };
+  if (!vm_run_typed(prog, &typed, NULL, &o)) return -1;
+
+  return (int)o.len;
+}
+
+// the argument classes prog consumes must be the field types, in order. var
+// ops take none: a value with a conversion was inlined as format ops when
+// prog compiled, and a late binding prints its conversions as text
+static bool batch_fields_match(const crprintf_compiled *prog, const crprintf_record_desc *desc) {
+  size_t next = 0;
+
+  for (const uint8_t *ip = prog->bc, *end = prog->bc + prog->bc_len; ip < end;) {
+    instruction_t ins;
+    ip = bc_decode(ip, &ins);
+    if (!is_fmt_op(ins.op)) continue;
+
+    fmt_desc_t d;
+    memcpy(&d, prog->literals + ins.operand, sizeof(d));
+    uint8_t want[3];
+    int count = 0;
+    if (d.flags & FMT_STAR_W) want[count++] = ARG_INT;
+    if (d.flags & FMT_STAR_P) want[count++] = ARG_INT;
+    if (d.cls != ARG_NONE) want[count++] = d.cls;
+
+    for (int i = 0; i < count; i++, next++)
+      if (next >= desc->count || desc->fields[next].type != want[i]) return false;
+  }
+
+  return next == desc->count;
+}
+
+// the VM runs the program once per record without returning, so style
+// registers carry from row to row as with the stateful functions and the
+// stream sees one write per chunk; a NULL stream only measures table cells
+static int batch_run(
+  crprintf_compiled *prog, FILE *stream, const void *records, size_t n,
+  const crprintf_record_desc *desc, vm_table_t *table, crprintf_arg *row
+) {
+  vm_output_t o;
+  if (!stream) vm_out_measure(&o);
+  else if (!vm_out_arena(&o)) return -1;
+
+  vm_batch_t batch = { row, records, n, desc, stream, 0, table };
+  vm_args_t typed = { row, desc->count, 0, &batch };
+  batch_next_row(&typed);
+  if (table) table->span = 0;
+
+  bool ok = vm_run_typed(prog, &typed, NULL, &o);
+  if (!stream) return ok ? 0 : -1;
+  if (ok) batch.written += fwrite(o.data, 1, o.len, stream);
+
+  vm_arena_settle(&o, ok);
+  return ok ? (int)batch.written : -1;
+}
+
+int crprintf_exec_batch(
+  crprintf_compiled *prog, FILE *stream,
+  const void *records, size_t n, const crprintf_record_desc *desc
+) {
+  if (!batch_fields_match(prog, desc)) return -1;
+
+  if (n == 0) return 0;
+
+  crprintf_arg local[16];
+  crprintf_arg *row = (desc->count <= 16) ? local : malloc(desc->count * sizeof(*row));
+  if (!row) return -1;
+
+  int ret = batch_run(prog, stream, records, n, desc, NULL, row);
+  if (row != local) free(row);
+
+  return ret;
+}
+
+// numbers the outermost spans that hold a conversion; the rest have a fixed width already
+static void table_columns(const crprintf_compiled *prog, vm_table_t *table) {
+  int16_t *cell = NULL;
+  size_t span = 0;
+  int depth = 0;
+
+  for (const uint8_t *ip = prog->bc, *end = prog->bc + prog->bc_len; ip < end;) {
+    instruction_t ins;
+    ip = bc_decode(ip, &ins);
+
+    if (ins.op == OP_PAD_BEGIN || ins.op == OP_RPAD_BEGIN) {
+      if (depth++ > 0) continue;
+      cell = (span < CRPRINTF_TABLE_COLUMNS) ? &table->column_of[span++] : NULL;
+      if (cell) *cell = -1;
+    } else if (ins.op == OP_PAD_END) {
+      if (depth > 0) depth--;
+    } else if (depth > 0 && cell && *cell < 0 && (is_fmt_op(ins.op) || is_var_op(ins.op))) {
+      *cell = (int16_t)table->columns++;
+    }
+  }
+
+  for (; span < CRPRINTF_TABLE_COLUMNS; span++) table->column_of[span] = -1;
+}
+
+// two batches over the same records: the first renders into nothing and keeps
+// only the widest cell of each column, the second pads every cell to it
+int crprintf_exec_table(
+  crprintf_compiled *prog, FILE *stream,
+  const void *records, size_t n, const crprintf_record_desc *desc,
+  crprintf_column *cols, size_t ncols
+) {
+  if (!batch_fields_match(prog, desc)) return -1;
+
+  vm_table_t table = {0};
+  table_columns(prog, &table);
+  for (size_t c = 0; c < ncols; c++) cols[c].width = 0;
+
+  if (n == 0) return 0;
+
+  crprintf_arg local[16];
+  crprintf_arg *row = (desc->count <= 16) ? local : malloc(desc->count * sizeof(*row));
+  if (!row) return -1;
+
+  int ret = batch_run(prog, NULL, records, n, desc, &table, row);
+  if (ret == 0) {
+    for (size_t c = 0; c < table.columns && c < ncols; c++) {
+      if (cols[c].max && table.width[c] > cols[c].max) table.width[c] = cols[c].max;
+      cols[c].width = table.width[c];
+    }
+    ret = batch_run(prog, stream, records, n, desc, &table, row);
+  }
+
+  if (row != local) free(row);
+  return ret;
+}
+
+// one line in the ring is an 8-byte header and its bytes padded to 8. the
+// header stays zero until the producer has copied the bytes in; the writer
+// zeroes all the space it hands back, since a later header can land on old text.
+// a deferred line holds a defer_rec_t, its arguments and copies of its strings
+#define ASYNC_COMMITTED (1ull << 63)
+#define ASYNC_DEFERRED  (1ull << 62)
+#define ASYNC_LEN       0xffffffffull
+#define ASYNC_IOV       256
+#define ASYNC_SPIN      64
+
+// a string argument of a deferred line: v.u is its offset in the record
+#define DEFER_TEXT ((size_t)-2)
+
+typedef struct {
+  crprintf_compiled *prog;
+  uint64_t count;
+} defer_rec_t;
+
+struct crprintf_async {
+  // producers reserve by moving head; tail is only written by the writer
+  _Alignas(64) uint64_t head;
+  _Alignas(64) uint64_t tail;
+  _Alignas(64) size_t dropped;
+
+  uint8_t *ring;
+  size_t cap;
+  crprintf_async_policy policy;
+  int fd;
+  size_t reported;
+  bool failed;
+
+  // the writer's own: deferred lines render into staged, wrapped records are made whole in scratch
+  vm_output_t staged;
+  uint8_t *scratch;
+  size_t scratch_cap;
+
+  // only for sleeping: the writer when the ring is empty, producers and flushes when it is full
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t room;
+  int idle;
+  int waiting;
+  bool closing;
+  pthread_t writer;
+};
+
+static inline uint64_t *async_header(crprintf_async *a, uint64_t pos) {
+  return (uint64_t *)(a->ring + (pos & (a->cap - 1)));
+}
+
+static inline uint64_t async_span(size_t len) {
+  return 8 + (((uint64_t)len + 7) & ~7ull);
+}
+
+static bool async_write_all(crprintf_async *a, struct iovec *iov, int cnt) {
+  while (cnt > 0) {
+    ssize_t n = writev(a->fd, iov, cnt);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    while (cnt > 0 && (size_t)n >= iov->iov_len) { n -= (ssize_t)iov->iov_len; iov++; cnt--; }
+    if (cnt > 0) { iov->iov_base = (char *)iov->iov_base + n; iov->iov_len -= (size_t)n; }
+  }
+  return true;
+}
+
+// runs a deferred line's program on the writer thread, appending to staged
+static bool async_render(crprintf_async *a, size_t at, size_t len) {
+  uint8_t *rec = a->ring + at;
+  if (len > a->cap - at) {
+    if (len > a->scratch_cap) {
+      uint8_t *grown = realloc(a->scratch, len);
+      if (!grown) return false;
+      a->scratch = grown;
+      a->scratch_cap = len;
+    }
+    memcpy(a->scratch, rec, a->cap - at);
+    memcpy(a->scratch + (a->cap - at), a->ring, len - (a->cap - at));
+    rec = a->scratch;
+  }
+
+  defer_rec_t head;
+  memcpy(&head, rec, sizeof(head));
+  crprintf_arg *args = (crprintf_arg *)(rec + sizeof(head));
+  for (size_t i = 0; i < head.count; i++) {
+    if (args[i].len != DEFER_TEXT) continue;
+    args[i].v.s = (const char *)rec + args[i].v.u;
+    args[i].len = CRPRINTF_ARG_VALUE;
+  }
+
+  if (!a->staged.data && !vm_out_heap(&a->staged, 4096)) return false;
+  a->staged.no_color = crprintf_no_color;
+
+  vm_args_t typed = { args, (size_t)head.count, 0, NULL };
+  if (vm_run_typed(head.prog, &typed, NULL, &a->staged)) return true;
+  a->staged = (vm_output_t){0};
+  return false;
+}
+
+// gathers every committed line from tail into one writev, then frees their space
+static bool async_drain(crprintf_async *a) {
+  struct iovec iov[ASYNC_IOV];
+  bool staged[ASYNC_IOV];
+  int cnt = 0;
+  uint64_t pos = a->tail;
+
+  while (cnt + 2 <= ASYNC_IOV) {
+    uint64_t h = __atomic_load_n(async_header(a, pos), __ATOMIC_ACQUIRE);
+    if (!h) break;
+
+    size_t len = (size_t)(h & ASYNC_LEN);
+    size_t at = (size_t)((pos + 8) & (a->cap - 1));
+    pos += async_span(len);
+
+    // staged lines hold an offset until every deferred line in the batch has rendered
+    if (h & ASYNC_DEFERRED) {
+      size_t start = a->staged.len;
+      if (async_render(a, at, len)) {
+        iov[cnt] = (struct iovec){ (void *)(uintptr_t)start, a->staged.len - start };
+        staged[cnt++] = true;
+        continue;
+      }
+      // the lines already staged went with the buffer
+      size_t lost = 1;
+      for (int i = 0; i < cnt; i++) if (staged[i] && iov[i].iov_len) { iov[i].iov_len = 0; lost++; }
+      __atomic_fetch_add(&a->dropped, lost, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    size_t first = (len < a->cap - at) ? len : a->cap - at;
+    staged[cnt] = false;
+    iov[cnt++] = (struct iovec){ a->ring + at, first };
+    if (first < len) { staged[cnt] = false; iov[cnt++] = (struct iovec){ a->ring, len - first }; }
+  }
+  if (pos == a->tail) return false;
+
+  for (int i = 0; i < cnt; i++)
+    if (staged[i]) iov[i].iov_base = iov[i].iov_len ? (void *)(a->staged.data + (uintptr_t)iov[i].iov_base) : (void *)a->ring;
+  if (!a->failed && !async_write_all(a, iov, cnt)) a->failed = true;
+  a->staged.len = 0;
+
+  size_t from = (size_t)(a->tail & (a->cap - 1)), used = (size_t)(pos - a->tail);
+  size_t first = (used < a->cap - from) ? used : a->cap - from;
+  memset(a->ring + from, 0, first);
+  memset(a->ring, 0, used - first);
+  __atomic_store_n(&a->tail, pos, __ATOMIC_SEQ_CST);
+  
+  if (__atomic_load_n(&a->waiting, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&a->lock);
+    pthread_cond_broadcast(&a->room);
+    pthread_mutex_unlock(&a->lock);
+  }
+  return true;
+}
+
+// the note goes in where the writer catches up, after the lines that did fit
+static void async_report_drops(crprintf_async *a) {
+  size_t dropped = __atomic_load_n(&a->dropped, __ATOMIC_RELAXED);
+  if (dropped == a->reported || a->failed) return;
+
+  char note[64];
+  int n = snprintf(note, sizeof(note), "crprintf: %zu lines dropped\n", dropped - a->reported);
+  struct iovec iov = { note, (size_t)n };
+  if (!async_write_all(a, &iov, 1)) a->failed = true;
+  a->reported = dropped;
+}
+
+static void *async_writer(void *arg) {
+  crprintf_async *a = arg;
+
+  for (;;) {
+    for (int spin = 0; spin < ASYNC_SPIN;) {
+      if (async_drain(a)) spin = 0;
+      else { spin++; sched_yield(); }
+    }
+    if (a->policy == CRPRINTF_ASYNC_COUNT) async_report_drops(a);
+
+    // sleep once the ring is empty; a producer that commits after the idle flag is visible wakes us
+    pthread_mutex_lock(&a->lock);
+    __atomic_store_n(&a->idle, 1, __ATOMIC_SEQ_CST);
+    while (!__atomic_load_n(async_header(a, a->tail), __ATOMIC_SEQ_CST) && !a->closing)
+      pthread_cond_wait(&a->wake, &a->lock);
+    __atomic_store_n(&a->idle, 0, __ATOMIC_RELAXED);
+    bool closing = a->closing;
+    pthread_mutex_unlock(&a->lock);
+
+    if (closing && __atomic_load_n(&a->head, __ATOMIC_ACQUIRE) == a->tail) break;
+  }
+
+  return NULL;
+}
+
+crprintf_async *crprintf_async_open(int fd, size_t capacity, crprintf_async_policy policy) {
+  size_t cap = 4096;
+  while (cap < capacity) cap *= 2;
+
+  crprintf_async *a = aligned_alloc(64, (sizeof(*a) + 63) & ~(size_t)63);
+  if (!a) return NULL;
+  *a = (crprintf_async){ .cap = cap, .policy = policy, .fd = fd };
+
+  if (!(a->ring = calloc(1, cap))) { free(a); return NULL; }
+  pthread_mutex_init(&a->lock, NULL);
+  pthread_cond_init(&a->wake, NULL);
+  pthread_cond_init(&a->room, NULL);
+
+  if (pthread_create(&a->writer, NULL, async_writer, a) != 0) {
+    pthread_mutex_destroy(&a->lock);
+    pthread_cond_destroy(&a->wake);
+    pthread_cond_destroy(&a->room);
+    free(a->ring); free(a);
+    return NULL;
+  }
+  return a;
+}
+
+// sleeps until the writer has moved tail to at least pos
+static void async_wait_tail(crprintf_async *a, uint64_t pos) {
+  for (int spin = 0; spin < ASYNC_SPIN; spin++) {
+    if (__atomic_load_n(&a->tail, __ATOMIC_ACQUIRE) >= pos) return;
+    sched_yield();
+  }
+
+  pthread_mutex_lock(&a->lock);
+  __atomic_fetch_add(&a->waiting, 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&a->tail, __ATOMIC_SEQ_CST) < pos)
+    pthread_cond_wait(&a->room, &a->lock);
+  __atomic_fetch_sub(&a->waiting, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&a->lock);
+}
+
+// claims room for len bytes after a header at *pos, or applies the overflow policy
+static bool async_reserve(crprintf_async *a, size_t len, uint64_t *pos) {
+  uint64_t need = async_span(len);
+  if (need > a->cap || len > ASYNC_LEN) { __atomic_fetch_add(&a->dropped, 1, __ATOMIC_RELAXED); return false; }
+
+  uint64_t at = __atomic_load_n(&a->head, __ATOMIC_RELAXED);
+  for (;;) {
+    uint64_t tail = __atomic_load_n(&a->tail, __ATOMIC_ACQUIRE);
+    if (at + need - tail > a->cap) {
+      if (a->policy != CRPRINTF_ASYNC_BLOCK) { __atomic_fetch_add(&a->dropped, 1, __ATOMIC_RELAXED); return false; }
+      async_wait_tail(a, at + need - a->cap);
+      at = __atomic_load_n(&a->head, __ATOMIC_RELAXED);
+      continue;
+    }
+    if (__atomic_compare_exchange_n(&a->head, &at, at + need, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+  }
+
+  *pos = at;
+  return true;
+}
+
+static void async_copy(crprintf_async *a, uint64_t pos, const void *src, size_t n) {
+  size_t at = (size_t)(pos & (a->cap - 1));
+  size_t first = (n < a->cap - at) ? n : a->cap - at;
+  memcpy(a->ring + at, src, first);
+  memcpy(a->ring, (const char *)src + first, n - first);
+}
+
+static void async_commit(crprintf_async *a, uint64_t pos, uint64_t header) {
+  // seq_cst on both sides: either the writer sees this header or we see it idle
+  __atomic_store_n(async_header(a, pos), header | ASYNC_COMMITTED, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&a->idle, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&a->lock);
+    pthread_cond_signal(&a->wake);
+    pthread_mutex_unlock(&a->lock);
+  }
+}
+
+static int async_publish(crprintf_async *a, const char *data, size_t len) {
+  uint64_t pos;
+  if (!async_reserve(a, len, &pos)) return -1;
+  async_copy(a, pos + 8, data, len);
+  async_commit(a, pos, len);
+  return (int)len;
+}
+
+// renders on the calling thread; without a sink the line goes straight to stdout
+static int async_render_now(crprintf_async *a, crprintf_compiled *prog, va_list ap) {
+  if (prog->is_const) {
+    bool plain = crprintf_no_color;
+    const char *text = prog->literals + prog->const_off[plain];
+    return a ? async_publish(a, text, prog->const_len[plain]) : (int)fwrite(text, 1, prog->const_len[plain], stdout);
+  }
+
+  vm_output_t o;
+  if (!vm_out_arena(&o)) return -1;
+
+  bool ok = crprintf_vm_run(prog, ap, NULL, &o);
+  int ret = !ok ? -1 : a ? async_publish(a, o.data, o.len) : (int)fwrite(o.data, 1, o.len, stdout);
+  vm_arena_settle(&o, ok);
+
+  return ret;
+}
+
+int crprintf_async_exec(crprintf_async *sink, crprintf_compiled *prog, ...) {
+  va_list ap; va_start(ap, prog);
+  int ret = async_render_now(sink, prog, ap);
+  va_end(ap);
+  return ret;
+}
+
+// the arguments prog takes, in order, worked out once per program by whichever
+// thread defers it first. %n writes through its pointer and %Lf reads a
+// long double, so programs holding either always render on the caller.
+// var ops take no arguments: a value with a conversion was inlined as
+// format ops when prog compiled, and a late binding prints them as text
+static bool defer_build(crprintf_compiled *prog) {
+  size_t n = 0;
+
+  for (const uint8_t *ip = prog->bc, *end = prog->bc + prog->bc_len; ip < end;) {
+    instruction_t ins;
+    ip = bc_decode(ip, &ins);
+    if (!is_fmt_op(ins.op)) continue;
+
+    fmt_desc_t d;
+    memcpy(&d, prog->literals + ins.operand, sizeof(d));
+    const char *spec = prog->literals + ins.operand + sizeof(d);
+    if (spec[d.len - 1] == 'n' || memchr(spec, 'L', d.len) || n + 3 > DEFER_MAX_ARGS) return false;
+
+    if (d.flags & FMT_STAR_W) prog->defer_args[n++] = (defer_arg_t){ ARG_INT, 0, 0 };
+    if (d.flags & FMT_STAR_P) prog->defer_args[n++] = (defer_arg_t){ ARG_INT, 0, 0 };
+    if (d.cls == ARG_NONE) continue;
+
+    // a string is copied only as far as its precision can reach
+    defer_arg_t arg = { d.cls, 0, 0 };
+    const char *dot = memchr(spec, '.', d.len);
+    if (d.cls == ARG_CSTR || d.cls == ARG_WSTR) {
+      if (d.flags & FMT_STAR_P) arg.limit = DEFER_STAR;
+      else if (d.flags & FMT_PREC) { arg.limit = DEFER_PREC; arg.prec = d.prec; }
+      else if (dot) {
+        unsigned long prec = strtoul(dot + 1, NULL, 10);
+        if (prec <= UINT16_MAX) { arg.limit = DEFER_PREC; arg.prec = (uint16_t)prec; }
+      }
+    }
+    prog->defer_args[n++] = arg;
+  }
+
+  prog->defer_count = (uint8_t)n;
+  return true;
+}
+
+static const defer_arg_t *defer_signature(crprintf_compiled *prog) {
+  uint8_t state = __atomic_load_n(&prog->defer_state, __ATOMIC_ACQUIRE);
+  if (__builtin_expect(state == DEFER_READY, 1)) return prog->defer_args;
+  if (state != DEFER_UNKNOWN) return NULL;
+
+  // a thread that loses the race renders this one line itself
+  if (!__atomic_compare_exchange_n(&prog->defer_state, &state, DEFER_BUILDING, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return NULL;
+  bool ok = defer_build(prog);
+  __atomic_store_n(&prog->defer_state, ok ? DEFER_READY : DEFER_NEVER, __ATOMIC_RELEASE);
+  return ok ? prog->defer_args : NULL;
+}
+
+// reads the raw arguments off ap, measuring each string only as far as its
+// precision reaches; text[i] is the string behind args[i], or NULL
+static void defer_collect(const defer_arg_t *sig, size_t count, va_list ap, crprintf_arg *args, const void **text, size_t *bytes) {
+  for (size_t i = 0; i < count; i++) {
+    args[i].len = CRPRINTF_ARG_VALUE;
+    text[i] = NULL;
+    bytes[i] = 0;
+
+    switch ((arg_class_t)sig[i].cls) {
+      case ARG_INT:    args[i].v.i = va_arg(ap, int); break;
+      case ARG_LONG:   args[i].v.i = va_arg(ap, long); break;
+      case ARG_LLONG:  args[i].v.i = va_arg(ap, long long); break;
+      case ARG_SIZE:   args[i].v.u = va_arg(ap, size_t); break;
+      case ARG_DOUBLE: args[i].v.f = va_arg(ap, double); break;
+      case ARG_PTR:    args[i].v.p = va_arg(ap, void *); break;
+      case ARG_WINT:   args[i].v.i = (long long)va_arg(ap, wint_t); break;
+      case ARG_CSTR:   args[i].v.s = text[i] = va_arg(ap, const char *); break;
+      case ARG_WSTR:   args[i].v.p = text[i] = va_arg(ap, const wchar_t *); break;
+      case ARG_NONE:   break;
+    }
+    if (!text[i]) continue;
+
+    size_t max = SIZE_MAX;
+    if (sig[i].limit == DEFER_PREC) max = sig[i].prec;
+    else if (sig[i].limit == DEFER_STAR && args[i - 1].v.i >= 0) max = (size_t)args[i - 1].v.i;
+
+    if (sig[i].cls == ARG_WSTR) {
+      const wchar_t *w = text[i];
+      size_t n = 0;
+      while (n < max && w[n]) n++;
+      bytes[i] = n * sizeof(wchar_t);
+    } else {
+      const char *stop = (max == SIZE_MAX) ? NULL : memchr(text[i], '\0', max);
+      bytes[i] = (max == SIZE_MAX) ? strlen(text[i]) : stop ? (size_t)(stop - (const char *)text[i]) : max;
+    }
+  }
+}
+
+// copies the raw arguments, and the strings they point at, into one ring
+// record; nothing is formatted here. -1 when the line was dropped
+static int async_defer(crprintf_async *a, crprintf_compiled *prog, const defer_arg_t *sig, va_list ap) {
+  size_t count = prog->defer_count;
+  crprintf_arg args[DEFER_MAX_ARGS];
+  const void *text[DEFER_MAX_ARGS];
+  size_t bytes[DEFER_MAX_ARGS];
+  size_t len = sizeof(defer_rec_t) + count * sizeof(crprintf_arg);
+  defer_collect(sig, count, ap, args, text, bytes);
+
+  // the terminators are already there: the writer zeroes the ring as it frees it
+  for (size_t i = 0; i < count; i++) {
+    if (!text[i]) continue;
+    len = (len + 7) & ~(size_t)7;
+    args[i].v.u = len;
+    args[i].len = DEFER_TEXT;
+    len += bytes[i] + (sig[i].cls == ARG_WSTR ? sizeof(wchar_t) : 1);
+  }
+
+  uint64_t pos;
+  if (!async_reserve(a, len, &pos)) return -1;
+
+  defer_rec_t head = { prog, count };
+  async_copy(a, pos + 8, &head, sizeof(head));
+  async_copy(a, pos + 8 + sizeof(head), args, count * sizeof(crprintf_arg));
+  for (size_t i = 0; i < count; i++)
+    if (text[i]) async_copy(a, pos + 8 + args[i].v.u, text[i], bytes[i]);
+  async_commit(a, pos, len | ASYNC_DEFERRED);
+  return 0;
+}
+
+// waits for every line published before the call, not ones racing with it
+int crprintf_async_flush(crprintf_async *sink) {
+  async_wait_tail(sink, __atomic_load_n(&sink->head, __ATOMIC_ACQUIRE));
+  return sink->failed ? -1 : 0;
+}
+
+int crprintf_async_defer(crprintf_async *sink, crprintf_compiled *prog, ...) {
+  va_list ap; va_start(ap, prog);
+  const defer_arg_t *sig = (sink && !prog->is_const) ? defer_signature(prog) : NULL;
+  int ret = sig ? async_defer(sink, prog, sig, ap) : async_render_now(sink, prog, ap);
+  va_end(ap);
+  return ret;
+}
+
+static crprintf_async *defer_sink;
+static pthread_once_t defer_once = PTHREAD_ONCE_INIT;
+
+// the writer keeps running through exit; this only waits for what was queued
+static void defer_at_exit(void) {
+  crprintf_async_flush(defer_sink);
+}
+
+static void defer_sink_open(void) {
+  fflush(stdout);
+  defer_sink = crprintf_async_open(STDOUT_FILENO, 1 << 20, CRPRINTF_ASYNC_BLOCK);
+  if (defer_sink) atexit(defer_at_exit);
+}
+
+crprintf_async *crprintf_defer_sink(void) {
+  pthread_once(&defer_once, defer_sink_open);
+  return defer_sink;
+}
+
+int crprintf_defer_flush(void) {
+  crprintf_async *sink = crprintf_defer_sink();
+  return sink ? crprintf_async_flush(sink) : fflush(stdout);
+}
+
+size_t crprintf_async_dropped(const crprintf_async *sink) {
+  return __atomic_load_n(&sink->dropped, __ATOMIC_RELAXED);
+}
+
+// drains the ring and joins the writer; no thread may still be printing to sink
+int crprintf_async_close(crprintf_async *sink) {
+  pthread_mutex_lock(&sink->lock);
+  sink->closing = true;
+  pthread_cond_signal(&sink->wake);
+  pthread_mutex_unlock(&sink->lock);
+  pthread_join(sink->writer, NULL);
+
+  int ret = sink->failed ? -1 : 0;
+  pthread_mutex_destroy(&sink->lock);
+  pthread_cond_destroy(&sink->wake);
+  pthread_cond_destroy(&sink->room);
+  free(sink->staged.data);
+  free(sink->scratch);
+  free(sink->ring);
+  free(sink);
+  return ret;
+}
+
+int crsprintf_inner(crprintf_compiled *prog, char *buf, size_t size, ...) {
+  if (prog->is_const) return const_copy(prog, buf, size);
   
-  op_emit_newlines: {
-    size_t n = (size_t)ip->operand;
-    ENSURE(n);
-    memset(out + pos, '\n', n);
-    pos += n;
-    NEXT();
-  }
+  vm_output_t o;
+  vm_out_direct(&o, buf, size);
+  
+  va_list ap; va_start(ap, size);
+  bool ok = crprintf_vm_run(prog, ap, NULL, &o);
+  va_end(ap); if (!ok) return -1;
+  
+  return (int)o.len;
+}
 
-  op_style_reset: {
-    if (regs.style_depth > 0) regs.current = regs.style_stack[--regs.style_depth];
-    else regs.current = (style_entry_t){.fg = COL_NONE, .bg = COL_NONE};
+// shared by every caller that passes the same format text; the table is
+// open-addressed and doubles as the CLOCK ring, so a hit is a probe and a compare
+typedef struct {
+  crprintf_compiled *prog;
+  char *fmt;
+  size_t len;
+  size_t bytes;
+  uint64_t gen;
+  uint32_t hash;
+  bool referenced;
+} cache_entry_t;
+
+static struct {
+  pthread_mutex_t lock;
+  cache_entry_t *slots;
+  size_t mask;
+  size_t count;
+  size_t bytes;
+  size_t hand;
+} prog_cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void program_destroy(crprintf_compiled *prog);
+
+static void cache_release(crprintf_compiled *prog) {
+  if (__atomic_sub_fetch(&prog->refs, 1, __ATOMIC_ACQ_REL) == 0) program_destroy(prog);
+}
 
-    if (!crprintf_no_color) {
-      char esc[128];
-      int n = snprintf(esc, sizeof(esc), "\x1b[0m");
-      if (regs.current.flags & STYLE_BOLD)   n += snprintf(esc+n, sizeof(esc)-n, "\x1b[1m");
-      if (regs.current.flags & STYLE_DIM)    n += snprintf(esc+n, sizeof(esc)-n, "\x1b[2m");
-      if (regs.current.flags & STYLE_UL)     n += snprintf(esc+n, sizeof(esc)-n, "\x1b[4m");
-      if (regs.current.flags & STYLE_ITALIC) n += snprintf(esc+n, sizeof(esc)-n, "\x1b[3m");
-      if (regs.current.flags & STYLE_STRIKE) n += snprintf(esc+n, sizeof(esc)-n, "\x1b[9m");
-      if (regs.current.flags & STYLE_INVERT) n += snprintf(esc+n, sizeof(esc)-n, "\x1b[7m");
-      if (regs.current.fg == COL_RGB)
-        n += snprintf(esc+n, sizeof(esc)-n, "\x1b[38;2;%d;%d;%dm",
-          UNPACK_R(regs.current.fg_rgb), UNPACK_G(regs.current.fg_rgb), UNPACK_B(regs.current.fg_rgb));
-      else if (regs.current.fg)
-        n += snprintf(esc+n, sizeof(esc)-n, "\x1b[%dm", regs.current.fg);
-      if (regs.current.bg == COL_RGB)
-        n += snprintf(esc+n, sizeof(esc)-n, "\x1b[48;2;%d;%d;%dm",
-          UNPACK_R(regs.current.bg_rgb), UNPACK_G(regs.current.bg_rgb), UNPACK_B(regs.current.bg_rgb));
-      else if (regs.current.bg)
-        n += snprintf(esc+n, sizeof(esc)-n, "\x1b[%dm", regs.current.bg + 10);
-      OUT_STR(esc, (size_t)n);
-    }
-    
-    NEXT();
-  }
-  
-  op_style_reset_all: {
-    regs.current = (style_entry_t){.fg = COL_NONE, .bg = COL_NONE};
-    regs.style_depth = 0;
-    if (!crprintf_no_color) { OUT_CSTR("\x1b[0m"); }
-    NEXT();
+static size_t cache_probe(uint32_t hash, const char *fmt, size_t len) {
+  for (size_t i = hash & prog_cache.mask;; i = (i + 1) & prog_cache.mask) {
+    cache_entry_t *e = &prog_cache.slots[i];
+    if (!e->prog) return i;
+    if (e->hash == hash && e->len == len && memcmp(e->fmt, fmt, len) == 0) return i;
   }
+}
 
-  op_style_flush: {
-    if (!crprintf_no_color) {
-      char esc[128];
-      int n = snprintf(esc, sizeof(esc), "\x1b[0m");
-      if (regs.current.flags & STYLE_BOLD)   n += snprintf(esc+n, sizeof(esc)-n, "\x1b[1m");
-      if (regs.current.flags & STYLE_DIM)    n += snprintf(esc+n, sizeof(esc)-n, "\x1b[2m");
-      if (regs.current.flags & STYLE_UL)     n += snprintf(esc+n, sizeof(esc)-n, "\x1b[4m");
-      if (regs.current.flags & STYLE_ITALIC) n += snprintf(esc+n, sizeof(esc)-n, "\x1b[3m");
-      if (regs.current.flags & STYLE_STRIKE) n += snprintf(esc+n, sizeof(esc)-n, "\x1b[9m");
-      if (regs.current.flags & STYLE_INVERT) n += snprintf(esc+n, sizeof(esc)-n, "\x1b[7m");
-      if (regs.current.fg == COL_RGB)
-        n += snprintf(esc+n, sizeof(esc)-n, "\x1b[38;2;%d;%d;%dm",
-          UNPACK_R(regs.current.fg_rgb), UNPACK_G(regs.current.fg_rgb), UNPACK_B(regs.current.fg_rgb));
-      else if (regs.current.fg)
-        n += snprintf(esc+n, sizeof(esc)-n, "\x1b[%dm", regs.current.fg);
-      if (regs.current.bg == COL_RGB)
-        n += snprintf(esc+n, sizeof(esc)-n, "\x1b[48;2;%d;%d;%dm",
-          UNPACK_R(regs.current.bg_rgb), UNPACK_G(regs.current.bg_rgb), UNPACK_B(regs.current.bg_rgb));
-      else if (regs.current.bg)
-        n += snprintf(esc+n, sizeof(esc)-n, "\x1b[%dm", regs.current.bg + 10);
-      OUT_STR(esc, (size_t)n);
-    }
-    NEXT();
-  }
+// backward-shift delete keeps every probe chain unbroken without tombstones
+static void cache_remove(size_t i) {
+  cache_entry_t *e = &prog_cache.slots[i];
+  prog_cache.bytes -= e->bytes;
+  prog_cache.count--;
+  cache_release(e->prog);
+  free(e->fmt);
   
-  op_snapshot: {
-    vm_checkpoint_t *save = &prog->checkpoint;
-    free(save->out_buf);
-    save->regs = regs;
-    save->out_buf = malloc(pos);
-    if (save->out_buf) {
-      memcpy(save->out_buf, out, pos);
-      save->out_pos = pos;
-      save->out_cap = pos;
-      save->resume_ip = (size_t)(ip + 1 - prog->code);
-      save->valid = true;
-    }
-    NEXT();
+  for (size_t j = (i + 1) & prog_cache.mask;; j = (j + 1) & prog_cache.mask) {
+    cache_entry_t *next = &prog_cache.slots[j];
+    if (!next->prog) break;
+    size_t home = next->hash & prog_cache.mask;
+    if (((j - home) & prog_cache.mask) < ((j - i) & prog_cache.mask)) continue;
+    prog_cache.slots[i] = *next;
+    i = j;
   }
+  prog_cache.slots[i] = (cache_entry_t){0};
+}
 
-  op_halt: {
-    if (state) {
-      state->current = regs.current;
-      memcpy(state->style_stack, regs.style_stack, sizeof(state->style_stack));
-      state->style_depth = regs.style_depth;
+// CLOCK: a referenced entry gets one more lap, everything else goes
+static void cache_evict(size_t budget) {
+  while (prog_cache.count && prog_cache.bytes > budget) {
+    size_t i = prog_cache.hand & prog_cache.mask;
+    cache_entry_t *e = &prog_cache.slots[i];
+    if (e->prog && !e->referenced) cache_remove(i);
+    else {
+      if (e->prog) e->referenced = false;
+      prog_cache.hand = i + 1;
     }
-    out[pos] = '\0';
-    return (vm_output_t){ out, pos };
   }
+}
 
-  #undef ENSURE
-  #undef OUT_STR
-  #undef OUT_CSTR
+static void cache_trim(size_t budget) {
+  pthread_mutex_lock(&prog_cache.lock);
+  cache_evict(budget);
+  pthread_mutex_unlock(&prog_cache.lock);
 }
 
-int crprintf_exec(crprintf_compiled *prog, FILE *stream, ...) {
-  va_list ap; va_start(ap, stream);
-  vm_output_t o = crprintf_vm_run(prog, ap, NULL);
-  va_end(ap); if (!o.data) return -1;
+static bool cache_grow(void) {
+  size_t cap = prog_cache.slots ? (prog_cache.mask + 1) * 2 : 64;
+  cache_entry_t *slots = calloc(cap, sizeof(*slots));
+  if (!slots) return false;
+  
+  cache_entry_t *old = prog_cache.slots;
+  size_t old_cap = old ? prog_cache.mask + 1 : 0;
+  prog_cache.slots = slots;
+  prog_cache.mask = cap - 1;
+  
+  for (size_t i = 0; i < old_cap; i++) if (old[i].prog)
+    prog_cache.slots[cache_probe(old[i].hash, old[i].fmt, old[i].len)] = old[i];
+  free(old);
+  return true;
+}
 
-  int ret = (int)fwrite(o.data, 1, o.len, stream);
-  free(o.data);
+static crprintf_compiled *cache_hit(uint32_t hash, const char *fmt, size_t len, uint64_t gen) {
+  if (!prog_cache.slots) return NULL;
+  size_t i = cache_probe(hash, fmt, len);
+  cache_entry_t *e = &prog_cache.slots[i];
+  if (!e->prog) return NULL;
+  if (e->gen != gen) { cache_remove(i); return NULL; }
   
-  return ret;
+  e->referenced = true;
+  __atomic_add_fetch(&e->prog->refs, 1, __ATOMIC_RELAXED);
+  return e->prog;
 }
 
-int crsprintf_inner(crprintf_compiled *prog, char *buf, size_t size, ...) {
-  va_list ap; va_start(ap, size);
-  vm_output_t o = crprintf_vm_run(prog, ap, NULL);
-  va_end(ap); if (!o.data) return -1;
+// compiled outside the lock; if another thread got there first its copy wins
+static crprintf_compiled *cache_insert(crprintf_compiled *prog, uint32_t hash, const char *fmt, size_t len, uint64_t gen) {
+  size_t bytes = crprintf_compiled_size(prog) + len;
+  if (bytes > crprintf_cache_cap) return prog;
+  
+  char *key = malloc(len);
+  if (!key) return prog;
+  memcpy(key, fmt, len);
 
-  size_t copy = (o.len < size) ? o.len : size - 1;
-  memcpy(buf, o.data, copy);
-  buf[copy] = '\0';
-  free(o.data);
+  pthread_mutex_lock(&prog_cache.lock);
+  crprintf_compiled *winner = cache_hit(hash, fmt, len, gen);
+  bool fits = prog_cache.slots && (prog_cache.count + 1) * 4 <= (prog_cache.mask + 1) * 3;
   
-  return (int)o.len;
+  if (winner || !(fits || cache_grow())) {
+    pthread_mutex_unlock(&prog_cache.lock);
+    free(key);
+    if (!winner) return prog;
+    crprintf_compiled_free(prog);
+    return winner;
+  }
+  
+  cache_evict(crprintf_cache_cap - bytes);
+  prog->cached = true;
+  prog->refs = 2;
+  prog_cache.slots[cache_probe(hash, fmt, len)] = (cache_entry_t){
+    .prog = prog, .fmt = key, .len = len, .bytes = bytes, .gen = gen, .hash = hash,
+  };
+  prog_cache.count++;
+  prog_cache.bytes += bytes;
+  pthread_mutex_unlock(&prog_cache.lock);
+  return prog;
 }
 
-int crsprintf_stateful(char *buf, size_t size, crprintf_state *state, const char *fmt, ...) {
-  crprintf_compiled *prog = crprintf_compile(fmt);
+crprintf_compiled *crprintf_cache_lookup(const char *fmt) {
+  size_t len = strlen(fmt);
+  uint32_t hash = var_hash(fmt, len);
+  uint64_t gen = __atomic_load_n(&var_generation, __ATOMIC_ACQUIRE);
+  
+  if (crprintf_cache_cap) {
+    pthread_mutex_lock(&prog_cache.lock);
+    crprintf_compiled *hit = cache_hit(hash, fmt, len, gen);
+    pthread_mutex_unlock(&prog_cache.lock);
+    if (hit) return hit;
+  }
+  
+  crprintf_compiled *prog = compile_program(fmt, false);
   if (__builtin_expect(crprintf_get_debug(), 0)) crprintf_disasm(prog, stderr);
   if (__builtin_expect(crprintf_get_debug_hex(), 0)) crprintf_hexdump(prog, stderr);
+  
+  return cache_insert(prog, hash, fmt, len, gen);
+}
+
+int crsprintf_stateful(char *buf, size_t size, crprintf_state *state, const char *fmt, ...) {
+  crprintf_compiled *prog = crprintf_cache_lookup(fmt);
+  
+  vm_output_t o;
+  vm_out_direct(&o, buf, size);
+  
   va_list ap; va_start(ap, fmt);
-  vm_output_t o = crprintf_vm_run(prog, ap, state);
+  bool ok = crprintf_vm_run(prog, ap, state, &o);
   va_end(ap);
   
-  free(prog->code); free(prog->literals);
-  free(prog->source); free(prog->src_map); free(prog->lit_marks);
-  free(prog);
-  
-  if (!o.data) return -1;
-  size_t copy = (o.len < size) ? o.len : size - 1;
-  memcpy(buf, o.data, copy);
-  buf[copy] = '\0';
-  free(o.data);
+  crprintf_compiled_free(prog);
+  if (!ok) return -1;
   return (int)o.len;
 }
 
 int crfprintf_stateful(FILE *stream, crprintf_state *state, const char *fmt, ...) {
-  crprintf_compiled *prog = crprintf_compile(fmt);
-  if (__builtin_expect(crprintf_get_debug(), 0)) crprintf_disasm(prog, stderr);
-  if (__builtin_expect(crprintf_get_debug_hex(), 0)) crprintf_hexdump(prog, stderr);
+  crprintf_compiled *prog = crprintf_cache_lookup(fmt);
+  
+  vm_output_t o;
+  if (!vm_out_arena(&o)) { crprintf_compiled_free(prog); return -1; }
+  
   va_list ap; va_start(ap, fmt);
-  vm_output_t o = crprintf_vm_run(prog, ap, state);
+  bool ok = crprintf_vm_run(prog, ap, state, &o);
   va_end(ap);
 
-  free(prog->code); free(prog->literals);
-  free(prog->source); free(prog->src_map); free(prog->lit_marks);
-  free(prog);
-
-  if (!o.data) return -1;
-  int ret = (int)fwrite(o.data, 1, o.len, stream);
-  free(o.data);
+  crprintf_compiled_free(prog);
+  int ret = ok ? (int)fwrite(o.data, 1, o.len, stream) : -1;
+  vm_arena_settle(&o, ok);
   return ret;
 }
 
 int crsprintf_compiled(char *buf, size_t size, crprintf_state *state, crprintf_compiled *prog, ...) {
+  if (prog->is_const && !state) return const_copy(prog, buf, size);
+  
+  vm_output_t o;
+  vm_out_direct(&o, buf, size);
+  
   va_list ap; va_start(ap, prog);
   const vm_checkpoint_t *ckpt = prog->checkpoint.valid ? &prog->checkpoint : NULL;
-  vm_output_t o = crprintf_vm_run_ex(prog, ap, state, ckpt);
-  va_end(ap); if (!o.data) return -1;
-
-  size_t copy = (o.len < size) ? o.len : size - 1;
-  memcpy(buf, o.data, copy);
-  buf[copy] = '\0';
-  free(o.data);
+  bool ok = crprintf_vm_run_ex(prog, ap, NULL, state, ckpt, &o);
+  va_end(ap); if (!ok) return -1;
+  
   return (int)o.len;
 }
 
+size_t crprintf_compiled_size(const crprintf_compiled *prog) {
+  size_t bytes = prog->packed_size ? prog->packed_size : sizeof(*prog)
+    + prog->code_cap * sizeof(instruction_t) + prog->bc_len + prog->lit_cap
+    + prog->slot_cap * sizeof(var_slot_t *);
+
+  if (prog->src_map) bytes += prog->map_cap * 2 * sizeof(uint32_t);
+  if (prog->source) bytes += prog->source_len + 1;
+  if (prog->checkpoint.out_buf) bytes += prog->checkpoint.out_cap;
+  return bytes;
+}
+
+// cached programs are shared, so freeing one only drops the caller's reference
 void crprintf_compiled_free(crprintf_compiled *prog) {
-  if (!prog) return;
-  free(prog->code);
-  free(prog->literals);
+  if (!prog || prog->external) return;
+  if (prog->cached) cache_release(prog);
+  else program_destroy(prog);
+}
+
+static void program_destroy(crprintf_compiled *prog) {
+  if (!prog->packed_size) {
+    free(prog->slots);
+    free(prog->code);
+    free(prog->bc);
+    free(prog->literals);
+  }
   free(prog->source);
   free(prog->src_map);
-  free(prog->lit_marks);
   free(prog->checkpoint.out_buf);
   free(prog);
 }
@@ -1391,15 +3837,16 @@ static crprintf_compiled *compile_tracked(const char *fmt) {
   p->source_len = strlen(fmt);
   p->source = malloc(p->source_len + 1);
   memcpy(p->source, fmt, p->source_len + 1);
-  p->map_cap = p->code_cap;
-  p->src_map = malloc(p->map_cap * sizeof(uint32_t));
-  p->lit_marks = malloc(p->map_cap * sizeof(uint32_t));
+  track_alloc(p, p->code_cap);
   p->compile_base = p->source;
 
-  var_scope_t vars = { .base = &global_vars };
+  var_scope_t vars;
+  scope_open(&vars);
   compile_fragment(p, p->source, &vars);
+  scope_close(&vars);
   emit_op(p, OP_HALT, 0);
   p->compile_base = NULL;
+  optimize_program(p, false);
   if (__builtin_expect(crprintf_get_debug(), 0)) crprintf_disasm(p, stderr);
   if (__builtin_expect(crprintf_get_debug_hex(), 0)) crprintf_hexdump(p, stderr);
   return p;
@@ -1449,6 +3896,7 @@ crprintf_compiled *crprintf_recompile(crprintf_compiled *prev, const char *fmt)
 
   prev->code_len = trunc_idx;
   prev->lit_len = (trunc_idx > 0) ? prev->lit_marks[trunc_idx - 1] : 0;
+  prev->defer_state = DEFER_UNKNOWN;
 
   if (prev->checkpoint.valid && prev->checkpoint.resume_ip != trunc_idx + 1) {
     free(prev->checkpoint.out_buf);
@@ -1457,7 +3905,7 @@ crprintf_compiled *crprintf_recompile(crprintf_compiled *prev, const char *fmt)
 
   bool prefix_has_fmt = false;
   for (size_t i = 0; i < trunc_idx; i++) {
-    if (prev->code[i].op == OP_EMIT_FMT) { prefix_has_fmt = true; break; }
+    if (is_fmt_op(prev->code[i].op) || is_var_op(prev->code[i].op)) { prefix_has_fmt = true; break; }
   }
 
   free(prev->source);
@@ -1465,7 +3913,8 @@ crprintf_compiled *crprintf_recompile(crprintf_compiled *prev, const char *fmt)
   prev->source = malloc(new_len + 1);
   memcpy(prev->source, fmt, new_len + 1);
 
-  var_scope_t vars = { .base = &global_vars };
+  var_scope_t vars;
+  scope_open(&vars);
   for (size_t i = 0; i + 5 < diverge; i++) {
     if (fmt[i] == '<' && memcmp(fmt + i + 1, "let ", 4) == 0) {
       const char *body = fmt + i + 5;
@@ -1482,18 +3931,686 @@ crprintf_compiled *crprintf_recompile(crprintf_compiled *prev, const char *fmt)
 
   prev->compile_base = prev->source;
   compile_fragment(prev, prev->source + resume_off, &vars);
+  scope_close(&vars);
   emit_op(prev, OP_HALT, 0);
   prev->compile_base = NULL;
+  optimize_program(prev, false);
   if (__builtin_expect(crprintf_get_debug(), 0)) crprintf_disasm(prev, stderr);
   if (__builtin_expect(crprintf_get_debug_hex(), 0)) crprintf_hexdump(prev, stderr);
 
   return prev;
 }
 
+// serialized image of one program: this header, then bytecode, literal
+// pool and the slot names as NUL-terminated strings; everything is an
+// offset or a length, so an image can be run from wherever it is mapped
+typedef struct {
+  uint32_t code_len;
+  uint32_t bc_len;
+  uint32_t lit_len;
+  uint32_t slot_count;
+  uint32_t const_off[2];
+  uint32_t const_len[2];
+  uint32_t is_const;
+} image_hdr_t;
+
+#define BUNDLE_MAGIC   "CRPB"
+#define BUNDLE_VERSION 1
+#define BUNDLE_ORDER   0x0102
+
+typedef struct {
+  char magic[4];
+  uint16_t version;
+  uint16_t order;
+  uint32_t count;
+  uint32_t reserved;
+} bundle_hdr_t;
+
+// offsets are from the start of the bundle; keys are the format text
+typedef struct {
+  uint32_t key_off;
+  uint32_t key_len;
+  uint32_t image_off;
+  uint32_t image_len;
+} bundle_entry_t;
+
+struct crprintf_bundle {
+  const uint8_t *data;
+  size_t size;
+  bool mapped;
+  uint32_t count;
+  uint32_t mask;
+  uint32_t *lookup;
+  var_slot_t **slots;
+  crprintf_compiled progs[];
+};
+
+size_t crprintf_serialize(const crprintf_compiled *prog, void *buf, size_t size) {
+  if (!prog->bc || prog->src_map) return 0;
+  
+  size_t names = 0;
+  for (uint32_t i = 0; i < prog->slot_count; i++) {
+    if (!prog->slots[i]->name) return 0;
+    names += strlen(prog->slots[i]->name) + 1;
+  }
+  
+  size_t need = sizeof(image_hdr_t) + prog->bc_len + prog->lit_len + names;
+  if (!buf || size < need) return need;
+  
+  image_hdr_t h = {
+    .code_len = (uint32_t)prog->code_len, .bc_len = (uint32_t)prog->bc_len,
+    .lit_len = (uint32_t)prog->lit_len, .slot_count = prog->slot_count,
+    .const_off = { prog->const_off[0], prog->const_off[1] },
+    .const_len = { prog->const_len[0], prog->const_len[1] },
+    .is_const = prog->is_const,
+  };
+  
+  uint8_t *out = buf;
+  memcpy(out, &h, sizeof(h)); out += sizeof(h);
+  memcpy(out, prog->bc, prog->bc_len); out += prog->bc_len;
+  memcpy(out, prog->literals, prog->lit_len); out += prog->lit_len;
+  for (uint32_t i = 0; i < prog->slot_count; i++) {
+    size_t n = strlen(prog->slots[i]->name) + 1;
+    memcpy(out, prog->slots[i]->name, n); out += n;
+  }
+  
+  return need;
+}
+
+static uint8_t *bundle_build(crprintf_compiled *const *progs, const char *const *keys, size_t count, size_t *len) {
+  size_t off = sizeof(bundle_hdr_t) + count * sizeof(bundle_entry_t), total = off;
+  
+  for (size_t i = 0; i < count; i++) {
+    size_t n = crprintf_serialize(progs[i], NULL, 0);
+    if (!n) return NULL;
+    total = ((total + (keys ? strlen(keys[i]) + 1 : 0) + 3) & ~(size_t)3) + n;
+  }
+  if (total > UINT32_MAX) return NULL;
+  
+  uint8_t *buf = calloc(1, total);
+  if (!buf) return NULL;
+  
+  bundle_hdr_t h = { .version = BUNDLE_VERSION, .order = BUNDLE_ORDER, .count = (uint32_t)count };
+  memcpy(h.magic, BUNDLE_MAGIC, 4);
+  memcpy(buf, &h, sizeof(h));
+  
+  for (size_t i = 0; i < count; i++) {
+    bundle_entry_t e = {0};
+    if (keys) {
+      e.key_off = (uint32_t)off;
+      e.key_len = (uint32_t)strlen(keys[i]);
+      memcpy(buf + off, keys[i], e.key_len + 1);
+      off += e.key_len + 1;
+    }
+    off = (off + 3) & ~(size_t)3;
+    e.image_off = (uint32_t)off;
+    e.image_len = (uint32_t)crprintf_serialize(progs[i], buf + off, total - off);
+    off += e.image_len;
+    memcpy(buf + sizeof(h) + i * sizeof(e), &e, sizeof(e));
+  }
+  
+  *len = off;
+  return buf;
+}
+
+int crprintf_bundle_write(FILE *out, crprintf_compiled *const *progs, const char *const *keys, size_t count) {
+  size_t len;
+  uint8_t *buf = bundle_build(progs, keys, count, &len);
+  if (!buf) return -1;
+  
+  int ret = fwrite(buf, 1, len, out) == len ? 0 : -1;
+  free(buf);
+  return ret;
+}
+
+static bool bc_read(const uint8_t **p, const uint8_t *end, uint32_t *v) {
+  uint64_t acc = 0;
+  for (int shift = 0; shift < 35 && *p < end; shift += 7) {
+    uint8_t b = *(*p)++;
+    acc |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) { *v = (uint32_t)acc; return acc <= UINT32_MAX; }
+  }
+  return false;
+}
+
+// a literal at off with exactly len bytes before its terminator
+static bool lit_ok(const crprintf_compiled *p, uint64_t off, uint64_t len) {
+  return off + len < p->lit_len && p->literals[off + len] == '\0' && memchr(p->literals + off, 0, len) == NULL;
+}
+
+// format records must say what recompiling their spec would say
+static bool fmt_ok(const crprintf_compiled *p, uint32_t op, uint32_t off) {
+  fmt_desc_t d, chk;
+  if ((uint64_t)off + sizeof(d) > p->lit_len) return false;
+  memcpy(&d, p->literals + off, sizeof(d));
+  
+  const char *spec = p->literals + off + sizeof(d);
+  if (d.len < 2 || !lit_ok(p, (uint64_t)off + sizeof(d), d.len) || spec[0] != '%') return false;
+  if (fmt_spec_end(spec) != spec + d.len || !strchr("diouxXeEfFgGaAcsp%", spec[d.len - 1])) return false;
+  
+  uint32_t want = native_fmt_op(spec, d.len, &chk);
+  if (want == OP_EMIT_FMT) describe_fmt(spec, d.len, &chk);
+  
+  return want == op && chk.len == d.len && chk.width == d.width &&
+    chk.prec == d.prec && chk.cls == d.cls && chk.flags == d.flags;
+}
+
+// walks the stream the way the VM will: every operand in range, no
+// subprogram returns or checkpoints, and exactly one HALT at the very end
+static bool image_ok(const crprintf_compiled *p) {
+  if (p->lit_len && p->literals[p->lit_len - 1] != '\0') return false;
+  if (p->is_const) for (int i = 0; i < 2; i++)
+    if ((uint64_t)p->const_off[i] + p->const_len[i] > p->lit_len) return false;
+  
+  const uint8_t *ip = p->bc, *end = p->bc + p->bc_len;
+  while (ip < end) {
+    uint8_t raw = *ip++;
+    uint32_t op = raw & ~BC_ARG, arg = 0, len = 0;
+    if (op >= OP_MAX || op == OP_VAR_RET || op == OP_SNAPSHOT) return false;
+    if ((raw & BC_ARG) && !bc_read(&ip, end, &arg)) return false;
+    if (bc_has_len(op) && !bc_read(&ip, end, &len)) return false;
+    
+    switch (op) {
+      case OP_EMIT_LIT:
+        if (!lit_ok(p, arg, len)) return false;
+        break;
+      case OP_STYLE_APPLY:
+        if (!lit_ok(p, (uint64_t)arg + sizeof(style_delta_t), len)) return false;
+        break;
+      case OP_EMIT_VAR: case OP_APPLY_VAR:
+        if (arg >= p->slot_count) return false;
+        break;
+      case OP_PAD_BEGIN: case OP_RPAD_BEGIN:
+        if (arg > INT32_MAX) return false;
+        break;
+      case OP_HALT:
+        return ip == end;
+      default:
+        if (is_fmt_op(op) && !fmt_ok(p, op, arg)) return false;
+        break;
+    }
+  }
+  return false;
+}
+
+// slot names resolve against variables defined now; a bundle that
+// refers to an undefined one fails to load rather than rendering wrong
+static bool image_load(crprintf_compiled *p, const uint8_t *img, size_t len, var_slot_t **slots) {
+  image_hdr_t h;
+  if (len < sizeof(h)) return false;
+  memcpy(&h, img, sizeof(h));
+  
+  uint64_t body = (uint64_t)h.bc_len + h.lit_len;
+  if (body > len - sizeof(h) || h.is_const > 1) return false;
+  
+  *p = (crprintf_compiled){
+    .code_len = h.code_len,
+    .bc = (uint8_t *)img + sizeof(h), .bc_len = h.bc_len,
+    .literals = (char *)img + sizeof(h) + h.bc_len, .lit_len = h.lit_len, .lit_cap = h.lit_len,
+    .slots = slots, .slot_count = h.slot_count, .slot_cap = h.slot_count,
+    .is_const = h.is_const, .external = true,
+    .const_off = { h.const_off[0], h.const_off[1] },
+    .const_len = { h.const_len[0], h.const_len[1] },
+  };
+  
+  const char *name = (const char *)img + sizeof(h) + body, *end = (const char *)img + len;
+  var_scope_t scope;
+  scope_open(&scope);
+  
+  bool ok = true;
+  for (uint32_t i = 0; ok && i < h.slot_count; i++) {
+    const char *nul = memchr(name, 0, (size_t)(end - name));
+    const crprintf_var_t *v = nul ? scope_find(&scope, name, (size_t)(nul - name)) : NULL;
+    if (!v || !v->slot) ok = false;
+    else { slots[i] = v->slot; name = nul + 1; }
+  }
+  
+  scope_close(&scope);
+  return ok && image_ok(p);
+}
+
+crprintf_bundle *crprintf_bundle_load(const void *data, size_t size) {
+  bundle_hdr_t h;
+  if (size < sizeof(h) || size > UINT32_MAX) return NULL;
+  memcpy(&h, data, sizeof(h));
+  if (memcmp(h.magic, BUNDLE_MAGIC, 4) || h.version != BUNDLE_VERSION || h.order != BUNDLE_ORDER) return NULL;
+  if (h.count > (size - sizeof(h)) / sizeof(bundle_entry_t)) return NULL;
+  
+  const uint8_t *base = data;
+  const bundle_entry_t *index = (const bundle_entry_t *)(base + sizeof(h));
+  size_t slot_total = 0;
+  
+  for (uint32_t i = 0; i < h.count; i++) {
+    bundle_entry_t e;
+    memcpy(&e, &index[i], sizeof(e));
+    if ((uint64_t)e.image_off + e.image_len > size || e.image_len < sizeof(image_hdr_t)) return NULL;
+    if (e.key_off && ((uint64_t)e.key_off + e.key_len >= size || base[e.key_off + e.key_len])) return NULL;
+    
+    image_hdr_t ih;
+    memcpy(&ih, base + e.image_off, sizeof(ih));
+    if (ih.slot_count > e.image_len) return NULL;
+    slot_total += ih.slot_count;
+  }
+  
+  uint32_t cap = 16;
+  while (cap < h.count * 2) cap *= 2;
+  
+  crprintf_bundle *b = calloc(1, sizeof(*b) + h.count * sizeof(crprintf_compiled));
+  if (!b) return NULL;
+  b->data = base;
+  b->size = size;
+  b->count = h.count;
+  b->mask = cap - 1;
+  b->lookup = calloc(cap, sizeof(uint32_t));
+  b->slots = calloc(slot_total ? slot_total : 1, sizeof(var_slot_t *));
+  if (!b->lookup || !b->slots) { crprintf_bundle_close(b); return NULL; }
+  
+  var_slot_t **slots = b->slots;
+  for (uint32_t i = 0; i < h.count; i++) {
+    bundle_entry_t e;
+    memcpy(&e, &index[i], sizeof(e));
+    if (!image_load(&b->progs[i], base + e.image_off, e.image_len, slots)) {
+      crprintf_bundle_close(b);
+      return NULL;
+    }
+    slots += b->progs[i].slot_count;
+    
+    if (!e.key_off) continue;
+    uint32_t k = var_hash((const char *)base + e.key_off, e.key_len) & b->mask;
+    while (b->lookup[k]) k = (k + 1) & b->mask;
+    b->lookup[k] = i + 1;
+  }
+  
+  return b;
+}
+
+crprintf_bundle *crprintf_bundle_open(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+  
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return NULL;
+  
+  crprintf_bundle *b = crprintf_bundle_load(map, (size_t)st.st_size);
+  if (!b) { munmap(map, (size_t)st.st_size); return NULL; }
+  b->mapped = true;
+  return b;
+}
+
+void crprintf_bundle_close(crprintf_bundle *b) {
+  if (!b) return;
+  if (b->mapped) munmap((void *)b->data, b->size);
+  free(b->lookup);
+  free(b->slots);
+  free(b);
+}
+
+size_t crprintf_bundle_count(const crprintf_bundle *b) {
+  return b->count;
+}
+
+crprintf_compiled *crprintf_bundle_get(crprintf_bundle *b, size_t i) {
+  return i < b->count ? &b->progs[i] : NULL;
+}
+
+crprintf_compiled *crprintf_bundle_find(crprintf_bundle *b, const char *fmt) {
+  size_t len = strlen(fmt);
+  const bundle_entry_t *index = (const bundle_entry_t *)(b->data + sizeof(bundle_hdr_t));
+  
+  for (uint32_t k = var_hash(fmt, len) & b->mask; b->lookup[k]; k = (k + 1) & b->mask) {
+    bundle_entry_t e;
+    memcpy(&e, &index[b->lookup[k] - 1], sizeof(e));
+    if (e.key_len == len && memcmp(b->data + e.key_off, fmt, len) == 0) return &b->progs[b->lookup[k] - 1];
+  }
+  return NULL;
+}
+
+// bundles linked in by the precompiler, registered from constructors before main
+typedef struct static_bundle {
+  crprintf_bundle *bundle;
+  struct static_bundle *next;
+} static_bundle_t;
+
+static static_bundle_t *static_bundles;
+
+crprintf_bundle *crprintf_register_static(const void *data, size_t size) {
+  static_bundle_t *node = malloc(sizeof(*node));
+  if (!node) return NULL;
+  if (!(node->bundle = crprintf_bundle_load(data, size))) { free(node); return NULL; }
+  
+  node->next = __atomic_load_n(&static_bundles, __ATOMIC_ACQUIRE);
+  while (!__atomic_compare_exchange_n(&static_bundles, &node->next, node, true, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+  return node->bundle;
+}
+
+static crprintf_compiled *static_find(const char *fmt) {
+  for (static_bundle_t *n = __atomic_load_n(&static_bundles, __ATOMIC_ACQUIRE); n; n = n->next) {
+    crprintf_compiled *prog = crprintf_bundle_find(n->bundle, fmt);
+    if (prog) return prog;
+  }
+  return NULL;
+}
+
+// a trace log is a trace_hdr_t, a bundle of the programs it may name, then
+// records: varint program index, varint ns since the previous record, varint
+// payload length, and the arguments packed by class. integers are zigzag
+// varints, doubles 8 raw bytes, and a string is varint length + 1 (0 for
+// NULL) followed by its bytes, or its wchar_ts for %ls
+#define TRACE_MAGIC   "CRPTRACE"
+#define TRACE_VERSION 1
+
+typedef struct {
+  char magic[8];
+  uint16_t version;
+  uint16_t order;
+  uint16_t wchar_size;
+  uint16_t reserved;
+  uint64_t epoch;       // UTC ns when the log was opened
+  uint64_t bundle_len;
+} trace_hdr_t;
+
+// varint program index, time delta and payload length, at most 10 bytes each
+#define TRACE_HEAD 30
+
+struct crprintf_trace {
+  FILE *out;
+  pthread_mutex_t lock;
+  uint64_t last;  // when the last record was written, under lock
+  uint32_t count;
+  crprintf_compiled *progs[];
+};
+
+static inline uint64_t trace_clock(void) {
+  struct timespec t;
+  timespec_get(&t, TIME_UTC);
+  return (uint64_t)t.tv_sec * 1000000000ull + (uint64_t)t.tv_nsec;
+}
+
+static inline uint8_t *trace_put(uint8_t *p, uint64_t v) {
+  while (v >= 0x80) { *p++ = (uint8_t)(v | 0x80); v >>= 7; }
+  *p++ = (uint8_t)v;
+  return p;
+}
+
+static bool trace_get(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+  uint64_t acc = 0;
+  for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+    uint8_t b = *(*p)++;
+    acc |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) { *v = acc; return true; }
+  }
+  return false;
+}
+
+static inline uint64_t zigzag(long long v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static inline long long unzigzag(uint64_t v) { return (long long)(v >> 1) ^ -(long long)(v & 1); }
+
+// every program is checked here, so writing a record never has to fail on one
+crprintf_trace *crprintf_trace_open(FILE *out, crprintf_compiled *const *progs, size_t count) {
+  if (count > UINT32_MAX) return NULL;
+  for (size_t i = 0; i < count; i++) {
+    const defer_arg_t *sig;
+    while (!(sig = defer_signature(progs[i])) && __atomic_load_n(&progs[i]->defer_state, __ATOMIC_ACQUIRE) == DEFER_BUILDING)
+      sched_yield();
+    if (!sig || progs[i]->slot_count || !crprintf_serialize(progs[i], NULL, 0)) return NULL;
+  }
+
+  size_t bundle_len;
+  uint8_t *bundle = bundle_build(progs, NULL, count, &bundle_len);
+  if (!bundle) return NULL;
+
+  crprintf_trace *log = malloc(sizeof(*log) + count * sizeof(crprintf_compiled *));
+  if (!log) { free(bundle); return NULL; }
+  log->out = out;
+  log->count = (uint32_t)count;
+  log->last = trace_clock();
+  memcpy(log->progs, progs, count * sizeof(crprintf_compiled *));
+
+  trace_hdr_t h = {
+    .version = TRACE_VERSION, .order = BUNDLE_ORDER, .wchar_size = sizeof(wchar_t),
+    .epoch = log->last, .bundle_len = bundle_len,
+  };
+  memcpy(h.magic, TRACE_MAGIC, 8);
+
+  bool ok = fwrite(&h, sizeof(h), 1, out) == 1 && fwrite(bundle, 1, bundle_len, out) == bundle_len;
+  free(bundle);
+  if (!ok) { free(log); return NULL; }
+  pthread_mutex_init(&log->lock, NULL);
+  return log;
+}
+
+int crprintf_trace_write(crprintf_trace *log, uint32_t id, ...) {
+  if (id >= log->count) return -1;
+  crprintf_compiled *prog = log->progs[id];
+  size_t count = prog->defer_count;
+
+  crprintf_arg args[DEFER_MAX_ARGS];
+  const void *text[DEFER_MAX_ARGS];
+  size_t bytes[DEFER_MAX_ARGS];
+  va_list ap; va_start(ap, id);
+  defer_collect(prog->defer_args, count, ap, args, text, bytes);
+  va_end(ap);
+
+  size_t need = TRACE_HEAD + count * 10;
+  for (size_t i = 0; i < count; i++) need += bytes[i];
+
+  // the payload is packed first, leaving room to put the record head in front of it
+  uint8_t local[512];
+  uint8_t *buf = (need <= sizeof(local)) ? local : malloc(need);
+  if (!buf) return -1;
+  uint8_t *p = buf + TRACE_HEAD;
+
+  for (size_t i = 0; i < count; i++) {
+    switch ((arg_class_t)prog->defer_args[i].cls) {
+      case ARG_INT:
+      case ARG_LONG:
+      case ARG_LLONG:
+      case ARG_WINT:   p = trace_put(p, zigzag(args[i].v.i)); break;
+      case ARG_SIZE:   p = trace_put(p, args[i].v.u); break;
+      case ARG_PTR:    p = trace_put(p, (uintptr_t)args[i].v.p); break;
+      case ARG_DOUBLE: memcpy(p, &args[i].v.f, 8); p += 8; break;
+      case ARG_NONE:   break;
+
+      case ARG_CSTR:
+      case ARG_WSTR: {
+        size_t unit = (prog->defer_args[i].cls == ARG_WSTR) ? sizeof(wchar_t) : 1;
+        p = trace_put(p, text[i] ? bytes[i] / unit + 1 : 0);
+        if (text[i]) { memcpy(p, text[i], bytes[i]); p += bytes[i]; }
+        break;
+      }
+    }
+  }
+  size_t payload = (size_t)(p - (buf + TRACE_HEAD));
+
+  // the clock is read under the lock, so records are in time order and a
+  // clock stepped backwards shows as a zero delta
+  pthread_mutex_lock(&log->lock);
+  uint64_t now = trace_clock();
+  uint8_t head[TRACE_HEAD];
+  uint8_t *h = trace_put(head, id);
+  h = trace_put(h, now > log->last ? now - log->last : 0);
+  h = trace_put(h, payload);
+  if (now > log->last) log->last = now;
+
+  size_t head_len = (size_t)(h - head);
+  memcpy(buf + TRACE_HEAD - head_len, head, head_len);
+  size_t len = head_len + payload;
+  int ret = fwrite(buf + TRACE_HEAD - head_len, 1, len, log->out) == len ? (int)len : -1;
+  pthread_mutex_unlock(&log->lock);
+
+  if (buf != local) free(buf);
+  return ret;
+}
+
+int crprintf_trace_close(crprintf_trace *log) {
+  int ret = fflush(log->out) == 0 && !ferror(log->out) ? 0 : -1;
+  pthread_mutex_destroy(&log->lock);
+  free(log);
+  return ret;
+}
+
+// unpacks one record's arguments; strings are copied into text with their terminators
+static bool trace_unpack(
+  const crprintf_compiled *prog, const uint8_t *p, const uint8_t *end,
+  crprintf_arg *args, uint8_t *text
+) {
+  size_t at = 0;
+
+  for (size_t i = 0; i < prog->defer_count; i++) {
+    uint64_t v = 0;
+    arg_class_t cls = (arg_class_t)prog->defer_args[i].cls;
+    args[i].len = CRPRINTF_ARG_VALUE;
+    if (cls == ARG_DOUBLE) {
+      if (end - p < 8) return false;
+      memcpy(&args[i].v.f, p, 8);
+      p += 8;
+      continue;
+    }
+    if (cls != ARG_NONE && !trace_get(&p, end, &v)) return false;
+
+    switch (cls) {
+      case ARG_INT:
+      case ARG_LONG:
+      case ARG_LLONG:
+      case ARG_WINT:   args[i].v.i = unzigzag(v); break;
+      case ARG_SIZE:   args[i].v.u = v; break;
+      case ARG_PTR:    args[i].v.p = (const void *)(uintptr_t)v; break;
+      case ARG_DOUBLE:
+      case ARG_NONE:   break;
+
+      case ARG_CSTR:
+      case ARG_WSTR: {
+        size_t unit = (cls == ARG_WSTR) ? sizeof(wchar_t) : 1;
+        if (!v) { args[i].v.p = NULL; break; }
+        if (v - 1 > (uint64_t)(end - p) / unit) return false;
+
+        size_t n = (size_t)(v - 1) * unit;
+        at = (at + sizeof(wchar_t) - 1) & ~(sizeof(wchar_t) - 1);
+        memcpy(text + at, p, n);
+        memset(text + at + n, 0, unit);
+        args[i].v.p = text + at;
+        at += n + unit;
+        p += n;
+        break;
+      }
+    }
+  }
+
+  return p == end;
+}
+
+// UTC, without gmtime's shared buffer: days to a civil date as in Howard Hinnant's algorithm
+static void trace_stamp(FILE *out, uint64_t ns) {
+  uint64_t secs = ns / 1000000000ull;
+  long long z = (long long)(secs / 86400) + 719468;
+  long long era = z / 146097, doe = z - era * 146097;
+  long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100), mp = (5 * doy + 2) / 153;
+  unsigned day = (unsigned)(doy - (153 * mp + 2) / 5 + 1), month = (unsigned)(mp < 10 ? mp + 3 : mp - 9);
+  long long year = yoe + era * 400 + (month <= 2);
+
+  unsigned sod = (unsigned)(secs % 86400);
+  fprintf(out, "%04lld-%02u-%02u %02u:%02u:%02u.%06u ", year, month, day,
+    sod / 3600, sod / 60 % 60, sod % 60, (unsigned)(ns % 1000000000ull / 1000));
+}
+
+int crprintf_trace_decode(const void *data, size_t size, FILE *out, bool timestamps) {
+  trace_hdr_t h;
+  if (size < sizeof(h)) return -1;
+  memcpy(&h, data, sizeof(h));
+  if (memcmp(h.magic, TRACE_MAGIC, 8) || h.version != TRACE_VERSION || h.order != BUNDLE_ORDER) return -1;
+  if (h.wchar_size != sizeof(wchar_t) || h.bundle_len > size - sizeof(h)) return -1;
+
+  const uint8_t *base = data;
+  crprintf_bundle *b = crprintf_bundle_load(base + sizeof(h), (size_t)h.bundle_len);
+  if (!b) return -1;
+
+  // the largest record bounds the strings any one of them carries
+  size_t text_cap = 0;
+  uint8_t *text = NULL;
+  uint64_t clock = h.epoch;
+  int records = 0;
+
+  // any break leaves done unset: a torn or corrupt record ends the replay
+  const uint8_t *p = base + sizeof(h) + h.bundle_len, *end = base + size;
+  bool done = false;
+  for (;;) {
+    if (p == end) { done = true; break; }
+    uint64_t id, delta, len;
+    if (!trace_get(&p, end, &id) || !trace_get(&p, end, &delta) || !trace_get(&p, end, &len)) break;
+    if (id >= b->count || len > (uint64_t)(end - p)) break;
+
+    crprintf_compiled *prog = &b->progs[id];
+    const defer_arg_t *sig = defer_signature(prog);
+    size_t need = (size_t)len + prog->defer_count * 2 * sizeof(wchar_t);
+    if (need > text_cap) {
+      uint8_t *grown = realloc(text, need);
+      if (!grown) break;
+      text = grown;
+      text_cap = need;
+    }
+
+    crprintf_arg args[DEFER_MAX_ARGS];
+    if (!sig || !trace_unpack(prog, p, p + len, args, text)) break;
+    p += len;
+    clock += delta;
+
+    if (timestamps) trace_stamp(out, clock);
+    if (crprintf_exec_args(prog, out, args, prog->defer_count) < 0) break;
+    records++;
+  }
+
+  free(text);
+  crprintf_bundle_close(b);
+  return done ? records : -1;
+}
+
+_Static_assert(sizeof(crprintf_compiled) <= CRPRINTF_BIND_STORAGE, "CRPRINTF_BIND_STORAGE is too small");
+
+static pthread_mutex_t bind_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// images compiled into the binary by crprintf.hpp: the program and its slot
+// table are built in the caller's storage, so binding never allocates. an
+// image that doesn't load, usually because a variable it names isn't
+// defined yet, falls back to compiling fmt like any other call site
+crprintf_compiled *crprintf_bind_image(
+  crprintf_compiled **slot, void *storage, size_t storage_size,
+  const void *image, size_t len, const char *fmt
+) {
+  pthread_mutex_lock(&bind_lock);
+  crprintf_compiled *prog = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+  
+  if (!prog) {
+    image_hdr_t h = {0};
+    if (len >= sizeof(h)) memcpy(&h, image, sizeof(h));
+    
+    crprintf_compiled *p = storage;
+    bool fits = len >= sizeof(h) && storage_size >= sizeof(*p) &&
+      h.slot_count <= (storage_size - sizeof(*p)) / sizeof(var_slot_t *);
+    
+    prog = (fits && image_load(p, image, len, (var_slot_t **)(p + 1))) ? p : crprintf_compile(fmt);
+    __atomic_store_n(slot, prog, __ATOMIC_RELEASE);
+    
+    if (__builtin_expect(crprintf_get_debug(), 0)) crprintf_disasm(prog, stderr);
+    if (__builtin_expect(crprintf_get_debug_hex(), 0)) crprintf_hexdump(prog, stderr);
+  }
+  
+  pthread_mutex_unlock(&bind_lock);
+  return prog;
+}
+
 static const char *op_names[OP_MAX] = {
   [OP_NOP]             = "NOP",
   [OP_EMIT_LIT]        = "EMIT_LIT",
   [OP_EMIT_FMT]        = "EMIT_FMT",
+  [OP_EMIT_INT]        = "EMIT_INT",
+  [OP_EMIT_UINT]       = "EMIT_UINT",
+  [OP_EMIT_UINT_HEX]   = "EMIT_UINT_HEX",
+  [OP_EMIT_CSTR]       = "EMIT_CSTR",
   [OP_SET_FG]          = "SET_FG",
   [OP_SET_BG]          = "SET_BG",
   [OP_SET_FG_RGB]      = "SET_FG_RGB",
@@ -1514,6 +4631,10 @@ static const char *op_names[OP_MAX] = {
   [OP_EMIT_SPACES]     = "EMIT_SPACES",
   [OP_EMIT_NEWLINES]   = "EMIT_NEWLINES",
   [OP_SNAPSHOT]        = "SNAPSHOT",
+  [OP_STYLE_APPLY]     = "STYLE_APPLY",
+  [OP_EMIT_VAR]        = "EMIT_VAR",
+  [OP_APPLY_VAR]       = "APPLY_VAR",
+  [OP_VAR_RET]         = "VAR_RET",
   [OP_HALT]            = "HALT",
 };
 
@@ -1579,12 +4700,15 @@ static void fprint_operand(FILE *out, crprintf_compiled *prog, instruction_t *in
       break;
     }
 
-    case OP_EMIT_FMT: {
-      uint32_t    lit_off = ins->operand & 0x0FFFFFFF;
-      arg_class_t cls     = (arg_class_t)(ins->operand >> 28);
-      const char *s = prog->literals + lit_off;
-      fprint_quoted(out, s, compact ? 24 : -1);
-      fprintf(out, " (%s)", arg_class_name(cls));
+    case OP_EMIT_FMT:
+    case OP_EMIT_INT:
+    case OP_EMIT_UINT:
+    case OP_EMIT_UINT_HEX:
+    case OP_EMIT_CSTR: {
+      fmt_desc_t d;
+      memcpy(&d, prog->literals + ins->operand, sizeof(d));
+      fprint_quoted(out, prog->literals + ins->operand + sizeof(d), compact ? 24 : -1);
+      fprintf(out, " (%s)", arg_class_name((arg_class_t)d.cls));
       break;
     }
 
@@ -1622,12 +4746,31 @@ static void fprint_operand(FILE *out, crprintf_compiled *prog, instruction_t *in
       fprintf(out, "%u", ins->operand);
       break;
 
+    case OP_STYLE_APPLY: {
+      style_delta_t d;
+      memcpy(&d, prog->literals + ins->operand, sizeof(d));
+      if (d.stack & DELTA_PUSH)  fprintf(out, "push ");
+      if (d.stack & DELTA_POP)   fprintf(out, "pop ");
+      if (d.stack & DELTA_QUIET) fprintf(out, "quiet ");
+      fprint_quoted(out, prog->literals + ins->operand + sizeof(d), compact ? 24 : -1);
+      break;
+    }
+
+    case OP_STYLE_RESET:
+    case OP_STYLE_RESET_ALL:
+      if (ins->operand) fprintf(out, "quiet");
+      break;
+
+    case OP_EMIT_VAR:
+    case OP_APPLY_VAR:
+      if (ins->operand < prog->slot_count) fprintf(out, "$%s", prog->slots[ins->operand]->name ? prog->slots[ins->operand]->name : "?");
+      break;
+
     case OP_NOP:
     case OP_STYLE_PUSH:
     case OP_STYLE_FLUSH:
-    case OP_STYLE_RESET:
-    case OP_STYLE_RESET_ALL:
     case OP_PAD_END:
+    case OP_VAR_RET:
     case OP_SNAPSHOT:
     case OP_HALT: break;
 
@@ -1640,35 +4783,42 @@ static void fprint_operand(FILE *out, crprintf_compiled *prog, instruction_t *in
 }
 
 void crprintf_disasm(crprintf_compiled *prog, FILE *out) {
-  fprintf(out, "; crprintf bytecode — %zu instructions, %zu bytes literal pool\n", prog->code_len, prog->lit_len);
+  fprintf(out, "; crprintf bytecode — %zu instructions, %zu bytes code, %zu bytes literal pool\n", prog->code_len, prog->bc_len, prog->lit_len);
+  if (prog->is_const) fprintf(out, "; constant output — %u bytes (%u without color)\n", prog->const_len[0], prog->const_len[1]);
   fprintf(out, "; %-4s  %-16s %s\n", "addr", "opcode", "operand");
   fprintf(out, "; ----  ---------------- -------\n");
 
-  for (size_t i = 0; i < prog->code_len; i++) {
-    instruction_t *ins = &prog->code[i];
-    const char *name = (ins->op < OP_MAX) ? op_names[ins->op] : "???";
+  for (const uint8_t *ip = prog->bc, *end = prog->bc + prog->bc_len; ip < end;) {
+    instruction_t ins;
+    size_t addr = (size_t)(ip - prog->bc);
+    ip = bc_decode(ip, &ins);
+    const char *name = (ins.op < OP_MAX) ? op_names[ins.op] : "???";
 
-    fprintf(out, "  %04zu  %-16s ", i, name);
-    fprint_operand(out, prog, ins, false);
+    fprintf(out, "  %04zu  %-16s ", addr, name);
+    fprint_operand(out, prog, &ins, false);
     fputc('\n', out);
   }
 }
 
 void crprintf_hexdump(crprintf_compiled *prog, FILE *out) {
-  fprintf(out, "; crprintf hex dump — %zu instructions, %zu bytes literal pool\n", prog->code_len, prog->lit_len);
+  fprintf(out, "; crprintf hex dump — %zu instructions, %zu bytes code, %zu bytes literal pool\n", prog->code_len, prog->bc_len, prog->lit_len);
   fprintf(out, "; %-4s  %-26s %s\n", "addr", "bytes", "decoded");
   fprintf(out, "; ----  -------------------------  --------\n");
 
-  for (size_t i = 0; i < prog->code_len; i++) {
-    instruction_t *ins = &prog->code[i];
-    const uint8_t *raw = (const uint8_t *)ins;
-    const char *name = (ins->op < OP_MAX) ? op_names[ins->op] : "???";
+  for (const uint8_t *ip = prog->bc, *end = prog->bc + prog->bc_len; ip < end;) {
+    instruction_t ins;
+    const uint8_t *raw = ip;
+    ip = bc_decode(ip, &ins);
+    const char *name = (ins.op < OP_MAX) ? op_names[ins.op] : "???";
 
-    fprintf(out, "  %04zu  ", i);
-    for (size_t b = 0; b < sizeof(instruction_t); b++) fprintf(out, "%02x ", raw[b]);
+    fprintf(out, "  %04zx  ", (size_t)(raw - prog->bc));
+    for (size_t b = 0; b < 8 || raw + b < ip; b++) {
+      if (raw + b < ip) fprintf(out, "%02x ", raw[b]);
+      else fprintf(out, "   ");
+    }
 
     fprintf(out, " ; %s ", name);
-    fprint_operand(out, prog, ins, true);
+    fprint_operand(out, prog, &ins, true);
     fputc('\n', out);
   }
 
@@ -57,10 +57,16 @@
 
 #include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef struct crprintf_state crprintf_state;
 typedef struct crprintf_compiled crprintf_compiled;
+typedef struct crprintf_bundle crprintf_bundle;
 
 void crprintf_set_color(bool enable);
 bool crprintf_get_color(void);
@@ -71,10 +77,24 @@ bool crprintf_get_debug(void);
 void crprintf_set_debug_hex(bool enable);
 bool crprintf_get_debug_hex(void);
 
+void crprintf_set_optimize(bool enable);
+bool crprintf_get_optimize(void);
+
+void crprintf_set_arena_cap(size_t bytes);
+size_t crprintf_get_arena_cap(void);
+
+void crprintf_set_cache_cap(size_t bytes);
+size_t crprintf_get_cache_cap(void);
+
 crprintf_compiled *crprintf_compile(const char *fmt);
+crprintf_compiled *crprintf_compile_once(crprintf_compiled **slot, const char *fmt);
+crprintf_compiled *crprintf_cache_lookup(const char *fmt);
 int crprintf_exec(struct crprintf_compiled *prog, FILE *stream, ...);
 int crsprintf_inner(struct crprintf_compiled *prog, char *buf, size_t size, ...);
 
+// compiled programs follow later values, except that a value holding a
+// conversion is inlined where it is used, since it takes arguments; a
+// conversion that appears in a value a program follows prints as text
 void crprintf_var(const char *name, const char *value);
 void crprintf_hexdump(struct crprintf_compiled *prog, FILE *out);
 void crprintf_disasm(struct crprintf_compiled *prog, FILE *out);
@@ -91,30 +111,174 @@ int crfprintf_stateful(FILE *stream, crprintf_state *state, const char *fmt, ...
 crprintf_compiled *crprintf_recompile(crprintf_compiled *prev, const char *fmt);
 int crsprintf_compiled(char *buf, size_t size, crprintf_state *state, crprintf_compiled *prog, ...);
 void crprintf_compiled_free(crprintf_compiled *prog);
+size_t crprintf_compiled_size(const crprintf_compiled *prog);
+
+size_t crprintf_serialize(const crprintf_compiled *prog, void *buf, size_t size);
+int crprintf_bundle_write(FILE *out, crprintf_compiled *const *progs, const char *const *keys, size_t count);
+
+crprintf_bundle *crprintf_bundle_load(const void *data, size_t size);
+crprintf_bundle *crprintf_bundle_open(const char *path);
+void crprintf_bundle_close(crprintf_bundle *bundle);
+
+size_t crprintf_bundle_count(const crprintf_bundle *bundle);
+crprintf_compiled *crprintf_bundle_get(crprintf_bundle *bundle, size_t index);
+crprintf_compiled *crprintf_bundle_find(crprintf_bundle *bundle, const char *fmt);
+crprintf_bundle *crprintf_register_static(const void *data, size_t size);
+
+// room crprintf_bind_image needs for the program itself; every slot adds a pointer
+#define CRPRINTF_BIND_STORAGE 768
+
+crprintf_compiled *crprintf_bind_image(
+  crprintf_compiled **slot, void *storage, size_t storage_size,
+  const void *image, size_t len, const char *fmt
+);
+
+// one argument for the typed entry points, taken in the order the format
+// consumes them ('*' widths first). len is CRPRINTF_ARG_VALUE unless s holds
+// text: the bytes of a plain %s, or the finished conversion of any other spec
+typedef struct crprintf_arg {
+  union {
+    long long i;
+    unsigned long long u;
+    double f;
+    const char *s;
+    const void *p;
+  } v;
+  size_t len;
+} crprintf_arg;
+
+#define CRPRINTF_ARG_VALUE ((size_t)-1)
+
+int crprintf_exec_args(crprintf_compiled *prog, FILE *stream, const crprintf_arg *args, size_t count);
+int crsprintf_args(crprintf_compiled *prog, char *buf, size_t size, const crprintf_arg *args, size_t count);
+
+// field types for crprintf_exec_batch, one per argument a conversion takes
+// ('*' widths are CRPRINTF_INT); %d is CRPRINTF_INT, %ld CRPRINTF_LONG,
+// %lld and %jd CRPRINTF_LLONG, %zu CRPRINTF_SIZE, %f CRPRINTF_DOUBLE,
+// %s CRPRINTF_CSTR, %p CRPRINTF_PTR, %lc CRPRINTF_WINT and %ls CRPRINTF_WSTR
+typedef enum {
+  CRPRINTF_INT = 1,
+  CRPRINTF_LONG,
+  CRPRINTF_LLONG,
+  CRPRINTF_SIZE,
+  CRPRINTF_DOUBLE,
+  CRPRINTF_CSTR,
+  CRPRINTF_PTR,
+  CRPRINTF_WINT,
+  CRPRINTF_WSTR,
+} crprintf_type;
+
+typedef struct crprintf_field {
+  size_t offset;
+  crprintf_type type;
+} crprintf_field;
+
+// stride is the distance between records, usually sizeof the row struct
+typedef struct crprintf_record_desc {
+  size_t stride;
+  size_t count;
+  const crprintf_field *fields;
+} crprintf_record_desc;
+
+#define CRPRINTF_FIELD(record, member, type) { offsetof(record, member), type }
+
+int crprintf_exec_batch(
+  crprintf_compiled *prog, FILE *stream,
+  const void *records, size_t n, const crprintf_record_desc *desc
+);
+
+// a column of crprintf_exec_table is an outermost <pad>/<rpad> span that
+// holds a conversion, counted from the left; its N is the least width.
+// max caps the column (0 for none) and width receives what it was laid out at
+typedef struct crprintf_column {
+  size_t max;
+  size_t width;
+} crprintf_column;
 
-#define _CRPRINTF_INIT(prog, fmt) \
-  if (!prog) { \
-    prog = crprintf_compile(fmt); \
-    if (crprintf_get_debug()) crprintf_disasm(prog, stderr); \
-    if (crprintf_get_debug_hex()) crprintf_hexdump(prog, stderr); \
-  }
+#define CRPRINTF_TABLE_COLUMNS 32
+
+int crprintf_exec_table(
+  crprintf_compiled *prog, FILE *stream,
+  const void *records, size_t n, const crprintf_record_desc *desc,
+  crprintf_column *cols, size_t ncols
+);
+
+// an opt-in sink for many printing threads: each line is rendered on the
+// calling thread and handed to one writer thread through a lock-free ring,
+// which drains it into fd with large writes. policy is what a line does
+// when the ring is full; COUNT drops it and the writer notes how many it lost
+typedef struct crprintf_async crprintf_async;
+
+typedef enum {
+  CRPRINTF_ASYNC_BLOCK,
+  CRPRINTF_ASYNC_DROP,
+  CRPRINTF_ASYNC_COUNT,
+} crprintf_async_policy;
+
+crprintf_async *crprintf_async_open(int fd, size_t capacity, crprintf_async_policy policy);
+int crprintf_async_exec(crprintf_async *sink, crprintf_compiled *prog, ...);
+int crprintf_async_flush(crprintf_async *sink);
+size_t crprintf_async_dropped(const crprintf_async *sink);
+int crprintf_async_close(crprintf_async *sink);
+
+// queues prog and a copy of its arguments, strings included, and leaves the
+// formatting to the writer thread: 0 once queued, -1 if dropped. {variables}
+// render with the value they have when the line is written, and prog must
+// outlive the line. a program with %n, %Lf or more than 16 arguments is
+// rendered on the spot, returning its length like crprintf_async_exec
+int crprintf_async_defer(crprintf_async *sink, crprintf_compiled *prog, ...);
+
+// the sink behind crprintf_defer: stdout, opened on first use with a 1 MB
+// ring that blocks when full, and flushed at exit. stdout is flushed as it
+// opens; later crprintf output may land ahead of lines still queued
+crprintf_async *crprintf_defer_sink(void);
+int crprintf_defer_flush(void);
+
+// a binary trace log: the header holds the programs, serialized, and each
+// record only the index of its program, a timestamp and the raw arguments.
+// crprintf_trace_decode, or the crprintf-decode tool, renders it later.
+// programs may not use global variables, %n or %Lf, or take more than 16
+// arguments; crprintf_trace_open returns NULL for those
+typedef struct crprintf_trace crprintf_trace;
+
+crprintf_trace *crprintf_trace_open(FILE *out, crprintf_compiled *const *progs, size_t count);
+int crprintf_trace_write(crprintf_trace *log, uint32_t id, ...);
+int crprintf_trace_close(crprintf_trace *log);
+int crprintf_trace_decode(const void *data, size_t size, FILE *out, bool timestamps);
+
+// after the first call at a site this is a single acquire load
+#define _CRPRINTF_INIT(prog, fmt) ({ \
+  crprintf_compiled *_cp_p_ = __atomic_load_n(&(prog), __ATOMIC_ACQUIRE); \
+  __builtin_expect(!_cp_p_, 0) ? crprintf_compile_once(&(prog), fmt) : _cp_p_; \
+})
   
 #define crprintf(fmt, ...) ({ \
   static crprintf_compiled *_cp_prog_ = NULL; \
-  _CRPRINTF_INIT(_cp_prog_, fmt); \
-  crprintf_exec(_cp_prog_, stdout, ##__VA_ARGS__); \
+  crprintf_exec(_CRPRINTF_INIT(_cp_prog_, fmt), stdout, ##__VA_ARGS__); \
 })
 
 #define crfprintf(stream, fmt, ...) ({ \
   static crprintf_compiled *_cp_prog_ = NULL; \
-  _CRPRINTF_INIT(_cp_prog_, fmt); \
-  crprintf_exec(_cp_prog_, stream, ##__VA_ARGS__); \
+  crprintf_exec(_CRPRINTF_INIT(_cp_prog_, fmt), stream, ##__VA_ARGS__); \
 })
 
 #define crsprintf(buf, size, fmt, ...) ({ \
   static crprintf_compiled *_cp_prog_ = NULL; \
-  _CRPRINTF_INIT(_cp_prog_, fmt); \
-  crsprintf_inner(_cp_prog_, buf, size, ##__VA_ARGS__); \
+  crsprintf_inner(_CRPRINTF_INIT(_cp_prog_, fmt), buf, size, ##__VA_ARGS__); \
 })
 
+#define craprintf(sink, fmt, ...) ({ \
+  static crprintf_compiled *_cp_prog_ = NULL; \
+  crprintf_async_exec(sink, _CRPRINTF_INIT(_cp_prog_, fmt), ##__VA_ARGS__); \
+})
+
+#define crprintf_defer(fmt, ...) ({ \
+  static crprintf_compiled *_cp_prog_ = NULL; \
+  crprintf_async_defer(crprintf_defer_sink(), _CRPRINTF_INIT(_cp_prog_, fmt), ##__VA_ARGS__); \
+})
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
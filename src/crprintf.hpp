@@ -0,0 +1,1323 @@
+/*
+ * crprintf.hpp - C++20 front end that compiles crprintf formats at compile time
+ *
+ * Copyright (c) 2026 theMackabu (me@themackabu.dev)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * usage:
+ *   using namespace crp::literals;
+ *   crp::printf("<bold><cyan>info:</cyan></bold> hello %s\n"_crp, name);
+ *   crp::fprintf(stderr, "<red>error:</red> %d files\n"_crp, count);
+ *
+ * the format is parsed by a consteval port of the compiler in crprintf.c and
+ * lands in read-only data as the same bytecode and literal pool, so there is
+ * no parse at runtime. it differs from the C compiler in being strict:
+ *   a '<' ... '>' that isn't a tag, a malformed <let>, %n, %L and case
+ *   transforms of global variables are compile errors, as is an argument
+ *   list whose count or types don't match the conversions
+ * {name} and <$name> that aren't <let> locals are global variables, bound by
+ * name the first time the call site runs; they take no arguments, so a
+ * conversion in a global's value prints as text
+ *
+ * crp::print and crp::format_to take the same formats but pack arguments by
+ * type instead of passing them through a va_list; std::string and
+ * std::string_view are accepted for a plain %s
+ */
+
+#ifndef CRPRINTF_HPP
+#define CRPRINTF_HPP
+
+#include "crprintf.h"
+
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cwchar>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace crp {
+
+// what a conversion takes from the argument list, numbered as in crprintf.c
+enum arg_class : uint8_t {
+  ARG_NONE = 0,
+  ARG_INT,
+  ARG_LONG,
+  ARG_LLONG,
+  ARG_SIZE,
+  ARG_DOUBLE,
+  ARG_CSTR,
+  ARG_PTR,
+  ARG_WINT,
+  ARG_WSTR,
+};
+
+namespace detail {
+
+// opcodes, colors and record layouts below mirror crprintf.c; every image is
+// validated when it binds, so a header out of step with the library falls
+// back to compiling at runtime rather than rendering wrong
+enum : uint32_t {
+  OP_NOP = 0,
+  OP_EMIT_LIT,
+  OP_EMIT_FMT,
+  OP_EMIT_INT,
+  OP_EMIT_UINT,
+  OP_EMIT_UINT_HEX,
+  OP_EMIT_CSTR,
+  OP_SET_FG,
+  OP_SET_BG,
+  OP_SET_FG_RGB,
+  OP_SET_BG_RGB,
+  OP_SET_BOLD,
+  OP_SET_DIM,
+  OP_SET_UL,
+  OP_SET_ITALIC,
+  OP_SET_STRIKE,
+  OP_SET_INVERT,
+  OP_STYLE_PUSH,
+  OP_STYLE_FLUSH,
+  OP_STYLE_RESET,
+  OP_STYLE_RESET_ALL,
+  OP_PAD_BEGIN,
+  OP_RPAD_BEGIN,
+  OP_PAD_END,
+  OP_EMIT_SPACES,
+  OP_EMIT_NEWLINES,
+  OP_SNAPSHOT,
+  OP_STYLE_APPLY,
+  OP_EMIT_VAR,
+  OP_APPLY_VAR,
+  OP_VAR_RET,
+  OP_HALT,
+};
+
+enum : uint32_t {
+  COL_NONE = 0,
+  COL_BLACK = 30, COL_RED, COL_GREEN, COL_YELLOW,
+  COL_BLUE, COL_MAGENTA, COL_CYAN, COL_WHITE,
+  COL_GRAY = 90, COL_BRIGHT_RED, COL_BRIGHT_GREEN, COL_BRIGHT_YELLOW,
+  COL_BRIGHT_BLUE, COL_BRIGHT_MAGENTA, COL_BRIGHT_CYAN, COL_BRIGHT_WHITE,
+  COL_RGB = 0xFF,
+};
+
+enum : uint8_t {
+  STYLE_BOLD = 0x01, STYLE_DIM = 0x02, STYLE_UL = 0x04,
+  STYLE_ITALIC = 0x08, STYLE_STRIKE = 0x10, STYLE_INVERT = 0x20,
+};
+
+enum : uint8_t { DELTA_PUSH = 1, DELTA_POP = 2, DELTA_QUIET = 4 };
+enum : uint8_t { DELTA_FG = 0x01, DELTA_FG_RGB = 0x02, DELTA_BG = 0x04, DELTA_BG_RGB = 0x08 };
+
+enum : uint8_t {
+  FMT_LEFT = 0x01, FMT_ZERO = 0x02, FMT_PREC = 0x04,
+  FMT_UPPER = 0x08, FMT_STAR_W = 0x10, FMT_STAR_P = 0x20,
+};
+
+inline constexpr unsigned FMT_MAX_WIDTH = 4096;
+inline constexpr uint8_t BC_ARG = 0x80;
+
+// sizeof(style_delta_t) and sizeof(fmt_desc_t) in crprintf.c
+inline constexpr size_t DELTA_SIZE = 20;
+inline constexpr size_t FMT_DESC_SIZE = 12;
+
+// not constexpr: a format that reaches one of these fails to compile, and the
+// diagnostic quotes the call with its reason
+void format_error(const char *why);
+
+template <size_t N>
+struct fixed_string {
+  char data[N];
+  constexpr fixed_string(const char (&s)[N]) { for (size_t i = 0; i < N; i++) data[i] = s[i]; }
+  constexpr std::string_view view() const { return { data, N - 1 }; }
+};
+
+struct insn { uint32_t op, operand; };
+
+struct style_entry {
+  uint32_t fg = 0, bg = 0, fg_rgb = 0, bg_rgb = 0;
+  uint8_t flags = 0;
+};
+
+struct style_regs {
+  style_entry current;
+  style_entry stack[8];
+  int depth = 0;
+};
+
+struct style_delta {
+  uint8_t stack = 0, fields = 0, flags_on = 0, flags_off = 0;
+  uint32_t fg = 0, fg_rgb = 0, bg = 0, bg_rgb = 0;
+};
+
+struct fmt_desc {
+  uint32_t len = 0;
+  uint16_t width = 0, prec = 0;
+  uint8_t cls = 0, flags = 0;
+};
+
+struct word { std::string_view name; uint32_t op, operand; };
+
+inline constexpr word style_words[] = {
+  { "i", OP_SET_ITALIC, 1 }, { "ul", OP_SET_UL, 1 }, { "dim", OP_SET_DIM, 1 },
+  { "bold", OP_SET_BOLD, 1 }, { "italic", OP_SET_ITALIC, 1 },
+  { "invert", OP_SET_INVERT, 1 }, { "strike", OP_SET_STRIKE, 1 },
+  { "black", OP_SET_FG, COL_BLACK }, { "red", OP_SET_FG, COL_RED },
+  { "green", OP_SET_FG, COL_GREEN }, { "yellow", OP_SET_FG, COL_YELLOW },
+  { "blue", OP_SET_FG, COL_BLUE }, { "magenta", OP_SET_FG, COL_MAGENTA },
+  { "cyan", OP_SET_FG, COL_CYAN }, { "white", OP_SET_FG, COL_WHITE },
+  { "gray", OP_SET_FG, COL_GRAY }, { "grey", OP_SET_FG, COL_GRAY },
+  { "bright_red", OP_SET_FG, COL_BRIGHT_RED }, { "bright_green", OP_SET_FG, COL_BRIGHT_GREEN },
+  { "bright_yellow", OP_SET_FG, COL_BRIGHT_YELLOW }, { "bright_blue", OP_SET_FG, COL_BRIGHT_BLUE },
+  { "bright_magenta", OP_SET_FG, COL_BRIGHT_MAGENTA }, { "bright_cyan", OP_SET_FG, COL_BRIGHT_CYAN },
+  { "bright_white", OP_SET_FG, COL_BRIGHT_WHITE },
+  { "bg_black", OP_SET_BG, COL_BLACK }, { "bg_red", OP_SET_BG, COL_RED },
+  { "bg_green", OP_SET_BG, COL_GREEN }, { "bg_yellow", OP_SET_BG, COL_YELLOW },
+  { "bg_blue", OP_SET_BG, COL_BLUE }, { "bg_magenta", OP_SET_BG, COL_MAGENTA },
+  { "bg_cyan", OP_SET_BG, COL_CYAN }, { "bg_white", OP_SET_BG, COL_WHITE },
+};
+
+constexpr insn style_word(std::string_view s) {
+  for (const word &w : style_words) if (w.name == s) return { w.op, w.operand };
+  return { OP_NOP, 0 };
+}
+
+constexpr char at(std::string_view s, size_t i) { return i < s.size() ? s[i] : '\0'; }
+
+constexpr int hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+constexpr bool is_attr_op(uint32_t op) { return op >= OP_SET_BOLD && op <= OP_SET_INVERT; }
+constexpr bool is_set_op(uint32_t op) { return op >= OP_SET_FG && op <= OP_SET_INVERT; }
+constexpr bool is_var_op(uint32_t op) { return op == OP_EMIT_VAR || op == OP_APPLY_VAR; }
+constexpr bool is_escape_op(uint32_t op) { return op == OP_STYLE_FLUSH || op == OP_STYLE_RESET || op == OP_STYLE_RESET_ALL; }
+constexpr bool is_style_silent(uint32_t op) { return op == OP_NOP || op == OP_STYLE_PUSH || is_set_op(op); }
+
+constexpr void put_le(std::vector<char> &out, uint64_t v, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    int shift = (std::endian::native == std::endian::little) ? i * 8 : (bytes - 1 - i) * 8;
+    out.push_back((char)(uint8_t)(v >> shift));
+  }
+}
+
+constexpr void put_varint(std::vector<char> &out, uint32_t v) {
+  while (v >= 0x80) { out.push_back((char)(uint8_t)(v | 0x80)); v >>= 7; }
+  out.push_back((char)(uint8_t)v);
+}
+
+// std::string isn't usable in constant expressions on every supported
+// toolchain yet, so text built at compile time lives in vectors
+using text = std::vector<char>;
+
+constexpr std::string_view view(const text &t) { return { t.data(), t.size() }; }
+
+constexpr void append(text &out, std::string_view s) { out.insert(out.end(), s.begin(), s.end()); }
+
+constexpr void esc_uint(text &out, unsigned v) {
+  if (v >= 100) out.push_back((char)('0' + v / 100));
+  if (v >= 10)  out.push_back((char)('0' + v / 10 % 10));
+  out.push_back((char)('0' + v % 10));
+}
+
+constexpr void esc_sgr(text &out, unsigned code) {
+  append(out, "\x1b[");
+  esc_uint(out, code);
+  out.push_back('m');
+}
+
+constexpr void esc_rgb(text &out, unsigned base, uint32_t rgb) {
+  append(out, "\x1b[");
+  esc_uint(out, base); append(out, ";2;");
+  esc_uint(out, (rgb >> 16) & 0xFF); out.push_back(';');
+  esc_uint(out, (rgb >> 8) & 0xFF); out.push_back(';');
+  esc_uint(out, rgb & 0xFF);
+  out.push_back('m');
+}
+
+constexpr text style_esc(const style_entry &s) {
+  text out;
+  esc_sgr(out, 0);
+  if (s.flags & STYLE_BOLD)   esc_sgr(out, 1);
+  if (s.flags & STYLE_DIM)    esc_sgr(out, 2);
+  if (s.flags & STYLE_UL)     esc_sgr(out, 4);
+  if (s.flags & STYLE_ITALIC) esc_sgr(out, 3);
+  if (s.flags & STYLE_STRIKE) esc_sgr(out, 9);
+  if (s.flags & STYLE_INVERT) esc_sgr(out, 7);
+  if (s.fg == COL_RGB) esc_rgb(out, 38, s.fg_rgb);
+  else if (s.fg)       esc_sgr(out, s.fg);
+  if (s.bg == COL_RGB) esc_rgb(out, 48, s.bg_rgb);
+  else if (s.bg)       esc_sgr(out, s.bg + 10);
+  return out;
+}
+
+constexpr void apply_delta(style_regs &r, const style_delta &d) {
+  if (d.stack & DELTA_PUSH) {
+    if (r.depth < 8) r.stack[r.depth++] = r.current;
+  } else if (d.stack & DELTA_POP) {
+    if (r.depth > 0) r.current = r.stack[--r.depth];
+    else r.current = style_entry{};
+  }
+
+  r.current.flags = (uint8_t)((r.current.flags & ~d.flags_off) | d.flags_on);
+  if (d.fields & DELTA_FG)     r.current.fg = d.fg;
+  if (d.fields & DELTA_FG_RGB) r.current.fg_rgb = d.fg_rgb;
+  if (d.fields & DELTA_BG)     r.current.bg = d.bg;
+  if (d.fields & DELTA_BG_RGB) r.current.bg_rgb = d.bg_rgb;
+}
+
+constexpr void delta_add(style_delta &d, const insn &ins) {
+  uint8_t bit = 0;
+  switch (ins.op) {
+    case OP_SET_FG:     d.fields |= DELTA_FG; d.fg = ins.operand; return;
+    case OP_SET_BG:     d.fields |= DELTA_BG; d.bg = ins.operand; return;
+    case OP_SET_FG_RGB: d.fields |= DELTA_FG | DELTA_FG_RGB; d.fg = COL_RGB; d.fg_rgb = ins.operand; return;
+    case OP_SET_BG_RGB: d.fields |= DELTA_BG | DELTA_BG_RGB; d.bg = COL_RGB; d.bg_rgb = ins.operand; return;
+    case OP_SET_BOLD:   bit = STYLE_BOLD;   break;
+    case OP_SET_DIM:    bit = STYLE_DIM;    break;
+    case OP_SET_UL:     bit = STYLE_UL;     break;
+    case OP_SET_ITALIC: bit = STYLE_ITALIC; break;
+    case OP_SET_STRIKE: bit = STYLE_STRIKE; break;
+    case OP_SET_INVERT: bit = STYLE_INVERT; break;
+  }
+  if (ins.operand) { d.flags_on |= bit; d.flags_off &= (uint8_t)~bit; }
+  else { d.flags_off |= bit; d.flags_on &= (uint8_t)~bit; }
+}
+
+constexpr arg_class classify_arg(std::string_view spec) {
+  char conv = spec.back();
+
+  if (conv == '%') return ARG_NONE;
+  if (conv == 'p') return ARG_PTR;
+  if (std::string_view("fFeEgGaA").find(conv) != std::string_view::npos) return ARG_DOUBLE;
+
+  size_t p = 1;
+  while (std::string_view("-+ #0").find(at(spec, p)) != std::string_view::npos && at(spec, p)) p++;
+  if (at(spec, p) == '*') p++; else while (at(spec, p) >= '0' && at(spec, p) <= '9') p++;
+  if (at(spec, p) == '.') { p++; if (at(spec, p) == '*') p++; else while (at(spec, p) >= '0' && at(spec, p) <= '9') p++; }
+
+  if (at(spec, p) == 'z')                             return ARG_SIZE;
+  if (at(spec, p) == 'l' && at(spec, p + 1) == 'l')   return ARG_LLONG;
+  if (at(spec, p) == 'l' && conv == 'c')              return ARG_WINT;
+  if (at(spec, p) == 'l' && conv == 's')              return ARG_WSTR;
+  if (conv == 's')                                    return ARG_CSTR;
+  if (at(spec, p) == 'l')                             return ARG_LONG;
+  if (at(spec, p) == 'j')                             return ARG_LLONG;
+
+  return ARG_INT;
+}
+
+constexpr uint32_t native_fmt_op(std::string_view spec, fmt_desc &d) {
+  size_t p = 1, end = spec.size();
+  d = fmt_desc{ .len = (uint32_t)spec.size() };
+
+  for (; p < end - 1 && (spec[p] == '-' || spec[p] == '0'); p++)
+    d.flags |= (spec[p] == '-') ? FMT_LEFT : FMT_ZERO;
+
+  unsigned width = 0, prec = 0;
+  while (p < end && spec[p] >= '0' && spec[p] <= '9')
+    if ((width = width * 10 + (unsigned)(spec[p++] - '0')) > FMT_MAX_WIDTH) return OP_EMIT_FMT;
+
+  if (p < end && spec[p] == '.') {
+    d.flags |= FMT_PREC; p++;
+    while (p < end && spec[p] >= '0' && spec[p] <= '9')
+      if ((prec = prec * 10 + (unsigned)(spec[p++] - '0')) > FMT_MAX_WIDTH) return OP_EMIT_FMT;
+  }
+
+  size_t mods = end - 1 - p;
+  if (!(mods == 0 || (mods == 1 && (spec[p] == 'l' || spec[p] == 'z' || spec[p] == 'j')) ||
+      (mods == 2 && spec[p] == 'l' && spec[p + 1] == 'l'))) return OP_EMIT_FMT;
+
+  d.width = (uint16_t)width;
+  d.prec = (uint16_t)prec;
+  d.cls = classify_arg(spec);
+
+  switch (spec.back()) {
+    case 'd': case 'i': return OP_EMIT_INT;
+    case 'u':           return OP_EMIT_UINT;
+    case 'X':           d.flags |= FMT_UPPER; return OP_EMIT_UINT_HEX;
+    case 'x':           return OP_EMIT_UINT_HEX;
+    case 's':           return (mods || (d.flags & FMT_ZERO)) ? OP_EMIT_FMT : OP_EMIT_CSTR;
+    default:            return OP_EMIT_FMT;
+  }
+}
+
+constexpr void describe_fmt(std::string_view spec, fmt_desc &d) {
+  size_t p = 1, end = spec.size();
+  d = fmt_desc{ .len = (uint32_t)spec.size(), .cls = classify_arg(spec) };
+
+  while (p < end && std::string_view("-+ #0").find(spec[p]) != std::string_view::npos) p++;
+  if (p < end && spec[p] == '*') { d.flags |= FMT_STAR_W; p++; }
+  else while (p < end && spec[p] >= '0' && spec[p] <= '9') p++;
+
+  if (end - p > 1 && spec[p] == '.' && spec[p + 1] == '*') d.flags |= FMT_STAR_P;
+}
+
+inline constexpr int SPEC_NONE = -1, SPEC_STAR = -2;
+
+// one argument as crp::print sees it: the op that reads it and the printf
+// spec it was written with; '*' widths are plain ints with op OP_NOP
+struct arg_spec {
+  arg_class cls = ARG_NONE;
+  uint32_t op = OP_NOP;
+  char conv = 0, mod = 0;
+  bool left = false, plus = false, space = false, alt = false, zero = false;
+  int width = 0, prec = SPEC_NONE;
+};
+
+// mod folds hh to 'H' and ll to 'q'
+constexpr arg_spec parse_spec(std::string_view spec, uint32_t op, arg_class cls) {
+  arg_spec sp{ .cls = cls, .op = op, .conv = spec.back() };
+  size_t p = 1;
+
+  for (;; p++) {
+    char c = at(spec, p);
+    if (c == '-') sp.left = true;
+    else if (c == '+') sp.plus = true;
+    else if (c == ' ') sp.space = true;
+    else if (c == '#') sp.alt = true;
+    else if (c == '0') sp.zero = true;
+    else break;
+  }
+
+  auto number = [&](int &out) {
+    if (at(spec, p) == '*') { out = SPEC_STAR; p++; return; }
+    out = 0;
+    while (at(spec, p) >= '0' && at(spec, p) <= '9')
+      if ((out = out * 10 + (at(spec, p++) - '0')) > (int)FMT_MAX_WIDTH) out = FMT_MAX_WIDTH + 1;
+  };
+
+  number(sp.width);
+  if (at(spec, p) == '.') { p++; number(sp.prec); }
+
+  char m = at(spec, p);
+  if (m == 'h' || m == 'l' || m == 'z' || m == 'j' || m == 't') {
+    sp.mod = (at(spec, p + 1) == m) ? (m == 'h' ? 'H' : 'q') : m;
+  }
+  return sp;
+}
+
+constexpr size_t fmt_spec_end(std::string_view s, size_t ptr) {
+  size_t fs = ptr + 1;
+  while (std::string_view("-+ #0").find(at(s, fs)) != std::string_view::npos && at(s, fs)) fs++;
+  if (at(s, fs) == '*') fs++; else while (at(s, fs) >= '0' && at(s, fs) <= '9') fs++;
+  if (at(s, fs) == '.') { fs++; if (at(s, fs) == '*') fs++; else while (at(s, fs) >= '0' && at(s, fs) <= '9') fs++; }
+  while (at(s, fs) && std::string_view("hlLzjt").find(at(s, fs)) != std::string_view::npos) fs++;
+  if (at(s, fs)) fs++;
+  return fs;
+}
+
+// tag counts are plain decimal; atoi's leniency would hide typos
+constexpr uint32_t parse_count(std::string_view s) {
+  uint64_t v = 0;
+  if (s.empty()) format_error("expected a number in tag");
+  for (char c : s) {
+    if (c < '0' || c > '9') format_error("expected a number in tag");
+    if ((v = v * 10 + (uint64_t)(c - '0')) > 0x7fffffff) format_error("number in tag is too large");
+  }
+  return (uint32_t)v;
+}
+
+// mode 1 lowers, 0 raises, anything else copies
+constexpr text transform_case(std::string_view s, int mode) {
+  text out(s.begin(), s.end());
+  for (char &c : out) {
+    if (mode == 1 && c >= 'A' && c <= 'Z') c = (char)(c - 'A' + 'a');
+    if (mode == 0 && c >= 'a' && c <= 'z') c = (char)(c - 'a' + 'A');
+  }
+  return out;
+}
+
+// names that can be global variables; anything else in braces is text, as
+// it is when the C compiler finds no variable by that name
+constexpr bool var_name_ok(std::string_view s) {
+  if (s.empty()) return false;
+  for (char c : s)
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.'))
+      return false;
+  return true;
+}
+
+struct local_var {
+  text name, value;
+  bool is_fmt;
+};
+
+// the scanner and peephole passes of crprintf.c, run by the C++ compiler
+struct compiler {
+  std::vector<insn> code;
+  std::vector<char> lits;
+  std::vector<text> slots;
+  std::vector<local_var> locals;
+  std::vector<arg_spec> args;
+  int var_depth = 0;
+
+  constexpr void emit(uint32_t op, uint32_t operand = 0) { code.push_back({ op, operand }); }
+
+  constexpr uint32_t add_literal(std::string_view s) {
+    uint32_t off = (uint32_t)lits.size();
+    lits.insert(lits.end(), s.begin(), s.end());
+    lits.push_back('\0');
+    return off;
+  }
+
+  constexpr uint32_t add_record(const std::vector<char> &hdr, std::string_view s) {
+    uint32_t off = (uint32_t)lits.size();
+    lits.insert(lits.end(), hdr.begin(), hdr.end());
+    return (add_literal(s), off);
+  }
+
+  constexpr size_t lit_strlen(size_t off) const {
+    size_t n = 0;
+    while (lits[off + n]) n++;
+    return n;
+  }
+
+  constexpr const local_var *find_local(std::string_view name) const {
+    for (const local_var &v : locals) if (view(v.name) == name) return &v;
+    return nullptr;
+  }
+
+  constexpr uint32_t slot(std::string_view name) {
+    for (size_t i = 0; i < slots.size(); i++) if (view(slots[i]) == name) return (uint32_t)i;
+    slots.emplace_back(name.begin(), name.end());
+    return (uint32_t)slots.size() - 1;
+  }
+
+  constexpr bool hex_rgb(std::string_view hex, uint32_t &rgb) const {
+    int d[6] = {};
+    if (hex.size() == 4) {
+      for (int i = 0; i < 3; i++) if ((d[i * 2] = d[i * 2 + 1] = hex_digit(hex[1 + i])) < 0) return false;
+    } else if (hex.size() == 7) {
+      for (int i = 0; i < 6; i++) if ((d[i] = hex_digit(hex[1 + i])) < 0) return false;
+    } else return false;
+    rgb = (uint32_t)(d[0] << 20 | d[1] << 16 | d[2] << 12 | d[3] << 8 | d[4] << 4 | d[5]);
+    return true;
+  }
+
+  constexpr bool compile_hex(uint32_t op, std::string_view hex) {
+    uint32_t rgb = 0;
+    if (!hex_rgb(hex, rgb)) return false;
+    emit(op, rgb);
+    return true;
+  }
+
+  constexpr bool match_word(std::string_view s) {
+    insn w = style_word(s);
+    if (w.op == OP_NOP) return false;
+    emit(w.op, w.operand);
+    return true;
+  }
+
+  constexpr bool match_seg_bg(std::string_view s) {
+    insn w = style_word(s);
+    if (w.op != OP_SET_FG || w.operand < COL_BLACK || w.operand > COL_WHITE) return false;
+    emit(OP_SET_BG, w.operand);
+    return true;
+  }
+
+  constexpr bool match_plus_seg(std::string_view seg) {
+    if (match_word(seg))                          return true;
+    if (!seg.empty() && seg[0] == '#')            return compile_hex(OP_SET_FG_RGB, seg);
+    if (seg.size() > 4 && seg.starts_with("bg_#")) return compile_hex(OP_SET_BG_RGB, seg.substr(3));
+    if (seg.size() > 3 && seg.starts_with("bg_"))  return match_seg_bg(seg.substr(3));
+    return false;
+  }
+
+  constexpr int compile_plus_segs(std::string_view s) {
+    int emitted = 0;
+    for (size_t seg = 0; seg < s.size();) {
+      size_t next = s.find('+', seg);
+      if (next == std::string_view::npos) next = s.size();
+      if (!match_plus_seg(s.substr(seg, next - seg))) return 0;
+      emitted++;
+      seg = next < s.size() ? next + 1 : s.size();
+    }
+    return emitted;
+  }
+
+  constexpr void define(std::string_view name, std::string_view value, bool is_fmt) {
+    for (local_var &v : locals) if (view(v.name) == name) { v.value.assign(value.begin(), value.end()); v.is_fmt = is_fmt; return; }
+    locals.push_back({ text(name.begin(), name.end()), text(value.begin(), value.end()), is_fmt });
+  }
+
+  constexpr bool compile_let(std::string_view body) {
+    if (!body.empty() && body.back() == '/') body.remove_suffix(1);
+    size_t p = 0, end = body.size();
+
+    while (p < end) {
+      while (p < end && (body[p] == ' ' || body[p] == ',')) p++;
+      if (p >= end) break;
+
+      size_t eq = body.find('=', p);
+      if (eq == std::string_view::npos) return false;
+      std::string_view name = body.substr(p, eq - p);
+      size_t vstart = eq + 1, vend = vstart;
+
+      if (vstart < end && (body[vstart] == '\'' || body[vstart] == '"')) {
+        char quote = body[vstart++];
+        vend = vstart;
+        while (vend < end && body[vend] != quote) vend++;
+        if (vend >= end || name.empty()) return false;
+
+        std::string_view value = body.substr(vstart, vend - vstart);
+        bool is_fmt = false;
+        for (size_t j = 0; j + 1 < value.size(); j++)
+          if (value[j] == '%' && value[j + 1] != '%') { is_fmt = true; break; }
+
+        define(name, value, is_fmt);
+        p = vend + 1;
+        while (p < end && (body[p] == ' ' || body[p] == ',')) p++;
+        continue;
+      }
+
+      while (vend < end && body[vend] != ',') vend++;
+      if (name.empty() || vend == vstart) return false;
+      define(name, body.substr(vstart, vend - vstart), false);
+      p = vend;
+    }
+
+    return true;
+  }
+
+  constexpr bool compile_var_ref(std::string_view tag) {
+    std::string_view name = tag.substr(1), rest;
+    if (size_t plus = name.find('+'); plus != std::string_view::npos) {
+      rest = name.substr(plus + 1);
+      name = name.substr(0, plus);
+    }
+
+    emit(OP_STYLE_PUSH);
+    if (const local_var *v = find_local(name)) {
+      if (!compile_plus_segs(view(v->value))) return false;
+    } else {
+      if (!var_name_ok(name)) return false;
+      emit(OP_APPLY_VAR, slot(name));
+    }
+
+    if (!rest.empty() && !compile_plus_segs(rest)) return false;
+    emit(OP_STYLE_FLUSH);
+    return true;
+  }
+
+  constexpr bool match_off(std::string_view s) {
+    insn w = style_word(s);
+
+    if (is_attr_op(w.op))                                          emit(w.op, 0);
+    else if (w.op == OP_SET_FG || (!s.empty() && s[0] == '#'))     emit(OP_SET_FG, COL_NONE);
+    else if (w.op == OP_SET_BG || (s.size() > 4 && s.starts_with("bg_#"))) emit(OP_SET_BG, COL_NONE);
+    else return false;
+
+    return true;
+  }
+
+  constexpr bool compile_tag(std::string_view tag, bool closing) {
+    if (closing) {
+      if (tag == "pad" || tag == "rpad") { emit(OP_PAD_END); return true; }
+      if (match_off(tag)) { emit(OP_STYLE_FLUSH); return true; }
+      emit(OP_STYLE_RESET);
+      return true;
+    }
+
+    if (tag.empty()) return false;
+    bool self_closing = tag.back() == '/';
+    std::string_view count = self_closing ? tag.substr(0, tag.size() - 1) : tag;
+
+    switch (tag[0]) {
+      case '$': if (tag.size() > 1) return compile_var_ref(tag); break;
+      case 'l': if (tag.size() > 4 && tag.starts_with("let ")) return compile_let(tag.substr(4)); break;
+      case 'p':
+        if (tag.size() > 4 && tag.starts_with("pad=")) { emit(OP_PAD_BEGIN, parse_count(tag.substr(4))); return true; }
+        break;
+      case 'r':
+        if (tag.size() > 5 && tag.starts_with("rpad=")) { emit(OP_RPAD_BEGIN, parse_count(tag.substr(5))); return true; }
+        if (tag == "reset/") { emit(OP_STYLE_RESET_ALL); return true; }
+        break;
+      case 's':
+        if (self_closing && tag.size() > 6 && tag.starts_with("space=")) { emit(OP_EMIT_SPACES, parse_count(count.substr(6))); return true; }
+        break;
+      case 'g':
+        if (self_closing && tag.size() > 4 && tag.starts_with("gap=")) { emit(OP_EMIT_SPACES, parse_count(count.substr(4))); return true; }
+        break;
+      case 'b':
+        if (tag == "br/") { emit(OP_EMIT_NEWLINES, 1); return true; }
+        if (self_closing && tag.size() > 3 && tag.starts_with("br=")) { emit(OP_EMIT_NEWLINES, parse_count(count.substr(3))); return true; }
+        break;
+    }
+
+    emit(OP_STYLE_PUSH);
+
+    if (match_word(tag)) { emit(OP_STYLE_FLUSH); return true; }
+
+    if (tag[0] == '#') {
+      if (!compile_hex(OP_SET_FG_RGB, tag)) return false;
+      emit(OP_STYLE_FLUSH); return true;
+    }
+
+    if (tag.size() > 4 && tag.starts_with("bg_#")) {
+      if (!compile_hex(OP_SET_BG_RGB, tag.substr(3))) return false;
+      emit(OP_STYLE_FLUSH); return true;
+    }
+
+    if (tag.find('+') != std::string_view::npos) {
+      if (compile_plus_segs(tag)) { emit(OP_STYLE_FLUSH); return true; }
+    }
+
+    int emitted = 0;
+    for (size_t seg = 0; seg < tag.size();) {
+      size_t sep = tag.find('_', seg);
+      if (sep == std::string_view::npos) sep = tag.size();
+      insn w = style_word(tag.substr(seg, sep - seg));
+
+      if (is_attr_op(w.op) || w.op == OP_SET_FG) {
+        emit(w.op, w.operand);
+      } else if (tag.substr(seg, sep - seg) == "bg" && sep < tag.size()) {
+        seg = sep + 1;
+        sep = tag.find('_', seg);
+        if (sep == std::string_view::npos) sep = tag.size();
+        if (!match_seg_bg(tag.substr(seg, sep - seg))) return false;
+      } else return false;
+
+      emitted++;
+      seg = sep < tag.size() ? sep + 1 : tag.size();
+    }
+
+    if (emitted) { emit(OP_STYLE_FLUSH); return true; }
+    return false;
+  }
+
+  constexpr void flush_lit(std::string_view s, size_t lit, size_t end) {
+    if (end <= lit) return;
+    emit(OP_EMIT_LIT, add_literal(s.substr(lit, end - lit)));
+  }
+
+  constexpr void emit_fmt(std::string_view spec) {
+    if (spec.size() < 2 || std::string_view("diouxXeEfFgGaAcsp%").find(spec.back()) == std::string_view::npos)
+      format_error("unsupported conversion");
+    if (spec.find('L') != std::string_view::npos) format_error("long double conversions are not supported");
+
+    fmt_desc d;
+    uint32_t op = native_fmt_op(spec, d);
+    if (op == OP_EMIT_FMT) describe_fmt(spec, d);
+
+    std::vector<char> hdr;
+    put_le(hdr, d.len, 4);
+    put_le(hdr, d.width, 2);
+    put_le(hdr, d.prec, 2);
+    put_le(hdr, d.cls, 1);
+    put_le(hdr, d.flags, 1);
+    hdr.resize(FMT_DESC_SIZE);
+    emit(op, add_record(hdr, spec));
+
+    if (d.flags & FMT_STAR_W) args.push_back({ .cls = ARG_INT });
+    if (d.flags & FMT_STAR_P) args.push_back({ .cls = ARG_INT });
+    if (d.cls != ARG_NONE) args.push_back(parse_spec(spec, op, (arg_class)d.cls));
+  }
+
+  constexpr size_t scan_tag(std::string_view s, size_t ptr, size_t &lit) {
+    flush_lit(s, lit, ptr);
+
+    size_t start = ptr + 1;
+    bool closing = at(s, start) == '/';
+    if (closing) start++;
+
+    if (closing && at(s, start) == '>') {
+      emit(OP_STYLE_RESET);
+      return lit = start + 1;
+    }
+
+    size_t end = start;
+    while (at(s, end) && at(s, end) != '>') end++;
+
+    if (at(s, end) == '>') {
+      if (!compile_tag(s.substr(start, end - start), closing)) format_error("unknown tag; write << for a literal <");
+      return lit = end + 1;
+    }
+
+    emit(OP_EMIT_LIT, add_literal("<"));
+    return lit = ptr + 1;
+  }
+
+  constexpr size_t scan_let_brace(std::string_view s, size_t ptr, size_t &lit) {
+    flush_lit(s, lit, ptr);
+
+    size_t end = s.find('}', ptr);
+    if (end != std::string_view::npos) {
+      if (!compile_let(s.substr(ptr + 5, end - ptr - 5))) format_error("malformed {let}");
+      return lit = end + 1;
+    }
+
+    emit(OP_EMIT_LIT, add_literal("{"));
+    return lit = ptr + 1;
+  }
+
+  constexpr size_t scan_var_brace(std::string_view s, size_t ptr, size_t &lit) {
+    flush_lit(s, lit, ptr);
+
+    size_t name = ptr + 1, end = s.find('}', name);
+    if (end == std::string_view::npos) return emit_brace(ptr, lit);
+
+    bool lower = at(s, name) == '~', upper = at(s, name) == '^';
+    if (lower || upper) name++;
+
+    if (at(s, name) == '\'' || at(s, name) == '"') {
+      size_t e = s.find(s[name], name + 1);
+      if (e == std::string_view::npos || e >= end) return emit_brace(ptr, lit);
+
+      std::string_view quoted = s.substr(name + 1, e - name - 1);
+      if (!quoted.empty()) emit(OP_EMIT_LIT, add_literal(view(transform_case(quoted, lower ? 1 : upper ? 0 : -1))));
+      return lit = end + 1;
+    }
+
+    std::string_view var = s.substr(name, end - name);
+    const local_var *v = find_local(var);
+
+    if (!v) {
+      if (!var_name_ok(var)) return emit_brace(ptr, lit);
+      if (lower || upper) format_error("case transforms need a <let> value");
+      emit(OP_EMIT_VAR, slot(var));
+      return lit = end + 1;
+    }
+
+    text val = transform_case(view(v->value), lower ? 1 : upper ? 0 : -1);
+    bool is_fmt = v->is_fmt;
+
+    if (view(val).find('<') != std::string_view::npos) {
+      if (var_depth >= 8) format_error("variables nest too deeply");
+      var_depth++;
+      compile_fragment(view(val));
+      var_depth--;
+    } else if (is_fmt) {
+      if (val[0] != '%' || fmt_spec_end(view(val), 0) != val.size()) format_error("a format variable holds exactly one conversion");
+      emit_fmt(view(val));
+    } else {
+      emit(OP_EMIT_LIT, add_literal(view(val)));
+    }
+
+    return lit = end + 1;
+  }
+
+  constexpr size_t emit_brace(size_t ptr, size_t &lit) {
+    emit(OP_EMIT_LIT, add_literal("{"));
+    return lit = ptr + 1;
+  }
+
+  constexpr size_t scan_escape(std::string_view s, size_t ptr, size_t &lit, std::string_view text) {
+    flush_lit(s, lit, ptr);
+    emit(OP_EMIT_LIT, add_literal(text));
+    return lit = ptr + 2;
+  }
+
+  constexpr void compile_fragment(std::string_view s) {
+    size_t ptr = 0, lit = 0;
+
+    while ((ptr = s.find_first_of("<>{%", ptr)) != std::string_view::npos) {
+      char c = s[ptr], next = at(s, ptr + 1);
+      if      (c == '<' && next == '<')                 ptr = scan_escape(s, ptr, lit, "<");
+      else if (c == '>' && next == '>')                 ptr = scan_escape(s, ptr, lit, ">");
+      else if (c == '%' && next == '%')                 ptr = scan_escape(s, ptr, lit, "%");
+      else if (c == '{' && s.substr(ptr).starts_with("{let ")) ptr = scan_let_brace(s, ptr, lit);
+      else if (c == '{')                                ptr = scan_var_brace(s, ptr, lit);
+      else if (c == '<')                                ptr = scan_tag(s, ptr, lit);
+      else if (c == '%' && next) {
+        flush_lit(s, lit, ptr);
+        size_t fs = fmt_spec_end(s, ptr);
+        emit_fmt(s.substr(ptr, fs - ptr));
+        ptr = lit = fs;
+      }
+      else ptr++;
+    }
+
+    flush_lit(s, lit, s.size());
+  }
+
+  constexpr void drop_overwritten_escapes() {
+    for (size_t k = 0; k < code.size(); k++) {
+      if (!is_escape_op(code[k].op)) continue;
+      size_t m = k + 1;
+      while (m < code.size() && is_style_silent(code[m].op)) m++;
+      if (m >= code.size() || !is_escape_op(code[m].op)) continue;
+
+      if (code[k].op == OP_STYLE_FLUSH) code[k] = { OP_NOP, 0 };
+      else code[k].operand = 1;
+    }
+  }
+
+  constexpr void drop_dead_sets() {
+    constexpr uint32_t F_FG = 0x040, F_FG_RGB = 0x080, F_BG = 0x100, F_BG_RGB = 0x200, F_ALL = 0x3FF;
+    uint32_t dead = 0;
+
+    for (size_t k = code.size(); k-- > 0;) {
+      uint32_t op = code[k].op, fields = 0;
+      switch (op) {
+        case OP_SET_FG:     fields = F_FG; break;
+        case OP_SET_BG:     fields = F_BG; break;
+        case OP_SET_FG_RGB: fields = F_FG | F_FG_RGB; break;
+        case OP_SET_BG_RGB: fields = F_BG | F_BG_RGB; break;
+        case OP_SET_BOLD:   fields = STYLE_BOLD; break;
+        case OP_SET_DIM:    fields = STYLE_DIM; break;
+        case OP_SET_UL:     fields = STYLE_UL; break;
+        case OP_SET_ITALIC: fields = STYLE_ITALIC; break;
+        case OP_SET_STRIKE: fields = STYLE_STRIKE; break;
+        case OP_SET_INVERT: fields = STYLE_INVERT; break;
+      }
+
+      if (fields) {
+        if ((dead & fields) == fields) { code[k] = { OP_NOP, 0 }; continue; }
+        dead |= fields;
+      } else if (op == OP_STYLE_RESET || op == OP_STYLE_RESET_ALL) {
+        dead = F_ALL;
+      } else switch (op) {
+        case OP_NOP: case OP_EMIT_LIT: case OP_EMIT_FMT:
+        case OP_EMIT_INT: case OP_EMIT_UINT: case OP_EMIT_UINT_HEX: case OP_EMIT_CSTR:
+        case OP_PAD_BEGIN: case OP_RPAD_BEGIN: case OP_PAD_END:
+        case OP_EMIT_SPACES: case OP_EMIT_NEWLINES: break;
+        default: dead = 0; break;
+      }
+    }
+  }
+
+  constexpr void compact_code() {
+    size_t w = 0, run_end = 0;
+
+    for (size_t i = 0; i < code.size(); i++) {
+      insn ins = code[i];
+      if (ins.op == OP_NOP) continue;
+
+      if (ins.op == OP_EMIT_LIT) {
+        size_t blen = lit_strlen(ins.operand), b_end = ins.operand + blen + 1;
+
+        if (w && code[w - 1].op == OP_EMIT_LIT && ins.operand == run_end) {
+          size_t a = code[w - 1].operand, alen = lit_strlen(a);
+          for (size_t k = 0; k <= blen; k++) lits[a + alen + k] = lits[ins.operand + k];
+          for (size_t k = a + alen + blen + 1; k < b_end; k++) lits[k] = '\0';
+          run_end = b_end;
+          continue;
+        }
+        run_end = b_end;
+      }
+
+      code[w++] = ins;
+    }
+
+    code.resize(w);
+  }
+
+  constexpr void fold_styles() {
+    style_regs sim;
+    size_t w = 0;
+
+    for (size_t i = 0; i < code.size();) {
+      if (is_var_op(code[i].op)) {
+        while (i < code.size()) code[w++] = code[i++];
+        break;
+      }
+
+      style_delta d;
+      size_t j = i;
+
+      if (code[j].op == OP_STYLE_PUSH) { d.stack = DELTA_PUSH; j++; }
+      while (j < code.size() && is_set_op(code[j].op)) delta_add(d, code[j++]);
+
+      uint32_t op = code[j].op;
+      if (op == OP_STYLE_FLUSH || (op == OP_STYLE_RESET && j == i)) {
+        if (op == OP_STYLE_RESET) d.stack = DELTA_POP | (code[j].operand ? DELTA_QUIET : 0);
+        apply_delta(sim, d);
+
+        std::vector<char> hdr;
+        put_le(hdr, d.stack, 1);
+        put_le(hdr, d.fields, 1);
+        put_le(hdr, d.flags_on, 1);
+        put_le(hdr, d.flags_off, 1);
+        put_le(hdr, d.fg, 4);
+        put_le(hdr, d.fg_rgb, 4);
+        put_le(hdr, d.bg, 4);
+        put_le(hdr, d.bg_rgb, 4);
+        text esc;
+        if (!(d.stack & DELTA_QUIET)) esc = style_esc(sim.current);
+        code[w++] = { OP_STYLE_APPLY, add_record(hdr, view(esc)) };
+        i = j + 1;
+        continue;
+      }
+
+      insn ins = code[i++];
+      if (ins.op == OP_STYLE_RESET_ALL) { sim.current = style_entry{}; sim.depth = 0; }
+      else if (ins.op == OP_STYLE_PUSH) apply_delta(sim, style_delta{ .stack = DELTA_PUSH });
+      else if (is_set_op(ins.op)) { style_delta one; delta_add(one, ins); apply_delta(sim, one); }
+      code[w++] = ins;
+    }
+
+    code.resize(w);
+  }
+
+  // pads stay as pads and constant programs aren't pre-rendered: both need
+  // the VM's column counting, which the C compiler runs and this can't
+  constexpr void compile(std::string_view fmt) {
+    compile_fragment(fmt);
+    emit(OP_HALT);
+    drop_overwritten_escapes();
+    drop_dead_sets();
+    compact_code();
+    fold_styles();
+  }
+
+  // the layout crprintf_serialize writes: header, bytecode, literal pool, slot names
+  constexpr std::vector<char> image() const {
+    std::vector<char> bc;
+    for (const insn &ins : code) {
+      bc.push_back((char)(uint8_t)(ins.op | (ins.operand ? BC_ARG : 0)));
+      if (ins.operand) put_varint(bc, ins.operand);
+      if (ins.op == OP_EMIT_LIT) put_varint(bc, (uint32_t)lit_strlen(ins.operand));
+      if (ins.op == OP_STYLE_APPLY) put_varint(bc, (uint32_t)lit_strlen(ins.operand + DELTA_SIZE));
+    }
+
+    std::vector<char> out;
+    for (uint64_t v : { (uint64_t)code.size(), (uint64_t)bc.size(), (uint64_t)lits.size(), (uint64_t)slots.size() })
+      put_le(out, v, 4);
+    out.resize(out.size() + 4 * 5);
+    out.insert(out.end(), bc.begin(), bc.end());
+    out.insert(out.end(), lits.begin(), lits.end());
+    for (const text &name : slots) { append(out, view(name)); out.push_back('\0'); }
+    return out;
+  }
+};
+
+// the copy keeps every view off the template parameter object, which
+// -fsanitize=null would otherwise null-check outside constant evaluation
+constexpr compiler compile(std::string_view fmt) {
+  text src(fmt.begin(), fmt.end());
+  compiler c;
+  c.compile(view(src));
+  return c;
+}
+
+template <fixed_string S>
+consteval auto make_image() {
+  std::array<unsigned char, compile(S.view()).image().size()> out{};
+  std::vector<char> img = compile(S.view()).image();
+  for (size_t i = 0; i < out.size(); i++) out[i] = (unsigned char)img[i];
+  return out;
+}
+
+template <fixed_string S>
+consteval auto make_args() {
+  std::array<arg_spec, compile(S.view()).args.size()> out{};
+  std::vector<arg_spec> args = compile(S.view()).args;
+  for (size_t i = 0; i < out.size(); i++) out[i] = args[i];
+  return out;
+}
+
+template <class T>
+consteval bool accepts(arg_class cls) {
+  using D = std::decay_t<T>;
+  constexpr bool integral = std::is_integral_v<D> || std::is_enum_v<D>;
+
+  switch (cls) {
+    case ARG_INT:    return integral && sizeof(D) <= sizeof(int);
+    case ARG_LONG:   return integral && sizeof(D) == sizeof(long);
+    case ARG_LLONG:  return integral && sizeof(D) == sizeof(long long);
+    case ARG_SIZE:   return integral && sizeof(D) == sizeof(size_t);
+    case ARG_DOUBLE: return std::is_same_v<D, double> || std::is_same_v<D, float>;
+    case ARG_CSTR:   return std::is_pointer_v<D> && std::is_convertible_v<D, const char *>;
+    case ARG_PTR:    return std::is_pointer_v<D> || std::is_null_pointer_v<D>;
+    case ARG_WINT:   return integral && sizeof(D) <= sizeof(wint_t);
+    case ARG_WSTR:   return std::is_pointer_v<D> && std::is_convertible_v<D, const wchar_t *>;
+    case ARG_NONE:   return false;
+  }
+  return false;
+}
+
+template <class Format, class... Args>
+consteval bool args_match() {
+  if (sizeof...(Args) != Format::args.size()) return false;
+  size_t i = 0;
+  return (accepts<Args>(Format::args[i++].cls) && ...);
+}
+
+// text print() may pass with its length; pointers and arrays stay C strings
+template <class T>
+inline constexpr bool is_text =
+  !std::is_pointer_v<std::decay_t<T>> && !std::is_null_pointer_v<std::decay_t<T>> &&
+  std::is_convertible_v<const T &, std::string_view>;
+
+template <class T>
+consteval bool accepts_typed(const arg_spec &sp) {
+  if constexpr (is_text<T>) return sp.cls == ARG_CSTR && sp.op == OP_EMIT_CSTR;
+  else return accepts<T>(sp.cls);
+}
+
+template <class Format, class... Args>
+consteval bool typed_args_match() {
+  if (sizeof...(Args) != Format::args.size()) return false;
+  size_t i = 0;
+  return (accepts_typed<std::remove_cvref_t<Args>>(Format::args[i++]) && ...);
+}
+
+// conversions print() renders itself instead of leaving them to snprintf in
+// the VM: integers and %c with flags or modifiers the VM doesn't take, and
+// f/e/g, which std::to_chars is specified to render exactly as printf does
+inline constexpr size_t TEXT_ROOM = 72;
+
+constexpr bool bounded(const arg_spec &sp) {
+  return sp.op == OP_EMIT_FMT && sp.width >= 0 && sp.width <= 48 && sp.prec >= SPEC_NONE && sp.prec <= 40;
+}
+
+constexpr bool int_as_text(const arg_spec &sp) {
+  return bounded(sp) && std::string_view("diouxX").find(sp.conv) != std::string_view::npos;
+}
+
+constexpr bool char_as_text(const arg_spec &sp) { return bounded(sp) && sp.conv == 'c' && !sp.mod; }
+
+constexpr bool float_as_text(const arg_spec &sp) {
+  return bounded(sp) && !sp.alt && std::string_view("fFeEgG").find(sp.conv) != std::string_view::npos;
+}
+
+// sign or 0x, then zeros, then the digits, padded to the width like printf
+inline size_t lay_out(char *out, const arg_spec &sp, std::string_view prefix, size_t zeros, std::string_view body) {
+  size_t total = prefix.size() + zeros + body.size();
+  size_t pad = (size_t)sp.width > total ? (size_t)sp.width - total : 0;
+  char *p = out;
+
+  if (!sp.left) { std::memset(p, ' ', pad); p += pad; }
+  for (char c : prefix) *p++ = c;
+  std::memset(p, '0', zeros); p += zeros;
+  std::memcpy(p, body.data(), body.size()); p += body.size();
+  if (sp.left) { std::memset(p, ' ', pad); p += pad; }
+  return (size_t)(p - out);
+}
+
+// reads v as the type the length modifier names, like va_arg would
+template <class T>
+inline unsigned long long int_magnitude(const arg_spec &sp, T v, bool &neg) {
+  if (sp.conv == 'd' || sp.conv == 'i') {
+    long long s;
+    switch (sp.mod) {
+      case 'H': s = (signed char)v; break;
+      case 'h': s = (short)v; break;
+      case 'l': s = (long)v; break;
+      case 'q': case 'j': s = (long long)v; break;
+      case 'z': case 't': s = (ptrdiff_t)v; break;
+      default:  s = (int)v; break;
+    }
+    neg = s < 0;
+    return neg ? 0ULL - (unsigned long long)s : (unsigned long long)s;
+  }
+
+  neg = false;
+  switch (sp.mod) {
+    case 'H': return (unsigned char)v;
+    case 'h': return (unsigned short)v;
+    case 'l': return (unsigned long)v;
+    case 'q': case 'j': return (unsigned long long)v;
+    case 'z': case 't': return (size_t)v;
+    default:  return (unsigned)v;
+  }
+}
+
+template <class T>
+inline size_t int_text(char *out, const arg_spec &sp, T v) {
+  bool neg;
+  unsigned long long mag = int_magnitude(sp, v, neg);
+  int base = (sp.conv == 'o') ? 8 : (sp.conv == 'x' || sp.conv == 'X') ? 16 : 10;
+
+  char digits[24];
+  size_t n = (size_t)(std::to_chars(digits, digits + sizeof(digits), mag, base).ptr - digits);
+  if (sp.conv == 'X') for (size_t i = 0; i < n; i++) if (digits[i] >= 'a') digits[i] = (char)(digits[i] - 'a' + 'A');
+  if (sp.prec == 0 && mag == 0) n = 0;
+
+  std::string_view prefix;
+  if (neg) prefix = "-";
+  else if ((sp.conv == 'd' || sp.conv == 'i') && sp.plus) prefix = "+";
+  else if ((sp.conv == 'd' || sp.conv == 'i') && sp.space) prefix = " ";
+  else if (sp.alt && mag && sp.conv == 'x') prefix = "0x";
+  else if (sp.alt && mag && sp.conv == 'X') prefix = "0X";
+
+  size_t zeros = (sp.prec > 0 && (size_t)sp.prec > n) ? (size_t)sp.prec - n : 0;
+  if (sp.alt && sp.conv == 'o' && !zeros && (n == 0 || digits[0] != '0')) zeros = 1;
+  if (sp.zero && !sp.left && sp.prec == SPEC_NONE && (size_t)sp.width > prefix.size() + n)
+    zeros = (size_t)sp.width - prefix.size() - n;
+
+  return lay_out(out, sp, prefix, zeros, { digits, n });
+}
+
+// CRPRINTF_ARG_VALUE when v is left for the VM: infinities, NaNs, and values
+// too long to fit
+inline size_t float_text(char *out, const arg_spec &sp, double v) {
+  if (!std::isfinite(v)) return CRPRINTF_ARG_VALUE;
+
+  std::chars_format style = std::chars_format::general;
+  if (sp.conv == 'f' || sp.conv == 'F') style = std::chars_format::fixed;
+  if (sp.conv == 'e' || sp.conv == 'E') style = std::chars_format::scientific;
+
+  bool neg = std::signbit(v);
+  char body[64];
+  auto r = std::to_chars(body, body + sizeof(body), neg ? -v : v, style, sp.prec == SPEC_NONE ? 6 : sp.prec);
+  if (r.ec != std::errc()) return CRPRINTF_ARG_VALUE;
+
+  size_t n = (size_t)(r.ptr - body);
+  if (sp.conv == 'E' || sp.conv == 'G') for (size_t i = 0; i < n; i++) if (body[i] == 'e') body[i] = 'E';
+
+  std::string_view prefix = neg ? "-" : sp.plus ? "+" : sp.space ? " " : "";
+  size_t zeros = 0;
+  if (sp.zero && !sp.left && (size_t)sp.width > prefix.size() + n) zeros = (size_t)sp.width - prefix.size() - n;
+
+  return lay_out(out, sp, prefix, zeros, { body, n });
+}
+
+template <class Format, size_t I, class T>
+inline void pack_arg(crprintf_arg &a, char *room, T &&v) {
+  constexpr arg_spec sp = Format::args[I];
+  using D = std::remove_cvref_t<T>;
+  a.len = CRPRINTF_ARG_VALUE;
+
+  if constexpr (is_text<D>) {
+    std::string_view s(v);
+    a.v.s = s.data();
+    a.len = s.size();
+  } else if constexpr (std::is_pointer_v<std::decay_t<T>> || std::is_null_pointer_v<D>) {
+    if constexpr (sp.cls == ARG_CSTR) a.v.s = v;
+    else a.v.p = (const void *)v;
+  } else if constexpr (std::is_floating_point_v<D>) {
+    a.v.f = (double)v;
+    if constexpr (float_as_text(sp)) {
+      size_t n = float_text(room, sp, (double)v);
+      if (n != CRPRINTF_ARG_VALUE) { a.v.s = room; a.len = n; }
+    }
+  } else {
+    using U = typename std::conditional_t<std::is_enum_v<D>, std::underlying_type<D>, std::type_identity<D>>::type;
+    U x = (U)v;
+    if constexpr (std::is_signed_v<U>) a.v.i = (long long)x;
+    else a.v.u = (unsigned long long)x;
+
+    if constexpr (int_as_text(sp)) {
+      a.len = int_text(room, sp, x);
+      a.v.s = room;
+    } else if constexpr (char_as_text(sp)) {
+      char c = (char)(unsigned char)x;
+      a.len = lay_out(room, sp, {}, 0, { &c, 1 });
+      a.v.s = room;
+    }
+  }
+}
+
+template <class Format, class... Args, size_t... I>
+inline void pack_args(crprintf_arg *argv, char (*room)[TEXT_ROOM], std::index_sequence<I...>, Args &&...args) {
+  (pack_arg<Format, I>(argv[I], room[I], std::forward<Args>(args)), ...);
+}
+
+} // namespace detail
+
+// one compiled format; the program binds to the runtime the first time it
+// runs and is a single acquire load after that
+template <detail::fixed_string S>
+struct format {
+  static constexpr auto image = detail::make_image<S>();
+  static constexpr auto args = detail::make_args<S>();
+  static constexpr size_t slots = detail::compile(S.view()).slots.size();
+
+  static crprintf_compiled *get() {
+    crprintf_compiled *p = __atomic_load_n(&prog, __ATOMIC_ACQUIRE);
+    if (__builtin_expect(!p, 0)) p = crprintf_bind_image(&prog, storage, sizeof(storage), image.data(), image.size(), S.data);
+    return p;
+  }
+
+private:
+  static constinit inline crprintf_compiled *prog = nullptr;
+  alignas(64) static constinit inline unsigned char storage[CRPRINTF_BIND_STORAGE + slots * sizeof(void *)] = {};
+};
+
+template <class Format, class... Args>
+inline constexpr bool args_match = detail::args_match<Format, Args...>();
+
+template <class Format, class... Args>
+inline constexpr bool typed_args_match = detail::typed_args_match<Format, Args...>();
+
+#define CRP_CHECK_ARGS(Format, Args) \
+  static_assert(sizeof...(Args) == Format::args.size(), "crp: argument count doesn't match the format"); \
+  static_assert(args_match<Format, Args...>, "crp: argument type doesn't match its conversion")
+
+#define CRP_CHECK_TYPED(Format, Args) \
+  static_assert(sizeof...(Args) == Format::args.size(), "crp: argument count doesn't match the format"); \
+  static_assert(typed_args_match<Format, Args...>, "crp: argument type doesn't match its conversion")
+
+// the args are packed by type into an array the VM reads directly: no
+// va_list, and the conversions it would hand to snprintf arrive as text
+#define CRP_PACK_ARGS(Format, Args, argv) \
+  constexpr size_t count_ = sizeof...(Args) ? sizeof...(Args) : 1; \
+  crprintf_arg argv[count_]; \
+  char room_[count_][detail::TEXT_ROOM]; \
+  detail::pack_args<Format>(argv, room_, std::index_sequence_for<Args...>{}, std::forward<Args>(args)...)
+
+template <detail::fixed_string S, class... Args>
+inline int fprintf(FILE *stream, format<S>, Args &&...args) {
+  CRP_CHECK_ARGS(format<S>, Args);
+  return crprintf_exec(format<S>::get(), stream, std::forward<Args>(args)...);
+}
+
+template <detail::fixed_string S, class... Args>
+inline int printf(format<S> fmt, Args &&...args) {
+  return crp::fprintf(stdout, fmt, std::forward<Args>(args)...);
+}
+
+template <detail::fixed_string S, class... Args>
+inline int sprintf(char *buf, size_t size, format<S>, Args &&...args) {
+  CRP_CHECK_ARGS(format<S>, Args);
+  return crsprintf_inner(format<S>::get(), buf, size, std::forward<Args>(args)...);
+}
+
+template <detail::fixed_string S, class... Args>
+inline int print(FILE *stream, format<S>, Args &&...args) {
+  CRP_CHECK_TYPED(format<S>, Args);
+  CRP_PACK_ARGS(format<S>, Args, argv);
+  return crprintf_exec_args(format<S>::get(), stream, argv, sizeof...(Args));
+}
+
+template <detail::fixed_string S, class... Args>
+inline int print(format<S> fmt, Args &&...args) {
+  return crp::print(stdout, fmt, std::forward<Args>(args)...);
+}
+
+template <detail::fixed_string S, class... Args>
+inline int format_to(char *buf, size_t size, format<S>, Args &&...args) {
+  CRP_CHECK_TYPED(format<S>, Args);
+  CRP_PACK_ARGS(format<S>, Args, argv);
+  return crsprintf_args(format<S>::get(), buf, size, argv, sizeof...(Args));
+}
+
+#undef CRP_CHECK_ARGS
+#undef CRP_CHECK_TYPED
+#undef CRP_PACK_ARGS
+
+inline namespace literals {
+  template <detail::fixed_string S>
+  consteval format<S> operator""_crp() { return {}; }
+}
+
+} // namespace crp
+
+#endif
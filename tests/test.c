@@ -1,7 +1,11 @@
 #include <crprintf.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
 
 static int test_count = 0;
 static int pass_count = 0;
@@ -149,6 +153,191 @@ TEST(variables) {
   crprintf_set_color(true);
 }
 
+TEST(variables_without_limits) {
+  char name[48], value[300], fmt[64], buf[512];
+  crprintf_set_color(false);
+
+  memset(name, 'n', sizeof(name) - 1); name[sizeof(name) - 1] = '\0';
+  memset(value, 'v', sizeof(value) - 1); value[sizeof(value) - 1] = '\0';
+  crprintf_var(name, value);
+  
+  snprintf(fmt, sizeof(fmt), "{%s}", name);
+  crprintf_compiled *prog = crprintf_compile(fmt);
+  crsprintf_compiled(buf, sizeof(buf), NULL, prog);
+  ASSERT_STR_EQ(buf, value);
+  crprintf_compiled_free(prog);
+
+  for (int i = 0; i < 100; i++) {
+    snprintf(name, sizeof(name), "bulk%d", i);
+    snprintf(value, sizeof(value), "<%d>", i);
+    crprintf_var(name, value);
+  }
+  crsprintf(buf, sizeof(buf), "{bulk0}{bulk99}");
+  ASSERT_STR_EQ(buf, "<0><99>");
+
+  crsprintf(buf, sizeof(buf), "{let bulk0='a'}{bulk0}{let bulk0='b'}{bulk0}{bulk1}");
+  ASSERT_STR_EQ(buf, "ab<1>");
+
+  crprintf_set_color(true);
+}
+
+#define VAR_THREADS 4
+
+static int var_stop;
+
+static void *var_reader(void *arg) {
+  char buf[64];
+  crprintf_compiled **bad = arg;
+  
+  while (!__atomic_load_n(&var_stop, __ATOMIC_ACQUIRE)) {
+    crprintf_compiled *prog = crprintf_compile("{theme}");
+    crsprintf_compiled(buf, sizeof(buf), NULL, prog);
+    if (strncmp(buf, "theme", 5) != 0) *bad = prog;
+    else crprintf_compiled_free(prog);
+  }
+  return NULL;
+}
+
+TEST(bytecode_wide_operands) {
+  // pushes literal offsets and pad widths past one and two varint bytes
+  size_t n = 20000;
+  char *fmt = malloc(n + 512), *want = malloc(n + 512), *got = malloc(n + 512);
+  memset(fmt, 'a', n);
+  strcpy(fmt + n, "<pad=300>%d</pad>|b");
+  memset(want, 'a', n);
+  snprintf(want + n, 512, "%-300d|b", 42);
+  
+  crprintf_set_color(false);
+  crprintf_compiled *prog = crprintf_compile(fmt);
+  crsprintf_compiled(got, n + 512, NULL, prog, 42);
+  crprintf_compiled_free(prog);
+  crprintf_set_color(true);
+  
+  int ok = strcmp(got, want) == 0;
+  free(fmt); free(want); free(got);
+  ASSERT_EQ(ok, 1);
+}
+
+TEST(compiled_programs_are_packed) {
+  const char *fmt = "<bold><pad=12>{let who='world'}hello {who}</pad></bold> %d items\n";
+  crprintf_compiled *packed = crprintf_compile(fmt);
+  crprintf_compiled *tracked = crprintf_recompile(NULL, fmt);
+
+  size_t size = crprintf_compiled_size(packed);
+  ASSERT_EQ((uintptr_t)packed % 64, 0);
+  ASSERT_EQ(size % 64, 0);
+  ASSERT_EQ(size < crprintf_compiled_size(tracked), 1);
+
+  char a[128], b[128];
+  crsprintf_compiled(a, sizeof(a), NULL, packed, 3);
+  crsprintf_compiled(b, sizeof(b), NULL, tracked, 3);
+  ASSERT_STR_EQ(a, b);
+
+  crprintf_compiled_free(packed);
+  crprintf_compiled_free(tracked);
+}
+
+TEST(format_cache_reuses_programs) {
+  char buf[64];
+  crprintf_set_color(false);
+  crprintf_compiled *a = crprintf_cache_lookup("<bold>{cached}</bold> %d");
+  crprintf_compiled *b = crprintf_cache_lookup("<bold>{cached}</bold> %d");
+  ASSERT_EQ(a == b, 1);
+  crprintf_compiled_free(b);
+
+  crprintf_var("cached", "v2");
+  b = crprintf_cache_lookup("<bold>{cached}</bold> %d");
+  ASSERT_EQ(a == b, 0);
+  crsprintf_compiled(buf, sizeof(buf), NULL, b, 7);
+  ASSERT_STR_EQ(buf, "v2 7");
+  crsprintf_compiled(buf, sizeof(buf), NULL, a, 7);
+  ASSERT_STR_EQ(buf, "{cached} 7");
+  crprintf_compiled_free(a);
+  crprintf_compiled_free(b);
+
+  size_t cap = crprintf_get_cache_cap();
+  crprintf_set_cache_cap(0);
+  a = crprintf_cache_lookup("x");
+  b = crprintf_cache_lookup("x");
+  ASSERT_EQ(a == b, 0);
+  crprintf_compiled_free(a);
+  crprintf_compiled_free(b);
+  
+  // a budget this small keeps evicting, which must never change the output
+  crprintf_set_cache_cap(4096);
+  for (int i = 0; i < 64; i++) {
+    char fmt[32], want[32];
+    snprintf(fmt, sizeof(fmt), "<pad=%d>%%d</pad>|", i % 8 + 4);
+    snprintf(want, sizeof(want), "%-*d|", i % 8 + 4, i);
+    crsprintf_stateful(buf, sizeof(buf), NULL, fmt, i);
+    ASSERT_STR_EQ(buf, want);
+  }
+  
+  crprintf_set_cache_cap(cap);
+  crprintf_set_color(true);
+}
+
+TEST(compiled_programs_bind_vars_late) {
+  char buf[256];
+  crprintf_var("late", "one");
+  crprintf_var("late_style", "red");
+  crprintf_compiled *text = crprintf_compile("[{late}]");
+  crprintf_compiled *style = crprintf_compile("<$late_style>x</>");
+
+  crprintf_var("late", "<bold>two</bold>");
+  crprintf_var("late_style", "green+bold");
+  
+  crprintf_set_color(false);
+  crsprintf_compiled(buf, sizeof(buf), NULL, text);
+  ASSERT_STR_EQ(buf, "[two]");
+  
+  crprintf_set_color(true);
+  crsprintf_compiled(buf, sizeof(buf), NULL, style);
+  ASSERT_STR_EQ(buf, "\x1b[0m\x1b[1m\x1b[32mx\x1b[0m");
+
+  // a value that takes arguments is inlined, so the call site's count is fixed
+  // when it compiles; a late binding prints any conversion it gains as text
+  crprintf_var("late_fmt", "<red>%d</red>");
+  crprintf_compiled *inlined = crprintf_compile("[{late_fmt}] %s");
+  crprintf_var("late_fmt", "<red>%s %s</red>");
+  crprintf_var("late", "<bold>%d%%</bold>");
+
+  crprintf_set_color(false);
+  crsprintf_compiled(buf, sizeof(buf), NULL, inlined, 7, "x");
+  ASSERT_STR_EQ(buf, "[7] x");
+  crsprintf_compiled(buf, sizeof(buf), NULL, text);
+  ASSERT_STR_EQ(buf, "[%d%]");
+  crprintf_set_color(true);
+
+  crprintf_compiled_free(text);
+  crprintf_compiled_free(style);
+  crprintf_compiled_free(inlined);
+}
+
+TEST(concurrent_var_updates) {
+  pthread_t readers[VAR_THREADS];
+  crprintf_compiled *bad = NULL;
+  char value[32];
+  
+  crprintf_set_color(false);
+  crprintf_var("theme", "theme0");
+  __atomic_store_n(&var_stop, 0, __ATOMIC_RELEASE);
+  
+  for (int i = 0; i < VAR_THREADS; i++) pthread_create(&readers[i], NULL, var_reader, &bad);
+  for (int i = 1; i < 2000; i++) {
+    snprintf(value, sizeof(value), "theme%d", i);
+    crprintf_var("theme", value);
+  }
+  
+  __atomic_store_n(&var_stop, 1, __ATOMIC_RELEASE);
+  for (int i = 0; i < VAR_THREADS; i++) pthread_join(readers[i], NULL);
+  
+  ASSERT_EQ(bad == NULL, true);
+  crsprintf(value, sizeof(value), "{theme}");
+  ASSERT_STR_EQ(value, "theme1999");
+  crprintf_set_color(true);
+}
+
 TEST(buffer_overflow) {
   char buf[8];
   int n = crsprintf(buf, sizeof(buf), "hello world this is long");
@@ -158,6 +347,947 @@ TEST(buffer_overflow) {
   ASSERT_EQ(buf[5], ' ');
 }
 
+TEST(buffer_truncation_counts_padding) {
+  char buf[6];
+  crprintf_set_color(false);
+
+  int n = crsprintf(buf, sizeof(buf), "<rpad=10>hi</rpad>|<pad=4>%d</pad>|", 7);
+  ASSERT_EQ(n, 16);
+  ASSERT_STR_EQ(buf, "     ");
+
+  n = crsprintf(buf, sizeof(buf), "<rpad=8>%s</rpad>", "abc");
+  ASSERT_EQ(n, 8);
+  ASSERT_STR_EQ(buf, "     ");
+
+  n = crsprintf(buf, sizeof(buf), "abcdefgh<pad=6>%s</pad><rpad=3>%d</rpad>end", "xy", 12345);
+  ASSERT_EQ(n, 22);
+  ASSERT_STR_EQ(buf, "abcde");
+
+  n = crsprintf(NULL, 0, "hello %d", 5);
+  ASSERT_EQ(n, 7);
+
+  crprintf_set_color(true);
+}
+
+TEST(stream_output_reuses_arena) {
+  char big[3000], got[4096];
+  memset(big, 'x', sizeof(big) - 1);
+  big[sizeof(big) - 1] = '\0';
+  crprintf_set_color(false);
+
+  size_t cap = crprintf_get_arena_cap();
+  crprintf_set_arena_cap(1024);
+
+  FILE *f = tmpfile();
+  for (int i = 0; i < 100; i++) crfprintf(f, "<pad=4>%d</pad>|", i % 10);
+  ASSERT_EQ(crfprintf(f, "[%s]", big), 3001);
+  ASSERT_EQ(crfprintf(f, "<red>end</red>"), 3);
+
+  rewind(f);
+  size_t n = fread(got, 1, sizeof(got) - 1, f);
+  got[n] = '\0';
+  fclose(f);
+
+  ASSERT_EQ(n, 500 + 3001 + 3);
+  ASSERT_EQ(memcmp(got, "0   |1   |", 10), 0);
+  ASSERT_EQ(got[500], '[');
+  ASSERT_EQ(got[3500], ']');
+  ASSERT_STR_EQ(got + 3501, "end");
+
+  crprintf_set_arena_cap(cap);
+  crprintf_set_color(true);
+}
+
+#define RACE_THREADS 16
+
+static pthread_barrier_t race_barrier;
+static char race_out[RACE_THREADS][64];
+
+static void *race_worker(void *arg) {
+  int id = (int)(intptr_t)arg;
+  pthread_barrier_wait(&race_barrier);
+  crsprintf(race_out[id], sizeof(race_out[id]), "<bold>worker</bold> %d", id);
+  return NULL;
+}
+
+TEST(concurrent_first_compile) {
+  pthread_t threads[RACE_THREADS];
+  crprintf_set_color(false);
+  pthread_barrier_init(&race_barrier, NULL, RACE_THREADS);
+
+  for (int i = 0; i < RACE_THREADS; i++)
+    pthread_create(&threads[i], NULL, race_worker, (void *)(intptr_t)i);
+  for (int i = 0; i < RACE_THREADS; i++) pthread_join(threads[i], NULL);
+  pthread_barrier_destroy(&race_barrier);
+
+  for (int i = 0; i < RACE_THREADS; i++) {
+    char want[64];
+    snprintf(want, sizeof(want), "worker %d", i);
+    ASSERT_STR_EQ(race_out[i], want);
+  }
+
+  crprintf_set_color(true);
+}
+
+static const char *style_cases[] = {
+  "<bold+red>hi</> there",
+  "<bold><red>a</red>b</bold>c",
+  "<dim_cyan>x</dim_cyan><reset/>y",
+  "<#ff8800>o<bg_#123>p</></>q",
+  "<ul>%d</ul> <strike+invert>%s</>", 
+  "<red><green><blue><yellow><cyan><magenta><white><black><gray>deep</></></></></></></></></></>",
+  "</>unbalanced</red><i>it",
+};
+
+TEST(folded_styles_match_runtime) {
+  char folded[512], runtime[512];
+  crprintf_state *green = crprintf_state_new();
+  crsprintf_stateful(folded, sizeof(folded), green, "<green>");
+
+  for (size_t i = 0; i < sizeof(style_cases) / sizeof(style_cases[0]); i++) {
+    crprintf_compiled *prog = crprintf_compile(style_cases[i]);
+    crprintf_state *fresh = crprintf_state_new();
+
+    crsprintf_compiled(folded, sizeof(folded), NULL, prog, 7, "s");
+    crsprintf_stateful(runtime, sizeof(runtime), fresh, style_cases[i], 7, "s");
+    ASSERT_STR_EQ(folded, runtime);
+
+    crprintf_state *a = crprintf_state_clone(green);
+    crprintf_state *b = crprintf_state_clone(green);
+    crsprintf_compiled(folded, sizeof(folded), a, prog, 7, "s");
+    crsprintf_stateful(runtime, sizeof(runtime), b, style_cases[i], 7, "s");
+    ASSERT_STR_EQ(folded, runtime);
+    ASSERT_EQ(crprintf_state_eq(a, b), true);
+
+    crprintf_state_free(a);
+    crprintf_state_free(b);
+    crprintf_state_free(fresh);
+    crprintf_compiled_free(prog);
+  }
+
+  crprintf_state_free(green);
+}
+
+TEST(constant_program_output) {
+  char buf[64];
+  crprintf_compiled *prog = crprintf_compile("<bold>up</bold><pad=4>x</pad>!");
+
+  crsprintf_compiled(buf, sizeof(buf), NULL, prog);
+  ASSERT_STR_EQ(buf, "\x1b[0m\x1b[1mup\x1b[0mx   !");
+
+  crprintf_set_color(false);
+  ASSERT_EQ(crsprintf_compiled(buf, 4, NULL, prog), 7);
+  ASSERT_STR_EQ(buf, "upx");
+  crprintf_set_color(true);
+
+  crprintf_compiled_free(prog);
+}
+
+static const char *peephole_cases[] = {
+  "a<<b%%c{'x'}d>>e",
+  "<bold><red><ul>x</ul></red></bold>",
+  "<red></red><blue>%d</blue>",
+  "<red+blue+green>x<reset/><reset/></>y",
+  "<bold></bold></><green>tail",
+  "<pad=6><cyan>%d</cyan></pad>|",
+};
+
+// keeps only what a terminal would act on: in each run of back-to-back escapes,
+// everything before the last reset is overwritten
+static void squash_escapes(char *s) {
+  char *w = s;
+  while (*s) {
+    if (*s != '\x1b') { *w++ = *s++; continue; }
+    char *last_reset = s;
+    while (*s == '\x1b') {
+      if (strncmp(s, "\x1b[0m", 4) == 0) last_reset = s;
+      while (*s && *s++ != 'm');
+    }
+    memmove(w, last_reset, (size_t)(s - last_reset));
+    w += s - last_reset;
+  }
+  *w = '\0';
+}
+
+TEST(native_formats_match_snprintf) {
+  static const char *int_specs[] = {
+    "%d", "%i", "%5d", "%-5d|", "%05d", "%.3d", "%8.3d", "%-08d|", "%.0d|", "%u", 
+    "%x", "%X", "%08x", "%#x", "%+d", "% d", "%hd", "%.0x|", "%12.4X",
+  };
+  static const int int_vals[] = { 0, 7, -42, 99, 100, 65535, -2147483647 - 1, 2147483647 };
+  
+  char got[128], want[128];
+  crprintf_set_color(false);
+  
+  for (size_t i = 0; i < sizeof(int_specs) / sizeof(*int_specs); i++) {
+    crprintf_compiled *prog = crprintf_compile(int_specs[i]);
+    for (size_t j = 0; j < sizeof(int_vals) / sizeof(*int_vals); j++) {
+      int gn = crsprintf_compiled(got, sizeof(got), NULL, prog, int_vals[j]);
+      int wn = snprintf(want, sizeof(want), int_specs[i], int_vals[j]);
+      ASSERT_EQ(gn, wn);
+      ASSERT_STR_EQ(got, want);
+    }
+    crprintf_compiled_free(prog);
+  }
+
+  static const char *str_specs[] = { "%s", "%8s|", "%-8s|", "%.2s", "%6.3s|", "%.0s|" };
+  static const char *str_vals[] = { "", "hi", "hello world" };
+  
+  for (size_t i = 0; i < sizeof(str_specs) / sizeof(*str_specs); i++) {
+    crprintf_compiled *prog = crprintf_compile(str_specs[i]);
+    for (size_t j = 0; j < sizeof(str_vals) / sizeof(*str_vals); j++) {
+      crsprintf_compiled(got, sizeof(got), NULL, prog, str_vals[j]);
+      snprintf(want, sizeof(want), str_specs[i], str_vals[j]);
+      ASSERT_STR_EQ(got, want);
+    }
+    crprintf_compiled_free(prog);
+  }
+
+  crsprintf(got, sizeof(got), "%ld %lld %zu %jd %lx", -5L, -9000000000LL, (size_t)77, (intmax_t)-3, 0xbeefUL);
+  ASSERT_STR_EQ(got, "-5 -9000000000 77 -3 beef");
+  
+  crsprintf(got, sizeof(got), "<pad=6>%d</pad>|%3s|", 42, "ab");
+  ASSERT_STR_EQ(got, "42    | ab|");
+
+  crprintf_set_color(true);
+}
+
+TEST(format_args_from_descriptor) {
+  char got[512], want[512];
+  crprintf_set_color(false);
+  
+  crsprintf(got, sizeof(got), "[%*d|%-*.*s|%+.2f|%c]", 6, -17, 5, 2, "abc", 2.5, 'z');
+  snprintf(want, sizeof(want), "[%*d|%-*.*s|%+.2f|%c]", 6, -17, 5, 2, "abc", 2.5, 'z');
+  ASSERT_STR_EQ(got, want);
+
+  int n = crsprintf(got, sizeof(got), "%300.1f|%s", 1.25, "end");
+  snprintf(want, sizeof(want), "%300.1f|%s", 1.25, "end");
+  ASSERT_EQ(n, 304);
+  ASSERT_STR_EQ(got, want);
+
+  n = crsprintf(got, 8, "ab%+5d%s", 42, "tail");
+  ASSERT_EQ(n, 11);
+  ASSERT_STR_EQ(got, "ab  +42");
+
+  crprintf_set_color(true);
+}
+
+TEST(typed_args_read_without_va_list) {
+  char got[128], want[128];
+  crprintf_set_color(false);
+
+  crprintf_compiled *prog = crprintf_compile("[%*d|%-*.*s|%+.2f|%lu|%x|%s]");
+  crprintf_arg args[] = {
+    { .v.i = 6, .len = CRPRINTF_ARG_VALUE }, { .v.i = -17, .len = CRPRINTF_ARG_VALUE },
+    { .v.i = 5, .len = CRPRINTF_ARG_VALUE }, { .v.i = 2, .len = CRPRINTF_ARG_VALUE },
+    { .v.s = "abc", .len = CRPRINTF_ARG_VALUE }, { .v.f = 2.5, .len = CRPRINTF_ARG_VALUE },
+    { .v.u = 3000000000UL, .len = CRPRINTF_ARG_VALUE }, { .v.i = -1, .len = CRPRINTF_ARG_VALUE },
+    { .v.s = "sized-not-terminated", .len = 5 },
+  };
+  int n = crsprintf_args(prog, got, sizeof(got), args, 9);
+  int wn = snprintf(want, sizeof(want), "[%*d|%-*.*s|%+.2f|%lu|%x|%s]", 6, -17, 5, 2, "abc", 2.5, 3000000000UL, -1, "sized");
+  ASSERT_EQ(n, wn);
+  ASSERT_STR_EQ(got, want);
+
+  // a sized value for a generic spec is the finished conversion
+  args[5] = (crprintf_arg){ .v.s = "+2.50", .len = 5 };
+  crsprintf_args(prog, got, sizeof(got), args, 9);
+  ASSERT_STR_EQ(got, want);
+
+  // missing arguments read as zero rather than past the array
+  n = crsprintf_args(prog, got, sizeof(got), args, 4);
+  ASSERT_STR_EQ(got, "[   -17|     |+0.00|0|0|(null)]");
+  crprintf_compiled_free(prog);
+
+  crprintf_set_color(true);
+}
+
+typedef struct {
+  const char *name;
+  int width;
+  int count;
+  double ratio;
+  size_t bytes;
+} batch_row_t;
+
+static const crprintf_field batch_fields[] = {
+  CRPRINTF_FIELD(batch_row_t, name, CRPRINTF_CSTR),
+  CRPRINTF_FIELD(batch_row_t, width, CRPRINTF_INT),
+  CRPRINTF_FIELD(batch_row_t, count, CRPRINTF_INT),
+  CRPRINTF_FIELD(batch_row_t, ratio, CRPRINTF_DOUBLE),
+  CRPRINTF_FIELD(batch_row_t, bytes, CRPRINTF_SIZE),
+};
+
+static char *render_batch(crprintf_compiled *prog, const void *rows, size_t n, const crprintf_record_desc *desc, int *ret) {
+  char *out = NULL;
+  size_t len = 0;
+  FILE *mem = open_memstream(&out, &len);
+  *ret = crprintf_exec_batch(prog, mem, rows, n, desc);
+  fclose(mem);
+  return out;
+}
+
+TEST(batch_matches_per_row) {
+  static const batch_row_t rows[] = {
+    { "alpha", 3, 42, 0.5, 4096 },
+    { "beta", 5, -7, 12.25, 0 },
+    { "\xe6\x97\xa5\xe6\x9c\xac", 1, 100000, -1.0, (size_t)1 << 40 },
+  };
+  const char *fmt = "<green><pad=8>%s</pad></green>|<rpad=6>%*d</rpad> <bold>%.2f</bold> %zu\n";
+  crprintf_record_desc desc = { sizeof(batch_row_t), 5, batch_fields };
+  crprintf_compiled *prog = crprintf_compile(fmt);
+
+  for (int plain = 0; plain < 2; plain++) {
+    crprintf_set_color(!plain);
+    char want[1024] = "", row[256];
+    for (size_t i = 0; i < 3; i++) {
+      crsprintf_compiled(row, sizeof(row), NULL, prog, rows[i].name, rows[i].width, rows[i].count, rows[i].ratio, rows[i].bytes);
+      strcat(want, row);
+    }
+
+    int n;
+    char *got = render_batch(prog, rows, 3, &desc, &n);
+    ASSERT_STR_EQ(got, want);
+    ASSERT_EQ(n, (int)strlen(want));
+    free(got);
+  }
+
+  // a field list that disagrees with the conversions writes nothing
+  crprintf_field swapped[5];
+  memcpy(swapped, batch_fields, sizeof(swapped));
+  swapped[3].type = CRPRINTF_INT;
+  crprintf_record_desc bad = { sizeof(batch_row_t), 5, swapped };
+  int n;
+  char *got = render_batch(prog, rows, 3, &bad, &n);
+  ASSERT_EQ(n, -1);
+  ASSERT_STR_EQ(got, "");
+  free(got);
+
+  bad.count = 4;
+  ASSERT_EQ(crprintf_exec_batch(prog, stdout, rows, 3, &bad), -1);
+  crprintf_compiled_free(prog);
+}
+
+TEST(batch_carries_style_across_rows) {
+  static const int counts[] = { 1, 2, 3 };
+  static const crprintf_field field = { 0, CRPRINTF_INT };
+  crprintf_record_desc desc = { sizeof(int), 1, &field };
+  crprintf_set_color(true);
+
+  // the unclosed tag is emitted once, not re-established at every row
+  crprintf_compiled *prog = crprintf_compile("<dim>%d ");
+  int n;
+  char *got = render_batch(prog, counts, 3, &desc, &n);
+  ASSERT_STR_EQ(got, "\x1b[0m\x1b[2m1 2 3 ");
+  free(got);
+  crprintf_compiled_free(prog);
+
+  prog = crprintf_compile("<red>%d</red>,");
+  got = render_batch(prog, counts, 3, &desc, &n);
+  ASSERT_STR_EQ(got, "\x1b[0m\x1b[31m1\x1b[0m,\x1b[0m\x1b[31m2\x1b[0m,\x1b[0m\x1b[31m3\x1b[0m,");
+  free(got);
+  crprintf_compiled_free(prog);
+
+  prog = crprintf_compile("<bold>%d<reset/><reset/>");
+  got = render_batch(prog, counts, 2, &desc, &n);
+  ASSERT_STR_EQ(got, "\x1b[0m\x1b[1m1\x1b[0m\x1b[0m\x1b[1m2\x1b[0m");
+  free(got);
+  crprintf_compiled_free(prog);
+}
+
+static char *render_table(crprintf_compiled *prog, const void *rows, size_t n, const crprintf_record_desc *desc, crprintf_column *cols, size_t ncols, int *ret) {
+  char *out = NULL;
+  size_t len = 0;
+  FILE *mem = open_memstream(&out, &len);
+  *ret = crprintf_exec_table(prog, mem, rows, n, desc, cols, ncols);
+  fclose(mem);
+  return out;
+}
+
+TEST(batch_counts_conversions_in_vars) {
+  static const batch_row_t rows[] = {
+    { "alpha", 0, 42, 0, 0 },
+    { "be", 0, -7, 0, 0 },
+  };
+  const crprintf_field fields[] = { batch_fields[2], batch_fields[0] };
+  crprintf_record_desc desc = { sizeof(batch_row_t), 2, fields };
+  crprintf_record_desc short_desc = { sizeof(batch_row_t), 1, batch_fields };
+  crprintf_set_color(false);
+
+  // the variable's %d is part of the call site, so it needs a field of its own
+  crprintf_var("batch_cell", "<red>%d</red>");
+  crprintf_compiled *prog = crprintf_compile("[{batch_cell}] %s\n");
+  int n;
+  char *got = render_batch(prog, rows, 2, &desc, &n);
+  ASSERT_STR_EQ(got, "[42] alpha\n[-7] be\n");
+  free(got);
+  ASSERT_EQ(crprintf_exec_batch(prog, stdout, rows, 2, &short_desc), -1);
+  crprintf_compiled_free(prog);
+
+  prog = crprintf_compile("[<rpad=0>{batch_cell}</rpad>] %s\n");
+  got = render_table(prog, rows, 2, &desc, NULL, 0, &n);
+  ASSERT_STR_EQ(got, "[42] alpha\n[-7] be\n");
+  free(got);
+  ASSERT_EQ(crprintf_exec_table(prog, stdout, rows, 2, &short_desc, NULL, 0), -1);
+  crprintf_compiled_free(prog);
+  crprintf_set_color(true);
+}
+
+TEST(batch_passes_wide_strings) {
+  typedef struct { const wchar_t *name; int count; } wide_row_t;
+  static const wide_row_t rows[] = { { L"alpha", 42 }, { L"be", -7 } };
+  const crprintf_field fields[] = {
+    CRPRINTF_FIELD(wide_row_t, name, CRPRINTF_WSTR),
+    CRPRINTF_FIELD(wide_row_t, count, CRPRINTF_INT),
+  };
+  const crprintf_field narrow[] = {
+    CRPRINTF_FIELD(wide_row_t, name, CRPRINTF_CSTR),
+    CRPRINTF_FIELD(wide_row_t, count, CRPRINTF_INT),
+  };
+  crprintf_record_desc desc = { sizeof(wide_row_t), 2, fields };
+  crprintf_record_desc narrow_desc = { sizeof(wide_row_t), 2, narrow };
+  crprintf_set_color(false);
+
+  crprintf_compiled *prog = crprintf_compile("%ls=%d\n");
+  int n;
+  char *got = render_batch(prog, rows, 2, &desc, &n);
+  ASSERT_STR_EQ(got, "alpha=42\nbe=-7\n");
+  free(got);
+  ASSERT_EQ(crprintf_exec_batch(prog, stdout, rows, 2, &narrow_desc), -1);
+  crprintf_compiled_free(prog);
+
+  prog = crprintf_compile("<pad=0>%ls</pad>|%d\n");
+  crprintf_column cols[1] = { { 0, 0 } };
+  got = render_table(prog, rows, 2, &desc, cols, 1, &n);
+  ASSERT_STR_EQ(got, "alpha|42\nbe   |-7\n");
+  ASSERT_EQ(cols[0].width, 5);
+  free(got);
+  ASSERT_EQ(crprintf_exec_table(prog, stdout, rows, 2, &narrow_desc, NULL, 0), -1);
+  crprintf_compiled_free(prog);
+  crprintf_set_color(true);
+}
+
+TEST(table_sizes_columns_to_widest_cell) {
+  static const batch_row_t rows[] = {
+    { "alpha", 0, 42, 0, 0 },
+    { "beta", 0, -7, 0, 0 },
+    { "\xe6\x97\xa5\xe6\x9c\xac", 0, 100000, 0, 0 },
+  };
+  const crprintf_field fields[] = { batch_fields[0], batch_fields[2] };
+  crprintf_record_desc desc = { sizeof(batch_row_t), 2, fields };
+  crprintf_set_color(false);
+
+  // the span without a conversion keeps its width and is not a column
+  crprintf_compiled *prog = crprintf_compile("<pad=3>%s</pad>|<rpad=0>%d</rpad>|<pad=4>-</pad>|\n");
+  crprintf_column cols[3] = { { 0, 9 }, { 0, 9 }, { 0, 9 } };
+  int n;
+  char *got = render_table(prog, rows, 3, &desc, cols, 3, &n);
+  const char *want =
+    "alpha|    42|-   |\n"
+    "beta |    -7|-   |\n"
+    "\xe6\x97\xa5\xe6\x9c\xac |100000|-   |\n";
+  ASSERT_STR_EQ(got, want);
+  ASSERT_EQ(n, (int)strlen(want));
+  ASSERT_EQ(cols[0].width, 5);
+  ASSERT_EQ(cols[1].width, 6);
+  ASSERT_EQ(cols[2].width, 0);
+  free(got);
+
+  // N is the least width a column gets
+  crprintf_compiled_free(prog);
+  prog = crprintf_compile("<pad=7>%s</pad>|<rpad=0>%d</rpad>|\n");
+  got = render_table(prog, rows, 2, &desc, NULL, 0, &n);
+  ASSERT_STR_EQ(got, "alpha  |42|\nbeta   |-7|\n");
+  free(got);
+
+  ASSERT_EQ(crprintf_exec_table(prog, stdout, rows, 0, &desc, cols, 2), 0);
+  desc.count = 1;
+  ASSERT_EQ(crprintf_exec_table(prog, stdout, rows, 3, &desc, cols, 2), -1);
+  crprintf_compiled_free(prog);
+}
+
+TEST(table_measures_long_cells) {
+  static const batch_row_t rows[] = {
+    { "alpha", 0, 0, 0, 0 },
+    { "\xe6\x97\xa5\xe6\x9c\xac", 0, 0, 0, 0 },
+  };
+  crprintf_record_desc desc = { sizeof(batch_row_t), 1, batch_fields };
+  crprintf_set_color(false);
+
+  // past the measure pass's stack buffer the cell is measured from its argument:
+  // printf pads by bytes, so the two wide characters make 298 columns and get 2 more
+  crprintf_compiled *prog = crprintf_compile("<pad=0>%-300s</pad>|\n");
+  crprintf_column cols[1] = { { 0, 0 } };
+  int n;
+  char *got = render_table(prog, rows, 2, &desc, cols, 1, &n);
+  ASSERT_EQ(cols[0].width, 300);
+  ASSERT_EQ(n, 302 + 304);
+  ASSERT_EQ(strncmp(got + 302, "\xe6\x97\xa5\xe6\x9c\xac ", 7), 0);
+  ASSERT_STR_EQ(got + 302 + 302, "|\n");
+  free(got);
+  crprintf_compiled_free(prog);
+}
+
+TEST(table_caps_clip_cells) {
+  static const batch_row_t rows[] = {
+    { "alpha", 0, 0, 0, 0 },
+    { "be", 0, 0, 0, 0 },
+    { "\xe6\x97\xa5\xe6\x9c\xac", 0, 0, 0, 0 },
+  };
+  crprintf_record_desc desc = { sizeof(batch_row_t), 1, batch_fields };
+  crprintf_set_color(true);
+
+  // a cut cell still closes its style; a wide character that would cross the cap is dropped
+  crprintf_compiled *prog = crprintf_compile("<pad=0><red>%s</red></pad>|\n");
+  crprintf_column cols[1] = { { 3, 0 } };
+  int n;
+  char *got = render_table(prog, rows, 3, &desc, cols, 1, &n);
+  ASSERT_STR_EQ(got,
+    "\x1b[0m\x1b[31malp\x1b[0m|\n"
+    "\x1b[0m\x1b[31mbe\x1b[0m |\n"
+    "\x1b[0m\x1b[31m\xe6\x97\xa5\x1b[0m |\n");
+  ASSERT_EQ(cols[0].width, 3);
+  free(got);
+  crprintf_compiled_free(prog);
+
+  crprintf_set_color(false);
+  prog = crprintf_compile("[<rpad=0>%s</rpad>]\n");
+  cols[0].max = 4;
+  got = render_table(prog, rows, 2, &desc, cols, 1, &n);
+  ASSERT_STR_EQ(got, "[alph]\n[  be]\n");
+  free(got);
+  crprintf_compiled_free(prog);
+}
+
+#define ASYNC_THREADS 8
+#define ASYNC_LINES   500
+
+static crprintf_async *async_sink;
+
+static void *async_worker(void *arg) {
+  int id = (int)(intptr_t)arg;
+  for (int i = 0; i < ASYNC_LINES; i++) craprintf(async_sink, "<bold>t%d</bold> line %d\n", id, i);
+  return NULL;
+}
+
+// drains the read end of a pipe until every writer is gone
+typedef struct {
+  int fd;
+  char *data;
+  size_t len;
+} pipe_drain_t;
+
+static void *pipe_reader(void *arg) {
+  pipe_drain_t *p = arg;
+  size_t cap = 1 << 16;
+  p->data = malloc(cap);
+  for (ssize_t n; (n = read(p->fd, p->data + p->len, cap - p->len - 1)) > 0;) {
+    p->len += (size_t)n;
+    if (cap - p->len < 4096) p->data = realloc(p->data, cap *= 2);
+  }
+  p->data[p->len] = '\0';
+  return NULL;
+}
+
+TEST(async_sink_keeps_lines_whole) {
+  FILE *tmp = tmpfile();
+  crprintf_set_color(false);
+  async_sink = crprintf_async_open(fileno(tmp), 4096, CRPRINTF_ASYNC_BLOCK);
+
+  pthread_t threads[ASYNC_THREADS];
+  for (int i = 0; i < ASYNC_THREADS; i++)
+    pthread_create(&threads[i], NULL, async_worker, (void *)(intptr_t)i);
+  for (int i = 0; i < ASYNC_THREADS; i++) pthread_join(threads[i], NULL);
+
+  ASSERT_EQ(crprintf_async_flush(async_sink), 0);
+  ASSERT_EQ(crprintf_async_dropped(async_sink), 0);
+  ASSERT_EQ(crprintf_async_close(async_sink), 0);
+
+  // every thread's lines arrive whole and in the order it printed them
+  int next[ASYNC_THREADS] = {0};
+  char line[64];
+  rewind(tmp);
+  while (fgets(line, sizeof(line), tmp)) {
+    int id, i;
+    ASSERT_EQ(sscanf(line, "t%d line %d\n", &id, &i), 2);
+    ASSERT_EQ(i, next[id]);
+    next[id]++;
+  }
+  for (int i = 0; i < ASYNC_THREADS; i++) ASSERT_EQ(next[i], ASYNC_LINES);
+
+  fclose(tmp);
+  crprintf_set_color(true);
+}
+
+TEST(async_sink_overflow_policies) {
+  crprintf_set_color(false);
+  const int lines = 20000;
+
+  // nobody reads the pipe while printing, so the writer stalls and the ring fills
+  for (int policy = CRPRINTF_ASYNC_DROP; policy <= CRPRINTF_ASYNC_COUNT; policy++) {
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    crprintf_async *sink = crprintf_async_open(fds[1], 4096, (crprintf_async_policy)policy);
+
+    int published = 0;
+    for (int i = 0; i < lines; i++)
+      if (craprintf(sink, "%05d <pad=90>padding</pad>\n", i) > 0) published++;
+    ASSERT_EQ(published + (int)crprintf_async_dropped(sink), lines);
+    ASSERT_EQ(published < lines, 1);
+
+    pipe_drain_t drain = { fds[0], NULL, 0 };
+    pthread_t reader;
+    pthread_create(&reader, NULL, pipe_reader, &drain);
+    ASSERT_EQ(crprintf_async_close(sink), 0);
+    close(fds[1]);
+    pthread_join(reader, NULL);
+    close(fds[0]);
+
+    // lines that made it are whole; COUNT says how many are missing in between
+    int got = 0, noted = 0, prev = -1;
+    for (char *at = drain.data, *nl; (nl = strchr(at, '\n')); at = nl + 1) {
+      int i, n;
+      if (sscanf(at, "crprintf: %d lines dropped", &n) == 1) { noted += n; continue; }
+      ASSERT_EQ(sscanf(at, "%05d", &i), 1);
+      ASSERT_EQ(nl - at, 96);
+      ASSERT_EQ(i > prev, 1);
+      prev = i;
+      got++;
+    }
+    ASSERT_EQ(got, published);
+    ASSERT_EQ(noted, policy == CRPRINTF_ASYNC_COUNT ? lines - published : 0);
+    free(drain.data);
+  }
+
+  // blocking loses nothing
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  pipe_drain_t drain = { fds[0], NULL, 0 };
+  pthread_t reader;
+  pthread_create(&reader, NULL, pipe_reader, &drain);
+
+  crprintf_async *sink = crprintf_async_open(fds[1], 4096, CRPRINTF_ASYNC_BLOCK);
+  for (int i = 0; i < lines; i++) ASSERT_EQ(craprintf(sink, "%05d <pad=90>padding</pad>\n", i), 97);
+  ASSERT_EQ(crprintf_async_close(sink), 0);
+  close(fds[1]);
+  pthread_join(reader, NULL);
+  close(fds[0]);
+
+  ASSERT_EQ(drain.len, (size_t)lines * 97);
+  ASSERT_EQ(strncmp(drain.data + (lines - 1) * 97, "19999 padding", 13), 0);
+  free(drain.data);
+  crprintf_set_color(true);
+}
+
+static char *read_all(FILE *f) {
+  long n = ftell(f);
+  char *data = malloc((size_t)n + 1);
+  rewind(f);
+  data[fread(data, 1, (size_t)n, f)] = '\0';
+  return data;
+}
+
+TEST(async_defer_matches_rendered) {
+  FILE *tmp = tmpfile();
+  crprintf_compiled *mixed = crprintf_compile("<bold>%d</bold> <pad=8>%s</pad>|%.2f %zu %lld %c %ls\n");
+  crprintf_compiled *stars = crprintf_compile("[%*.*s] [%.3s] [%-*d]\n");
+  crprintf_compiled *plain = crprintf_compile("rendered %d\n");
+  crprintf_async *sink = crprintf_async_open(fileno(tmp), 4096, CRPRINTF_ASYNC_BLOCK);
+
+  // a small ring wraps many times; deferred and rendered lines keep their order
+  char expect[1 << 16] = "", line[256];
+  size_t len = 0;
+  const char unterminated[4] = { 'a', 'b', 'c', 'd' };
+  for (int i = 0; i < 300; i++) {
+    const char *name = (i % 3) ? "item" : "";
+    ASSERT_EQ(crprintf_async_defer(sink, mixed, i, name, i / 7.0, (size_t)i * 4096, -5ll * i, 'a' + i % 26, L"wide"), 0);
+    len += (size_t)crsprintf_inner(mixed, line, sizeof(line), i, name, i / 7.0, (size_t)i * 4096, -5ll * i, 'a' + i % 26, L"wide");
+    strcat(expect, line);
+
+    ASSERT_EQ(crprintf_async_defer(sink, stars, 6, i % 5, "precision", unterminated, 4, i), 0);
+    len += (size_t)crsprintf_inner(stars, line, sizeof(line), 6, i % 5, "precision", unterminated, 4, i);
+    strcat(expect, line);
+
+    if (i % 10) continue;
+    ASSERT_EQ(crprintf_async_exec(sink, plain, i) > 0, 1);
+    len += (size_t)crsprintf_inner(plain, line, sizeof(line), i);
+    strcat(expect, line);
+  }
+  ASSERT_EQ(crprintf_async_close(sink), 0);
+
+  char *got = read_all(tmp);
+  ASSERT_EQ(strlen(got), len);
+  ASSERT_STR_EQ(got, expect);
+  free(got);
+  fclose(tmp);
+  crprintf_compiled_free(mixed);
+  crprintf_compiled_free(stars);
+  crprintf_compiled_free(plain);
+}
+
+TEST(async_defer_copies_arguments) {
+  FILE *tmp = tmpfile();
+  crprintf_set_color(false);
+  crprintf_compiled *prog = crprintf_compile("<pad=6>%s</pad>|\n");
+  crprintf_compiled *many = crprintf_compile("%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d\n");
+  crprintf_compiled *count = crprintf_compile("abc%n\n");
+  crprintf_async *sink = crprintf_async_open(fileno(tmp), 4096, CRPRINTF_ASYNC_BLOCK);
+
+  // the caller may reuse or free its strings as soon as the call returns
+  char *name = strdup("first");
+  ASSERT_EQ(crprintf_async_defer(sink, prog, name), 0);
+  strcpy(name, "later");
+  ASSERT_EQ(crprintf_async_defer(sink, prog, name), 0);
+  free(name);
+  ASSERT_EQ(crprintf_async_defer(sink, prog, (char *)NULL), 0);
+
+  // a variable's conversion takes its argument where the variable is used
+  crprintf_var("defer_cell", "<red>%d</red>");
+  crprintf_compiled *var = crprintf_compile("[{defer_cell}] %s\n");
+  ASSERT_EQ(crprintf_async_defer(sink, var, 7, "deferred"), 0);
+
+  // past 16 arguments, or with %n, the line is rendered on the spot
+  ASSERT_EQ(crprintf_async_defer(sink, many, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 1, 2, 3, 4, 5, 6, 7), 18);
+  int n = 0;
+  ASSERT_EQ(crprintf_async_defer(sink, count, &n), 4);
+  ASSERT_EQ(crprintf_async_close(sink), 0);
+
+  char *got = read_all(tmp);
+  ASSERT_STR_EQ(got, "first |\nlater |\n(null)|\n[7] deferred\n12345678901234567\nabc\n");
+  free(got);
+  fclose(tmp);
+  crprintf_compiled_free(prog);
+  crprintf_compiled_free(many);
+  crprintf_compiled_free(count);
+  crprintf_compiled_free(var);
+  crprintf_set_color(true);
+}
+
+TEST(trace_log_replays_records) {
+  crprintf_set_color(false);
+  const char *fmts[] = {
+    "<bold>%s</bold> took <cyan>%.3f</cyan>ms [%d]\n",
+    "<pad=6>%zu</pad>|%.*s|%lld|%ls|%c\n",
+    "static <red>line</red>\n",
+  };
+  crprintf_compiled *progs[3];
+  for (int i = 0; i < 3; i++) progs[i] = crprintf_compile(fmts[i]);
+
+  char *data = NULL;
+  size_t size = 0;
+  FILE *mem = open_memstream(&data, &size);
+  crprintf_trace *log = crprintf_trace_open(mem, progs, 3);
+  ASSERT_EQ(log != NULL, 1);
+
+  char expect[1 << 16] = "", line[256];
+  for (int i = 0; i < 100; i++) {
+    const char *name = (i == 7) ? NULL : "request";
+    ASSERT_EQ(crprintf_trace_write(log, 0, name, i / 3.0, i) > 0, 1);
+    crsprintf_inner(progs[0], line, sizeof(line), name, i / 3.0, i);
+    strcat(expect, line);
+    ASSERT_EQ(crprintf_trace_write(log, 1, (size_t)i * 1000, i % 7, "abcdef", -7ll * i, L"wide", 'a' + i % 26) > 0, 1);
+    crsprintf_inner(progs[1], line, sizeof(line), (size_t)i * 1000, i % 7, "abcdef", -7ll * i, L"wide", 'a' + i % 26);
+    strcat(expect, line);
+    ASSERT_EQ(crprintf_trace_write(log, 2) > 0, 1);
+    crsprintf_inner(progs[2], line, sizeof(line));
+    strcat(expect, line);
+  }
+  ASSERT_EQ(crprintf_trace_write(log, 3), -1);
+  ASSERT_EQ(crprintf_trace_close(log), 0);
+  fclose(mem);
+
+  char *out = NULL;
+  size_t out_len = 0;
+  mem = open_memstream(&out, &out_len);
+  ASSERT_EQ(crprintf_trace_decode(data, size, mem, false), 300);
+  fclose(mem);
+  ASSERT_STR_EQ(out, expect);
+  free(out);
+
+  // a torn last record costs only that record
+  mem = open_memstream(&out, &out_len);
+  ASSERT_EQ(crprintf_trace_decode(data, size - 1, mem, false), -1);
+  fclose(mem);
+  expect[strlen(expect) - strlen("static line\n")] = '\0';
+  ASSERT_STR_EQ(out, expect);
+  free(out);
+  free(data);
+
+  // programs the log couldn't replay are refused up front
+  crprintf_var("trace_var", "v");
+  crprintf_compiled *bad[] = { crprintf_compile("%d%n\n"), crprintf_compile("{trace_var} %d\n") };
+  mem = open_memstream(&data, &size);
+  ASSERT_EQ(crprintf_trace_open(mem, &bad[0], 1) == NULL, 1);
+  ASSERT_EQ(crprintf_trace_open(mem, &bad[1], 1) == NULL, 1);
+  fclose(mem);
+  free(data);
+
+  for (int i = 0; i < 2; i++) crprintf_compiled_free(bad[i]);
+  for (int i = 0; i < 3; i++) crprintf_compiled_free(progs[i]);
+  crprintf_set_color(true);
+}
+
+TEST(nested_pads_track_columns) {
+  char buf[128];
+  crprintf_set_color(false);
+
+  crsprintf(buf, sizeof(buf), "[<pad=12><rpad=5>%d</rpad>|<red>%s</red></pad>]", 42, "ab");
+  ASSERT_STR_EQ(buf, "[   42|ab    ]");
+
+  crsprintf(buf, sizeof(buf), "[<rpad=10><pad=4>x</pad><rpad=3>%s</rpad></rpad>]", "yz");
+  ASSERT_STR_EQ(buf, "[   x    yz]");
+  
+  crprintf_set_color(true);
+  crsprintf(buf, sizeof(buf), "<rpad=6><bold>%d</bold></rpad>", 7);
+  ASSERT_STR_EQ(buf, "     \x1b[0m\x1b[1m7\x1b[0m");
+
+  char *listing = NULL;
+  size_t len = 0;
+  FILE *mem = open_memstream(&listing, &len);
+  
+  crprintf_compiled *prog = crprintf_compile("<rpad=8><pad=3>ab</pad>%d</rpad>");
+  crprintf_disasm(prog, mem);
+  fclose(mem);
+
+  ASSERT_EQ(strstr(listing, "RPAD_BEGIN") != NULL, true);
+  ASSERT_EQ(strstr(listing, " PAD_BEGIN") == NULL, true);
+  ASSERT_EQ(strstr(listing, "EMIT_SPACES      1") != NULL, true);
+  
+  free(listing);
+  crprintf_compiled_free(prog);
+}
+
+TEST(pad_counts_terminal_columns) {
+  char buf[128];
+  crprintf_set_color(false);
+
+  crsprintf(buf, sizeof(buf), "[<pad=6>%s</pad>]", "\xe6\x97\xa5\xe6\x9c\xac");
+  ASSERT_STR_EQ(buf, "[\xe6\x97\xa5\xe6\x9c\xac  ]");
+
+  crsprintf(buf, sizeof(buf), "[<rpad=4>%s</rpad>]", "e\xcc\x81");
+  ASSERT_STR_EQ(buf, "[   e\xcc\x81]");
+  
+  crsprintf(buf, sizeof(buf), "[<pad=20>%s</pad>]", "\xf0\x9f\x9a\x80 long ascii tail");
+  ASSERT_STR_EQ(buf, "[\xf0\x9f\x9a\x80 long ascii tail  ]");
+
+  crprintf_set_color(true);
+}
+
+TEST(long_literal_templates) {
+  char fmt[1200], want[1200], got[1200];
+  size_t f = 0, w = 0;
+  
+  for (int i = 0; f < 1000; i++) {
+    for (int k = 0; k < i % 37; k++) fmt[f++] = want[w++] = (char)('a' + k % 26);
+    if (i % 3 == 0) { memcpy(fmt + f, "<<", 2); f += 2; want[w++] = '<'; }
+    if (i % 5 == 0) { memcpy(fmt + f, "{'x'}", 5); f += 5; want[w++] = 'x'; }
+    if (i % 7 == 0) { memcpy(fmt + f, "%%>", 3); f += 3; memcpy(want + w, "%>", 2); w += 2; }
+  }
+  fmt[f] = want[w] = '\0';
+
+  crprintf_set_color(false);
+  crprintf_compiled *prog = crprintf_compile(fmt);
+  ASSERT_EQ(crsprintf_compiled(got, sizeof(got), NULL, prog), (int)w);
+  ASSERT_STR_EQ(got, want);
+  crprintf_compiled_free(prog);
+  crprintf_set_color(true);
+}
+
+TEST(style_names_resolve) {
+  static const struct { const char *name; int code; } names[] = {
+    {"black", 30}, {"red", 31}, {"green", 32}, {"yellow", 33}, {"blue", 34},
+    {"magenta", 35}, {"cyan", 36}, {"white", 37}, {"gray", 90}, {"grey", 90},
+    {"bright_red", 91}, {"bright_green", 92}, {"bright_yellow", 93}, {"bright_blue", 94},
+    {"bright_magenta", 95}, {"bright_cyan", 96}, {"bright_white", 97},
+    {"bg_black", 40}, {"bg_red", 41}, {"bg_green", 42}, {"bg_yellow", 43},
+    {"bg_blue", 44}, {"bg_magenta", 45}, {"bg_cyan", 46}, {"bg_white", 47},
+    {"bold", 1}, {"dim", 2}, {"ul", 4}, {"i", 3}, {"italic", 3}, {"strike", 9}, {"invert", 7},
+  };
+  
+  char fmt[64], want[64], got[64];
+  for (size_t i = 0; i < sizeof(names) / sizeof(*names); i++) {
+    snprintf(fmt, sizeof(fmt), "<%s>x</%s>", names[i].name, names[i].name);
+    snprintf(want, sizeof(want), "\x1b[0m\x1b[%dmx\x1b[0m", names[i].code);
+    crprintf_compiled *prog = crprintf_compile(fmt);
+    crsprintf_compiled(got, sizeof(got), NULL, prog);
+    ASSERT_STR_EQ(got, want);
+    crprintf_compiled_free(prog);
+  }
+
+  crsprintf(got, sizeof(got), "<bold_red_bg_blue>x</>");
+  ASSERT_STR_EQ(got, "\x1b[0m\x1b[1m\x1b[31m\x1b[44mx\x1b[0m");
+  
+  crsprintf(got, sizeof(got), "<dim+cyan+bg_gray>x</>");
+  ASSERT_STR_EQ(got, "<dim+cyan+bg_gray>x\x1b[0m");
+  
+  crsprintf(got, sizeof(got), "<bright>x<>y");
+  ASSERT_STR_EQ(got, "<bright>x<>y");
+}
+
+TEST(peephole_matches_unoptimized) {
+  char opt[256], raw[256];
+
+  for (size_t i = 0; i < sizeof(peephole_cases) / sizeof(peephole_cases[0]); i++) {
+    crprintf_compiled *fast = crprintf_compile(peephole_cases[i]);
+    crprintf_set_optimize(false);
+    crprintf_compiled *slow = crprintf_compile(peephole_cases[i]);
+    crprintf_set_optimize(true);
+
+    crprintf_state *a = crprintf_state_new();
+    crprintf_state *b = crprintf_state_new();
+    crsprintf_compiled(opt, sizeof(opt), a, fast, 3, "z");
+    crsprintf_compiled(raw, sizeof(raw), b, slow, 3, "z");
+    squash_escapes(opt);
+    squash_escapes(raw);
+    ASSERT_STR_EQ(opt, raw);
+    ASSERT_EQ(crprintf_state_eq(a, b), true);
+
+    crprintf_state_free(a);
+    crprintf_state_free(b);
+    crprintf_compiled_free(fast);
+    crprintf_compiled_free(slow);
+  }
+}
+
+TEST(peephole_merges_literals) {
+  char *listing = NULL;
+  size_t len = 0;
+  FILE *mem = open_memstream(&listing, &len);
+
+  crprintf_compiled *prog = crprintf_compile("a<<b%%c{'x'}d>>e");
+  crprintf_disasm(prog, mem);
+  fclose(mem);
+
+  ASSERT_EQ(strstr(listing, "2 instructions") != NULL, true);
+  ASSERT_EQ(strstr(listing, "\"a<b%cxd>e\"") != NULL, true);
+
+  free(listing);
+  crprintf_compiled_free(prog);
+}
+
+TEST(recompile_after_peephole) {
+  static const char *edits[][2] = {
+    { "<bold><red>x</red>",        "<bold>y<red>x</red>" },
+    { "<red></red><blue>z",        "<red>w</red><blue>z" },
+    { "a<<b<<c",                   "a<<b<<cd" },
+    { "<green>%d<red><blue>!",     "<green>%d<red>?<blue>!" },
+  };
+  char buf[256], want[256];
+
+  for (size_t i = 0; i < sizeof(edits) / sizeof(edits[0]); i++) {
+    crprintf_compiled *prog = crprintf_recompile(NULL, edits[i][0]);
+    prog = crprintf_recompile(prog, edits[i][1]);
+    crsprintf_compiled(buf, sizeof(buf), NULL, prog, 1);
+
+    crprintf_compiled *fresh = crprintf_compile(edits[i][1]);
+    crsprintf_compiled(want, sizeof(want), NULL, fresh, 1);
+    ASSERT_STR_EQ(buf, want);
+
+    crprintf_compiled_free(prog);
+    crprintf_compiled_free(fresh);
+  }
+}
+
 TEST(state_new_is_clean) {
   crprintf_state *s = crprintf_state_new();
   crprintf_state *empty = crprintf_state_new();
@@ -260,6 +1390,105 @@ TEST(state_eq_null_handling) {
   crprintf_state_free(s);
 }
 
+static crprintf_bundle *write_bundle(const char **fmts, size_t count, char **data, size_t *size) {
+  crprintf_compiled *progs[8];
+  for (size_t i = 0; i < count; i++) progs[i] = crprintf_compile(fmts[i]);
+
+  FILE *mem = open_memstream(data, size);
+  int rc = crprintf_bundle_write(mem, progs, fmts, count);
+  fclose(mem);
+  
+  for (size_t i = 0; i < count; i++) crprintf_compiled_free(progs[i]);
+  return rc == 0 ? crprintf_bundle_load(*data, *size) : NULL;
+}
+
+TEST(bundle_round_trip) {
+  const char *fmts[] = { "<bold>hi</bold> %d", "<pad=6>%d</pad>|", "[{bundle_var}] %d", "plain <red>text</red>" };
+  char want[64], got[64], *data = NULL;
+  size_t size = 0;
+  crprintf_var("bundle_var", "<green>v</green>");
+  
+  crprintf_bundle *b = write_bundle(fmts, 4, &data, &size);
+  ASSERT_EQ(b != NULL, 1);
+  ASSERT_EQ((int)crprintf_bundle_count(b), 4);
+  ASSERT_EQ(crprintf_bundle_find(b, "nope") == NULL, 1);
+  
+  for (int i = 0; i < 4; i++) {
+    crprintf_compiled *ref = crprintf_compile(fmts[i]);
+    crprintf_compiled *loaded = crprintf_bundle_find(b, fmts[i]);
+    ASSERT_EQ(loaded == crprintf_bundle_get(b, (size_t)i), 1);
+    crsprintf_compiled(want, sizeof(want), NULL, ref, 42);
+    crsprintf_compiled(got, sizeof(got), NULL, loaded, 42);
+    ASSERT_STR_EQ(got, want);
+    crprintf_compiled_free(ref);
+  }
+  crprintf_bundle_close(b);
+  
+  char path[] = "/tmp/crprintf_bundle_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_EQ(fd >= 0, 1);
+  ASSERT_EQ(write(fd, data, size) == (ssize_t)size, 1);
+  close(fd);
+  
+  b = crprintf_bundle_open(path);
+  unlink(path);
+  ASSERT_EQ(b != NULL, 1);
+  crsprintf_compiled(got, sizeof(got), NULL, crprintf_bundle_find(b, "<pad=6>%d</pad>|"), 7);
+  ASSERT_STR_EQ(got, "7     |");
+  crprintf_bundle_close(b);
+  free(data);
+}
+
+TEST(bundle_rejects_corruption) {
+  const char *fmts[] = { "<bold>hi</bold> %d", "<rpad=5>%x</rpad>{bundle_var}", "x" };
+  char *data = NULL, *copy, got[128];
+  size_t size = 0;
+  crprintf_var("bundle_var", "<green>v</green>");
+  
+  crprintf_bundle *b = write_bundle(fmts, 3, &data, &size);
+  ASSERT_EQ(b != NULL, 1);
+  crprintf_bundle_close(b);
+  
+  // every single-bit flip either fails to load or still renders safely
+  copy = malloc(size);
+  for (size_t i = 0; i < size; i++) {
+    for (int bit = 0; bit < 8; bit++) {
+      memcpy(copy, data, size);
+      copy[i] ^= (char)(1 << bit);
+      crprintf_bundle *c = crprintf_bundle_load(copy, size);
+      for (size_t k = 0; c && k < crprintf_bundle_count(c); k++)
+        crsprintf_compiled(got, sizeof(got), NULL, crprintf_bundle_get(c, k), 1);
+      crprintf_bundle_close(c);
+    }
+  }
+  
+  ASSERT_EQ(crprintf_bundle_load(data, size - 1) == NULL, 1);
+  ASSERT_EQ(crprintf_bundle_load(data, 8) == NULL, 1);
+  free(copy);
+  free(data);
+}
+
+TEST(static_bundles_bind_call_sites) {
+  const char *fmts[] = { "<cyan>static</cyan> %d" };
+  char *data = NULL, buf[64];
+  size_t size = 0;
+  crprintf_bundle *probe = write_bundle(fmts, 1, &data, &size);
+  crprintf_bundle_close(probe);
+
+  crprintf_bundle *b = crprintf_register_static(data, size);
+  ASSERT_EQ(b != NULL, 1);
+
+  crprintf_compiled *slot = NULL, *other = NULL;
+  ASSERT_EQ(crprintf_compile_once(&slot, fmts[0]) == crprintf_bundle_find(b, fmts[0]), 1);
+  ASSERT_EQ(crprintf_compile_once(&other, "<cyan>dynamic</cyan>") != NULL, 1);
+  
+  crprintf_set_color(false);
+  crsprintf_compiled(buf, sizeof(buf), NULL, slot, 5);
+  ASSERT_STR_EQ(buf, "static 5");
+  crprintf_set_color(true);
+  crprintf_compiled_free(other);
+}
+
 TEST(compiled_basic) {
   char buf[256];
   crprintf_set_color(false);
@@ -363,7 +1592,39 @@ int main(void) {
   RUN_TEST(extra_styles);
   RUN_TEST(reset);
   RUN_TEST(variables);
+  RUN_TEST(variables_without_limits);
+  RUN_TEST(compiled_programs_bind_vars_late);
+  RUN_TEST(bytecode_wide_operands);
+  RUN_TEST(compiled_programs_are_packed);
+  RUN_TEST(format_cache_reuses_programs);
+  RUN_TEST(concurrent_var_updates);
   RUN_TEST(buffer_overflow);
+  RUN_TEST(buffer_truncation_counts_padding);
+  RUN_TEST(stream_output_reuses_arena);
+  RUN_TEST(concurrent_first_compile);
+  RUN_TEST(folded_styles_match_runtime);
+  RUN_TEST(constant_program_output);
+  RUN_TEST(native_formats_match_snprintf);
+  RUN_TEST(format_args_from_descriptor);
+  RUN_TEST(typed_args_read_without_va_list);
+  RUN_TEST(batch_matches_per_row);
+  RUN_TEST(batch_carries_style_across_rows);
+  RUN_TEST(batch_counts_conversions_in_vars);
+  RUN_TEST(batch_passes_wide_strings);
+  RUN_TEST(table_sizes_columns_to_widest_cell);
+  RUN_TEST(table_caps_clip_cells);
+  RUN_TEST(table_measures_long_cells);
+  RUN_TEST(async_sink_keeps_lines_whole);
+  RUN_TEST(async_sink_overflow_policies);
+  RUN_TEST(async_defer_matches_rendered);
+  RUN_TEST(async_defer_copies_arguments);
+  RUN_TEST(trace_log_replays_records);
+  RUN_TEST(peephole_matches_unoptimized);
+  RUN_TEST(peephole_merges_literals);
+  RUN_TEST(nested_pads_track_columns);
+  RUN_TEST(pad_counts_terminal_columns);
+  RUN_TEST(long_literal_templates);
+  RUN_TEST(style_names_resolve);
 
   printf("\n--- stateful ---\n");
   RUN_TEST(state_new_is_clean);
@@ -376,10 +1637,14 @@ int main(void) {
 
   printf("\n--- compiled / recompile ---\n");
   RUN_TEST(compiled_basic);
+  RUN_TEST(bundle_round_trip);
+  RUN_TEST(bundle_rejects_corruption);
+  RUN_TEST(static_bundles_bind_call_sites);
   RUN_TEST(recompile_identity);
   RUN_TEST(recompile_tail_edit);
   RUN_TEST(recompile_middle_edit);
   RUN_TEST(recompile_from_null);
+  RUN_TEST(recompile_after_peephole);
   RUN_TEST(compiled_with_state);
   
   printf("\n=== Results: %d/%d tests passed ===\n", pass_count, test_count);
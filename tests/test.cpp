@@ -0,0 +1,273 @@
+#include <crprintf.hpp>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <math.h>
+#include <string>
+#include <string_view>
+
+using namespace crp::literals;
+
+static int test_count = 0;
+static int pass_count = 0;
+
+#define TEST(name) static void test_##name(void)
+#define RUN_TEST(name) do { \
+  printf("Running %s... ", #name); \
+  int _before = fail_count; \
+  test_##name(); \
+  test_count++; \
+  if (fail_count == _before) { pass_count++; printf("PASS\n"); } \
+} while(0)
+
+static int fail_count = 0;
+
+#define ASSERT_EQ(a, b) do { \
+  if ((a) != (b)) { \
+    printf("FAIL: %s:%d: expected %d, got %d\n", __FILE__, __LINE__, (int)(b), (int)(a)); \
+    fail_count++; return; \
+  } \
+} while(0)
+
+#define ASSERT_STR_EQ(a, b) do { \
+  if (strcmp((a), (b)) != 0) { \
+    printf("FAIL: %s:%d: expected \"%s\", got \"%s\"\n", __FILE__, __LINE__, (b), (a)); \
+    fail_count++; return; \
+  } \
+} while(0)
+
+// renders fmt through the consteval program and the C compiler, with and without color
+#define ASSERT_SAME(fmt, ...) do { \
+  char _got[512], _want[512]; \
+  crprintf_compiled *_prog = crprintf_compile(fmt); \
+  for (int _plain = 0; _plain < 2; _plain++) { \
+    crprintf_set_color(!_plain); \
+    int _gn = crp::sprintf(_got, sizeof(_got), fmt ""_crp, ##__VA_ARGS__); \
+    int _wn = crsprintf_compiled(_want, sizeof(_want), NULL, _prog, ##__VA_ARGS__); \
+    crprintf_set_color(true); \
+    ASSERT_STR_EQ(_got, _want); \
+    ASSERT_EQ(_gn, _wn); \
+  } \
+  crprintf_compiled_free(_prog); \
+} while(0)
+
+// programs the C compiler neither pre-renders nor resolves pads in serialize to the same bytes
+#define ASSERT_SAME_IMAGE(fmt) do { \
+  using _F = decltype(fmt ""_crp); \
+  unsigned char _img[1024]; \
+  crprintf_compiled *_prog = crprintf_compile(fmt); \
+  size_t _n = crprintf_serialize(_prog, _img, sizeof(_img)); \
+  crprintf_compiled_free(_prog); \
+  ASSERT_EQ(_n, _F::image.size()); \
+  ASSERT_EQ(memcmp(_img, _F::image.data(), _n), 0); \
+} while(0)
+
+// renders through crp::format_to's typed arguments and through the va_list path
+#define ASSERT_TYPED(fmt, ...) do { \
+  char _got[512], _want[512]; \
+  crprintf_compiled *_prog = crprintf_compile(fmt); \
+  int _gn = crp::format_to(_got, sizeof(_got), fmt ""_crp, ##__VA_ARGS__); \
+  int _wn = crsprintf_compiled(_want, sizeof(_want), NULL, _prog, ##__VA_ARGS__); \
+  crprintf_compiled_free(_prog); \
+  ASSERT_STR_EQ(_got, _want); \
+  ASSERT_EQ(_gn, _wn); \
+} while(0)
+
+static_assert(crp::args_match<decltype("%d %s"_crp), int, const char *>);
+static_assert(crp::args_match<decltype("%*.*f|%c"_crp), int, int, double, char>);
+static_assert(crp::args_match<decltype("%zu %ld %p"_crp), size_t, long, void *>);
+static_assert(!crp::args_match<decltype("%d"_crp), const char *>);
+static_assert(!crp::args_match<decltype("%ld"_crp), int>);
+static_assert(!crp::args_match<decltype("%s"_crp), int>);
+static_assert(crp::args_match<decltype("%ls %lc"_crp), const wchar_t *, wchar_t>);
+static_assert(!crp::args_match<decltype("%ls"_crp), const char *>);
+static_assert(!crp::args_match<decltype("%d %d"_crp), int>);
+static_assert(decltype("<red>%d</red> %%"_crp)::args.size() == 1);
+static_assert(crp::typed_args_match<decltype("%s|%-8.3s"_crp), std::string, std::string_view>);
+static_assert(crp::typed_args_match<decltype("%s %d"_crp), const char *, short>);
+static_assert(!crp::typed_args_match<decltype("%05s"_crp), std::string_view>);
+static_assert(!crp::args_match<decltype("%s"_crp), std::string_view>);
+
+TEST(formats_match_c) {
+  ASSERT_SAME("hello world");
+  ASSERT_SAME("num: %d", 42);
+  ASSERT_SAME("str: %s", "test");
+  ASSERT_SAME("wide: %ls|%-6ls|%.2ls", L"abc", L"de", L"xyz");
+  ASSERT_SAME("hex: 0x%x", 255);
+  ASSERT_SAME("float: %.2f", 3.14);
+  ASSERT_SAME("one: %.*s two: %s", 3, "abcdef", "done");
+  ASSERT_SAME("wide: '%*s' next: %d", 5, "hi", 7);
+  ASSERT_SAME("float: %*.*f next: %s", 6, 2, 3.14159, "done");
+  ASSERT_SAME("%5d|%-5d|%05d|%08x|%#x|%+d|% d|%hd|%12.4X", -42, -42, -42, 255, 255, 7, 7, 3, 48879);
+  ASSERT_SAME("%8s|%-8s|%.2s|%6.3s|%.0s|", "hi", "hi", "hello", "hello", "x");
+  ASSERT_SAME("%ld %lld %zu %jd %lx", -5L, -9000000000LL, (size_t)77, (intmax_t)-3, 0xbeefUL);
+  ASSERT_SAME("[%*d|%-*.*s|%+.2f|%c]", 6, -17, 5, 2, "abc", 2.5, 'z');
+  ASSERT_SAME("%300.1f|%s", 1.25, "end");
+  ASSERT_SAME("<< >> %% trailing %");
+}
+
+TEST(tags_match_c) {
+  ASSERT_SAME("<red>hello</red>");
+  ASSERT_SAME("<red>%.*s</red> %s", 4, "abcdef", "ok");
+  ASSERT_SAME("<i>italic</i> <italic>italic</italic> <strike>strike</strike> <invert>invert</invert>");
+  ASSERT_SAME("<red>hello <reset/>world");
+  ASSERT_SAME("a<br/>b<br=2/>c<space=3/>d<gap=2/>e");
+  ASSERT_SAME("<bold_red_bg_blue>x</>");
+  ASSERT_SAME("<dim+cyan+bg_blue>x</>");
+  ASSERT_SAME("<bright_magenta>a</bright_magenta><bg_white>b</bg_white><grey>c");
+  ASSERT_SAME("<bold+red>hi</> there");
+  ASSERT_SAME("<bold><red>a</red>b</bold>c");
+  ASSERT_SAME("<dim_cyan>x</dim_cyan><reset/>y");
+  ASSERT_SAME("<#ff8800>o<bg_#123>p</></>q");
+  ASSERT_SAME("<ul>%d</ul> <strike+invert>%s</>", 7, "s");
+  ASSERT_SAME("<red><green><blue><yellow><cyan><magenta><white><black><gray>deep</></></></></></></></></></>");
+  ASSERT_SAME("</>unbalanced</red><i>it");
+  ASSERT_SAME("<bold><red><ul>x</ul></red></bold>");
+  ASSERT_SAME("<red></red><blue>%d</blue>", 3);
+  ASSERT_SAME("<red+blue+green>x<reset/><reset/></>y");
+  ASSERT_SAME("<bold></bold></><green>tail");
+  ASSERT_SAME("a < b");
+}
+
+TEST(pads_match_c) {
+  ASSERT_SAME("<pad=10>hi</pad>|<rpad=10>hi</rpad>|");
+  ASSERT_SAME("<pad=6><cyan>%d</cyan></pad>|", 3);
+  ASSERT_SAME("<pad=6>%d</pad>|%3s|", 42, "ab");
+  ASSERT_SAME("[<pad=12><rpad=5>%d</rpad>|<red>%s</red></pad>]", 42, "ab");
+  ASSERT_SAME("[<rpad=10><pad=4>x</pad><rpad=3>%s</rpad></rpad>]", "yz");
+  ASSERT_SAME("<rpad=6><bold>%d</bold></rpad>", 7);
+  ASSERT_SAME("[<pad=6>%s</pad>][<rpad=4>%s</rpad>]", "\xe6\x97\xa5\xe6\x9c\xac", "e\xcc\x81");
+  ASSERT_SAME("<bold>up</bold><pad=4>x</pad>!");
+}
+
+TEST(variables_match_c) {
+  ASSERT_SAME("{let v='a'}{v}{let v='b'}{v}");
+  ASSERT_SAME("<let hi=bold+red>x<$hi>y</>z");
+  ASSERT_SAME("<let hi=bold, lo=dim/><$hi+ul>x</><$lo>y");
+  ASSERT_SAME("{let w='%5d'}[{w}]", 42);
+  ASSERT_SAME("{let t='<green>go</green>'}{t}!");
+  ASSERT_SAME("{let n=MiXeD}{~n}{^n}{~'AbC'}{^'AbC'}{'x'}");
+  ASSERT_SAME("{ not a var } {%d}", 5);
+
+  crprintf_var("hpp_theme", "bold+cyan");
+  crprintf_var("hpp_name", "world");
+  ASSERT_SAME("<$hpp_theme>hello</> {hpp_name}");
+  ASSERT_SAME("{hpp_missing} <red>%s</red>", "x");
+}
+
+TEST(images_match_c) {
+  ASSERT_SAME_IMAGE("num: %d");
+  ASSERT_SAME_IMAGE("<bold><red>hi %d</red></bold> %s");
+  ASSERT_SAME_IMAGE("%ld %lld %zu %jd %lx");
+  ASSERT_SAME_IMAGE("%ls|%5.2ls|%lc");
+  ASSERT_SAME_IMAGE("[%*d|%-*.*s|%+.2f|%c]");
+  ASSERT_SAME_IMAGE("<ul>%d</ul> <strike+invert>%s</>");
+  ASSERT_SAME_IMAGE("<#ff8800>%s<bg_#123>p</></>q");
+  ASSERT_SAME_IMAGE("a<<b%%c{'x'}d>>e%d");
+  ASSERT_SAME_IMAGE("<red+blue+green>%d<reset/><reset/></>y");
+}
+
+TEST(typed_args_match_va_list) {
+  crprintf_set_color(false);
+  ASSERT_TYPED("num: %d %u %x %X %5d|%-5d|%05d|%.3d", -42, 42u, 255u, 48879, 7, 7, -7, 3);
+  ASSERT_TYPED("%ld %lld %zu %jd %lx %lu", -5L, -9000000000LL, (size_t)77, (intmax_t)-3, 0xbeefUL, 3000000000UL);
+  ASSERT_TYPED("%+d|% d|%#x|%#o|%#X|%hd|%hhu|%hx|%5.3d|%-+6d|%+05d|%.0d|%#.0o", 42, 42, 255, 8, 255, 70000, 300, -1, 7, 9, -3, 0, 0);
+  ASSERT_TYPED("%+lld|%020llx|%-12zu|%hhd|%jx", -9000000000LL, 0xdeadbeefcafeULL, (size_t)12, 300, (intmax_t)255);
+  ASSERT_TYPED("[%*d|%-*.*s|%+.2f|%c|%-4c|%3c]", 6, -17, 5, 2, "abc", 2.5, 'z', 'y', 'x');
+  ASSERT_TYPED("%f %.2f %10.3f %-10.1f| %+e %.0e %E %g %G %.3g %+08.2f % f", 3.14159, -2.5, 1e6, 0.05, 12345.678, 0.5, 1e-10, 0.0001, 1e20, 100.0, -1.5, 0.0);
+  ASSERT_TYPED("%f %e %g %5.1f %-8f|", -0.0, 1e300, 1e-300, INFINITY, NAN);
+  ASSERT_TYPED("%f|%100.2f|%.60f|%#g|%a", 1e300, 1.5, 0.1, 2.0, 1.0);
+  ASSERT_TYPED("<bold>%s</bold> %.2s|%8s|%-8s|%.0s|%s", "hi", "hello", "r", "l", "x", (const char *)NULL);
+  ASSERT_TYPED("%p %p %c%c%%", (void *)0x1234, (void *)NULL, 'o', 'k');
+  ASSERT_TYPED("%ls|%-6ls|%.2ls|%lc", L"abc", L"de", L"xyz", L'w');
+  ASSERT_TYPED("<pad=12><rpad=5>%+d</rpad>|<red>%.1f</red></pad>]", 42, 2.25);
+  crprintf_set_color(true);
+  ASSERT_TYPED("<green>%#x</green> <pad=10>%-3c</pad>|", 255, 'q');
+}
+
+TEST(typed_args_take_text) {
+  char buf[64];
+  std::string owned = "owned";
+  std::string_view view = std::string_view("view-but-longer").substr(0, 4);
+  crprintf_set_color(false);
+
+  crp::format_to(buf, sizeof(buf), "[%s|%-6s|%6.3s|%.9s]"_crp, owned, view, owned, std::string_view("ab\0cd", 5));
+  ASSERT_EQ(memcmp(buf, "[owned|view  |   own|ab\0cd]", 28), 0);
+
+  int n = crp::format_to(buf, 8, "%s and %+d more"_crp, owned, 12);
+  ASSERT_STR_EQ(buf, "owned a");
+  ASSERT_EQ(n, 18);
+
+  char *out = NULL;
+  size_t len = 0;
+  FILE *mem = open_memstream(&out, &len);
+  n = crp::print(mem, "<red>%s</red> %05.1f %#o\n"_crp, view, 2.25, 8);
+  fclose(mem);
+  ASSERT_STR_EQ(out, "view 002.2 010\n");
+  ASSERT_EQ(n, 15);
+  free(out);
+
+  crprintf_set_color(true);
+}
+
+TEST(globals_bind_late) {
+  char buf[64];
+  crprintf_set_color(false);
+
+  crprintf_var("hpp_late", "first");
+  crp::sprintf(buf, sizeof(buf), "[{hpp_late}]"_crp);
+  ASSERT_STR_EQ(buf, "[first]");
+
+  crprintf_var("hpp_late", "<bold>second</bold>");
+  crp::sprintf(buf, sizeof(buf), "[{hpp_late}]"_crp);
+  ASSERT_STR_EQ(buf, "[second]");
+
+  crprintf_set_color(true);
+}
+
+#define BIND_THREADS 8
+
+static pthread_barrier_t bind_barrier;
+static crprintf_compiled *bound[BIND_THREADS];
+
+static void *bind_worker(void *arg) {
+  pthread_barrier_wait(&bind_barrier);
+  bound[(intptr_t)arg] = decltype("<green>%s</green> raced"_crp)::get();
+  return NULL;
+}
+
+TEST(first_bind_is_shared) {
+  pthread_t threads[BIND_THREADS];
+  pthread_barrier_init(&bind_barrier, NULL, BIND_THREADS);
+
+  for (intptr_t i = 0; i < BIND_THREADS; i++) pthread_create(&threads[i], NULL, bind_worker, (void *)i);
+  for (int i = 0; i < BIND_THREADS; i++) pthread_join(threads[i], NULL);
+  pthread_barrier_destroy(&bind_barrier);
+
+  for (int i = 1; i < BIND_THREADS; i++) ASSERT_EQ(bound[i] == bound[0], true);
+
+  char buf[64];
+  crprintf_set_color(false);
+  crsprintf_compiled(buf, sizeof(buf), NULL, bound[0], "go");
+  crprintf_set_color(true);
+  ASSERT_STR_EQ(buf, "go raced");
+}
+
+int main(void) {
+  printf("=== crprintf.hpp tests ===\n\n");
+
+  RUN_TEST(formats_match_c);
+  RUN_TEST(tags_match_c);
+  RUN_TEST(pads_match_c);
+  RUN_TEST(variables_match_c);
+  RUN_TEST(images_match_c);
+  RUN_TEST(typed_args_match_va_list);
+  RUN_TEST(typed_args_take_text);
+  RUN_TEST(globals_bind_late);
+  RUN_TEST(first_bind_is_shared);
+
+  printf("\n=== Results: %d/%d tests passed ===\n", pass_count, test_count);
+
+  return (pass_count == test_count) ? 0 : 1;
+}
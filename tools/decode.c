@@ -0,0 +1,59 @@
+// crprintf-decode: renders a binary trace log written with crprintf_trace_write
+//
+//   crprintf-decode [--color | --no-color] [--time] [log]
+//
+// reads stdin without a log. color follows whether stdout is a terminal
+// unless forced; --time puts each record's UTC timestamp in front of it
+#include <crprintf.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char *read_stream(FILE *f, size_t *len) {
+  size_t cap = 1 << 16, n = 0, got;
+  char *buf = malloc(cap);
+  while (buf && (got = fread(buf + n, 1, cap - n, f)) > 0) {
+    n += got;
+    if (n == cap) buf = realloc(buf, cap *= 2);
+  }
+
+  *len = n;
+  return buf;
+}
+
+int main(int argc, char **argv) {
+  const char *path = NULL;
+  bool color = isatty(STDOUT_FILENO), timestamps = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--color") == 0) color = true;
+    else if (strcmp(argv[i], "--no-color") == 0) color = false;
+    else if (strcmp(argv[i], "--time") == 0) timestamps = true;
+    else if (!path && argv[i][0] != '-') path = argv[i];
+    else {
+      fprintf(stderr, "usage: crprintf-decode [--color | --no-color] [--time] [log]\n");
+      return 2;
+    }
+  }
+
+  FILE *in = path ? fopen(path, "rb") : stdin;
+  if (!in) { fprintf(stderr, "crprintf-decode: cannot read %s\n", path); return 1; }
+
+  size_t len;
+  char *data = read_stream(in, &len);
+  if (in != stdin) fclose(in);
+  if (!data) { fprintf(stderr, "crprintf-decode: out of memory\n"); return 1; }
+
+  crprintf_set_color(color);
+  int records = crprintf_trace_decode(data, len, stdout, timestamps);
+  free(data);
+  if (fflush(stdout) != 0) return 1;
+
+  // the records before a torn or corrupt one have still been printed
+  if (records < 0) {
+    fprintf(stderr, "crprintf-decode: %s is not a trace log, or is truncated\n", path ? path : "input");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,327 @@
+// crprintf-precompile: compiles format literals at build time into a bundle
+// that is linked into the program and registered before main
+//
+//   crprintf-precompile [-o out.c] input...
+//
+// inputs ending in .crp are manifests; anything else is scanned as C source
+// for crprintf/crfprintf/crsprintf calls whose format is a string literal.
+// a manifest holds one C string literal per line, plus variable lines:
+//
+//   # prompt styles
+//   var accent = "bold+cyan"
+//   "<$accent>❯</> %s "
+//
+// compiled together with the library source so program internals are reachable
+#include "../src/crprintf.c"
+
+typedef struct {
+  char **items;
+  size_t count, cap;
+} list_t;
+
+static list_t formats, var_names, var_values;
+
+static void list_push(list_t *l, char *s) {
+  if (l->count == l->cap) {
+    l->cap = l->cap ? l->cap * 2 : 16;
+    l->items = realloc(l->items, l->cap * sizeof(char *));
+    if (!l->items) { fprintf(stderr, "crprintf-precompile: out of memory\n"); exit(1); }
+  }
+  l->items[l->count++] = s;
+}
+
+static bool list_has(const list_t *l, const char *s) {
+  for (size_t i = 0; i < l->count; i++) if (strcmp(l->items[i], s) == 0) return true;
+  return false;
+}
+
+static char *read_file(const char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (!f) return NULL;
+
+  size_t cap = 4096, n = 0, got;
+  char *buf = malloc(cap + 1);
+  while (buf && (got = fread(buf + n, 1, cap - n, f)) > 0) {
+    n += got;
+    if (n == cap) buf = realloc(buf, (cap *= 2) + 1);
+  }
+  fclose(f);
+
+  if (!buf) return NULL;
+  buf[n] = '\0';
+  *len = n;
+  return buf;
+}
+
+static const char *skip_space(const char *p, const char *end) {
+  for (;;) {
+    while (p < end && isspace((unsigned char)*p)) p++;
+    if (p + 1 < end && p[0] == '/' && p[1] == '/') { while (p < end && *p != '\n') p++; continue; }
+    if (p + 1 < end && p[0] == '/' && p[1] == '*') {
+      const char *close = strstr(p + 2, "*/");
+      p = close ? close + 2 : end;
+      continue;
+    }
+    return p;
+  }
+}
+
+// skips a string or character literal starting at its opening quote
+static const char *skip_quoted(const char *p, const char *end) {
+  char q = *p++;
+  while (p < end && *p != q && *p != '\n') p += (*p == '\\' && p + 1 < end) ? 2 : 1;
+  return p < end ? p + 1 : end;
+}
+
+// appends one decoded C string literal; false on escapes the compiler can't take
+static bool decode_literal(const char **pp, const char *end, char **out, size_t *len, size_t *cap) {
+  const char *p = *pp + 1;
+
+  while (p < end && *p != '"') {
+    if (*p == '\n') return false;
+    if (*len + 4 >= *cap) *out = realloc(*out, *cap *= 2);
+
+    char c = *p++;
+    if (c == '\\' && p < end) {
+      c = *p++;
+      switch (c) {
+        case 'n': c = '\n'; break;
+        case 't': c = '\t'; break;
+        case 'r': c = '\r'; break;
+        case 'a': c = '\a'; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'v': c = '\v'; break;
+        case 'e': c = '\x1b'; break;
+        case '\\': case '\'': case '"': case '?': break;
+        case 'x': {
+          unsigned v = 0;
+          if (p >= end || !isxdigit((unsigned char)*p)) return false;
+          while (p < end && isxdigit((unsigned char)*p)) v = v * 16 + (unsigned)hex_digit(*p++);
+          c = (char)v;
+          break;
+        }
+        default: {
+          if (c < '0' || c > '7') return false;
+          unsigned v = (unsigned)(c - '0');
+          for (int k = 0; k < 2 && p < end && *p >= '0' && *p <= '7'; k++) v = v * 8 + (unsigned)(*p++ - '0');
+          c = (char)v;
+          break;
+        }
+      }
+      if (c == '\0') return false;
+    }
+    (*out)[(*len)++] = c;
+  }
+
+  if (p >= end) return false;
+  *pp = p + 1;
+  return true;
+}
+
+// adjacent literals concatenate; NULL unless the whole argument is literals
+static char *parse_literals(const char **pp, const char *end) {
+  size_t len = 0, cap = 64;
+  char *out = malloc(cap);
+  const char *p = *pp;
+  bool any = false;
+
+  while ((p = skip_space(p, end)) < end && *p == '"') {
+    if (!decode_literal(&p, end, &out, &len, &cap)) { free(out); return NULL; }
+    any = true;
+  }
+
+  if (!any || p >= end || (*p != ',' && *p != ')')) { free(out); return NULL; }
+  out[len] = '\0';
+  *pp = p;
+  return out;
+}
+
+// skips one macro argument up to the comma that ends it
+static const char *skip_arg(const char *p, const char *end) {
+  int depth = 0;
+  while (p < end) {
+    if (*p == '"' || *p == '\'') { p = skip_quoted(p, end); continue; }
+    if (*p == '(' || *p == '[' || *p == '{') depth++;
+    else if (*p == ')' || *p == ']' || *p == '}') { if (depth-- == 0) return NULL; }
+    else if (*p == ',' && depth == 0) return p + 1;
+    p++;
+  }
+  return NULL;
+}
+
+static void scan_source(const char *src, size_t n) {
+  static const struct { const char *name; size_t len; int skip; } calls[] = {
+    { "crprintf", 8, 0 }, { "crfprintf", 9, 1 }, { "crsprintf", 9, 2 },
+  };
+  const char *end = src + n;
+
+  for (const char *p = src; p < end;) {
+    if (*p == '"' || *p == '\'') { p = skip_quoted(p, end); continue; }
+    if (p + 1 < end && *p == '/' && (p[1] == '/' || p[1] == '*')) { p = skip_space(p, end); continue; }
+    if (!isalpha((unsigned char)*p) && *p != '_') { p++; continue; }
+
+    const char *id = p;
+    while (p < end && (isalnum((unsigned char)*p) || *p == '_')) p++;
+    if (id > src && (isalnum((unsigned char)id[-1]) || id[-1] == '_')) continue;
+
+    for (size_t k = 0; k < sizeof(calls) / sizeof(*calls); k++) {
+      if ((size_t)(p - id) != calls[k].len || memcmp(id, calls[k].name, calls[k].len)) continue;
+
+      const char *arg = skip_space(p, end);
+      if (arg >= end || *arg++ != '(') break;
+      for (int s = 0; arg && s < calls[k].skip; s++) arg = skip_arg(arg, end);
+      if (!arg) break;
+
+      char *fmt = parse_literals(&arg, end);
+      if (fmt && !list_has(&formats, fmt)) list_push(&formats, fmt);
+      else free(fmt);
+      break;
+    }
+  }
+}
+
+static bool parse_manifest(const char *path, char *src) {
+  int line = 0;
+  for (char *p = src, *next; p && *p; p = next) {
+    line++;
+    next = strchr(p, '\n');
+    if (next) *next++ = '\0';
+
+    const char *end = p + strlen(p);
+    const char *q = skip_space(p, end);
+    if (q == end || *q == '#') continue;
+
+    if (strncmp(q, "var ", 4) == 0) {
+      const char *name = skip_space(q + 4, end), *ne = name;
+      while (ne < end && (isalnum((unsigned char)*ne) || *ne == '_' || *ne == '-')) ne++;
+      const char *eq = skip_space(ne, end);
+      if (ne == name || eq == end || *eq != '=') goto bad;
+
+      const char *val = skip_space(eq + 1, end);
+      size_t len = 0, cap = 64;
+      char *value = malloc(cap);
+      if (*val == '"') {
+        if (!decode_literal(&val, end, &value, &len, &cap)) { free(value); goto bad; }
+      } else {
+        while (end > val && isspace((unsigned char)end[-1])) end--;
+        len = (size_t)(end - val);
+        if (len + 1 > cap) value = realloc(value, len + 1);
+        memcpy(value, val, len);
+      }
+      value[len] = '\0';
+
+      char *copy = malloc((size_t)(ne - name) + 1);
+      memcpy(copy, name, (size_t)(ne - name));
+      copy[ne - name] = '\0';
+      list_push(&var_names, copy);
+      list_push(&var_values, value);
+      crprintf_var(var_names.items[var_names.count - 1], value);
+      continue;
+    }
+
+    if (*q == '"') {
+      size_t len = 0, cap = 64;
+      char *fmt = malloc(cap);
+      if (!decode_literal(&q, end, &fmt, &len, &cap)) { free(fmt); goto bad; }
+      fmt[len] = '\0';
+      if (!list_has(&formats, fmt)) list_push(&formats, fmt);
+      else free(fmt);
+      continue;
+    }
+
+  bad:
+    fprintf(stderr, "%s:%d: expected a format literal or 'var name = value'\n", path, line);
+    return false;
+  }
+  return true;
+}
+
+static void emit_c_string(FILE *out, const char *s) {
+  fputc('"', out);
+  for (; *s; s++) {
+    unsigned char c = (unsigned char)*s;
+    if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+    else if (c < 0x20 || c == 0x7f) fprintf(out, "\\%03o", c);
+    else fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+static bool has_ext(const char *path, const char *ext) {
+  size_t n = strlen(path), e = strlen(ext);
+  return n >= e && strcmp(path + n - e, ext) == 0;
+}
+
+int main(int argc, char **argv) {
+  const char *out_path = NULL;
+  list_t inputs = {0};
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) out_path = argv[++i];
+    else list_push(&inputs, argv[i]);
+  }
+
+  if (!inputs.count) {
+    fprintf(stderr, "usage: crprintf-precompile [-o out.c] input...\n");
+    return 2;
+  }
+
+  // manifests first, so their variables are defined before any format compiles
+  for (int pass = 0; pass < 2; pass++) {
+    for (size_t i = 0; i < inputs.count; i++) {
+      const char *path = inputs.items[i];
+      if (has_ext(path, ".crp") != (pass == 0)) continue;
+
+      size_t n;
+      char *src = read_file(path, &n);
+      if (!src) { fprintf(stderr, "crprintf-precompile: cannot read %s\n", path); return 1; }
+      if (pass == 0 && !parse_manifest(path, src)) return 1;
+      if (pass == 1) scan_source(src, n);
+      free(src);
+    }
+  }
+
+  // formats that name variables the manifest doesn't define stay runtime-compiled
+  crprintf_compiled **progs = calloc(formats.count + 1, sizeof(*progs));
+  const char **keys = calloc(formats.count + 1, sizeof(*keys));
+  size_t kept = 0;
+
+  for (size_t i = 0; i < formats.count; i++) {
+    crprintf_compiled *prog = crprintf_compile(formats.items[i]);
+    if (prog->unresolved || !crprintf_serialize(prog, NULL, 0)) { crprintf_compiled_free(prog); continue; }
+    progs[kept] = prog;
+    keys[kept++] = formats.items[i];
+  }
+
+  char *data = NULL;
+  size_t size = 0;
+  FILE *mem = open_memstream(&data, &size);
+  if (!mem || crprintf_bundle_write(mem, progs, keys, kept) != 0) {
+    fprintf(stderr, "crprintf-precompile: cannot serialize bundle\n");
+    return 1;
+  }
+  fclose(mem);
+
+  FILE *out = out_path ? fopen(out_path, "w") : stdout;
+  if (!out) { fprintf(stderr, "crprintf-precompile: cannot write %s\n", out_path); return 1; }
+
+  fprintf(out, "// generated by crprintf-precompile: %zu of %zu formats precompiled; do not edit\n", kept, formats.count);
+  fprintf(out, "#include <crprintf.h>\n\n");
+  fprintf(out, "static const unsigned char crprintf_bundle_data[%zu] __attribute__((aligned(16))) = {", size);
+  for (size_t i = 0; i < size; i++) fprintf(out, "%s0x%02x,", (i % 12) ? " " : "\n  ", (unsigned char)data[i]);
+  fprintf(out, "\n};\n\n");
+
+  fprintf(out, "__attribute__((constructor)) static void crprintf_bundle_init(void) {\n");
+  for (size_t i = 0; i < var_names.count; i++) {
+    fprintf(out, "  crprintf_var(");
+    emit_c_string(out, var_names.items[i]);
+    fprintf(out, ", ");
+    emit_c_string(out, var_values.items[i]);
+    fprintf(out, ");\n");
+  }
+  fprintf(out, "  crprintf_register_static(crprintf_bundle_data, sizeof(crprintf_bundle_data));\n}\n");
+
+  if (out != stdout && fclose(out) != 0) return 1;
+  return 0;
+}